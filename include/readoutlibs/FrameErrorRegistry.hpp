@@ -8,15 +8,27 @@
 #ifndef READOUTLIBS_INCLUDE_READOUTLIBS_FRAMEERRORREGISTRY_HPP_
 #define READOUTLIBS_INCLUDE_READOUTLIBS_FRAMEERRORREGISTRY_HPP_
 
+#include "logging/Logging.hpp"
+#include "readoutlibs/ReadoutLogging.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint> // uint_t types
-#include <map>
 #include <mutex>
-#include <utility>
+#include <shared_mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace dunedaq {
 namespace readoutlibs {
 
+/** NOTES:
+    Error types are interned into small ids, the registry keeps one interval per id in a fixed table. A bit mask of the
+    active ids answers has_error without locks, intervals are read through a per slot sequence lock. Writers, i.e.
+    add_error and remove_errors_until, serialize on a mutex, which stays off the path of the queries.
+ */
 class FrameErrorRegistry
 {
 public:
@@ -36,40 +48,128 @@ public:
     bool operator>(const ErrorInterval& other) const { return end_ts > other.end_ts; }
   };
 
-  FrameErrorRegistry()
-    : m_errors()
-  {}
+  using error_id_t = std::size_t;
+
+  static constexpr std::size_t max_error_types = 64;
+  //! Id of "MISSING_FRAMES", interned by every registry
+  static constexpr error_id_t missing_frames = 0;
+
+  FrameErrorRegistry() { m_names.push_back("MISSING_FRAMES"); }
+
+  //! Id of an error type, new types get the next free id. All types beyond max_error_types share the last id.
+  error_id_t intern(const std::string& error_name)
+  {
+    error_id_t id = 0;
+    if (find(error_name, id)) {
+      return id;
+    }
+    std::unique_lock<std::shared_mutex> lock(m_names_mutex);
+    if (find_locked(error_name, id)) {
+      return id;
+    }
+    if (m_names.size() == max_error_types) {
+      return max_error_types - 1;
+    }
+    m_names.push_back(error_name);
+    return m_names.size() - 1;
+  }
 
-  void add_error(std::string error_name, ErrorInterval error)
+  void add_error(error_id_t id, ErrorInterval error)
   {
-    std::lock_guard<std::mutex> guard(m_error_map_mutex);
-    if (m_errors.find(error_name) == m_errors.end()) {
-      TLOG() << "Encountered new error";
+    std::lock_guard<std::mutex> guard(m_write_mutex);
+    auto& slot = m_slots[id];
+    slot.sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.start_ts.store(error.start_ts, std::memory_order_relaxed);
+    slot.end_ts.store(error.end_ts, std::memory_order_relaxed);
+    slot.sequence.fetch_add(1, std::memory_order_release);
+    auto mask = std::uint64_t(1) << id; // NOLINT(build/unsigned)
+    if ((m_active.fetch_or(mask) & mask) == 0) {
+      TLOG_DEBUG(logging::TLVL_TAKE_NOTE) << "Encountered new error with id " << id;
     }
-    m_errors.erase(error_name);
-    m_errors.insert(std::make_pair(error_name, error));
   }
 
+  void add_error(const std::string& error_name, ErrorInterval error) { add_error(intern(error_name), error); }
+
+  //! Drop all errors that ended before ts, a sweep over the active slots
   void remove_errors_until(uint64_t ts) // NOLINT(build/unsigned)
   {
-    std::lock_guard<std::mutex> guard(m_error_map_mutex);
-    for (auto it = m_errors.begin(); it != m_errors.end();) {
-      if (ts > it->second.end_ts) {
-        it = m_errors.erase(it);
-        TLOG() << "Removed error";
-      } else {
-        it++;
+    if (m_active.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> guard(m_write_mutex);
+    auto active = m_active.load(std::memory_order_relaxed);
+    while (active != 0) {
+      error_id_t id = __builtin_ctzll(active);
+      active &= active - 1;
+      if (ts > m_slots[id].end_ts.load(std::memory_order_relaxed)) {
+        m_active.fetch_and(~(std::uint64_t(1) << id)); // NOLINT(build/unsigned)
+        TLOG_DEBUG(logging::TLVL_TAKE_NOTE) << "Removed error with id " << id;
       }
     }
   }
 
-  bool has_error(std::string error_name) { return m_errors.find(error_name) != m_errors.end(); }
+  bool has_error(error_id_t id) const
+  {
+    return (m_active.load(std::memory_order_acquire) & (std::uint64_t(1) << id)) != 0; // NOLINT(build/unsigned)
+  }
+
+  //! Queries don't intern, a type that was never added has no error
+  bool has_error(const std::string& error_name) const
+  {
+    error_id_t id = 0;
+    return find(error_name, id) && has_error(id);
+  }
+
+  bool has_error() const { return m_active.load(std::memory_order_acquire) != 0; }
 
-  bool has_error() { return !m_errors.empty(); }
+  //! Copy the interval of an active error, returns false if the error is not active
+  bool get_error(error_id_t id, ErrorInterval& error) const
+  {
+    const auto& slot = m_slots[id];
+    while (true) {
+      auto before = slot.sequence.load(std::memory_order_acquire);
+      if (before % 2 == 0) {
+        error.start_ts = slot.start_ts.load(std::memory_order_relaxed);
+        error.end_ts = slot.end_ts.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) {
+          return has_error(id);
+        }
+      }
+    }
+  }
 
 private:
-  std::map<std::string, ErrorInterval> m_errors;
-  std::mutex m_error_map_mutex;
+  bool find(const std::string& error_name, error_id_t& id) const
+  {
+    std::shared_lock<std::shared_mutex> lock(m_names_mutex);
+    return find_locked(error_name, id);
+  }
+
+  bool find_locked(const std::string& error_name, error_id_t& id) const
+  {
+    for (id = 0; id < m_names.size(); ++id) {
+      if (m_names[id] == error_name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  struct Slot
+  {
+    std::atomic<std::uint32_t> sequence{ 0 }; // NOLINT(build/unsigned)
+    std::atomic<uint64_t> start_ts{ 0 };      // NOLINT(build/unsigned)
+    std::atomic<uint64_t> end_ts{ 0 };        // NOLINT(build/unsigned)
+  };
+
+  std::array<Slot, max_error_types> m_slots;
+  std::atomic<std::uint64_t> m_active{ 0 }; // NOLINT(build/unsigned)
+  std::mutex m_write_mutex;
+
+  std::vector<std::string> m_names;
+  mutable std::shared_mutex m_names_mutex;
 };
 
 } // namespace readoutlibs
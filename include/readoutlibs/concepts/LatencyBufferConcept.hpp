@@ -11,6 +11,7 @@
 #include <nlohmann/json.hpp>
 
 #include <cstddef>
+#include <utility>
 
 namespace dunedaq {
 namespace readoutlibs {
@@ -45,6 +46,22 @@ public:
   //! Move referenced object into LB
   virtual bool write(T&& element) = 0;
 
+  //! Move a batch of objects into LB, returns the number of elements written. If written is not a nullptr, it
+  //! receives pointers to the stored elements.
+  virtual std::size_t write_bulk(T* elements, std::size_t amount, const T** written)
+  {
+    std::size_t num_written = 0;
+    for (; num_written < amount; ++num_written) {
+      if (!write(std::move(elements[num_written]))) {
+        break;
+      }
+      if (written != nullptr) {
+        written[num_written] = back();
+      }
+    }
+    return num_written;
+  }
+
   //! Move object from LB to referenced
   virtual bool read(T& element) = 0;
 
@@ -60,6 +77,27 @@ public:
   //! Pop specified amount of elements from LB
   virtual void pop(std::size_t amount) = 0;
 
+  //! Pop at most amount of the oldest elements that are smaller than the referenced one, returns the number popped
+  virtual std::size_t pop_older_than(const T& element, std::size_t amount)
+  {
+    std::size_t popped = 0;
+    while (popped < amount && front() != nullptr && *front() < element) {
+      pop(1);
+      ++popped;
+    }
+    return popped;
+  }
+
+  //! Protect the oldest element and all newer ones from being popped until unpin. Returns the pin handle.
+  //! The default protects nothing, buffers that are read by requests while being cleaned up have to override the pins.
+  virtual int pin() { return 0; }
+
+  //! Release the protection of the elements older than the referenced one
+  virtual void advance_pin(int /*pin*/, const T* /*element*/) {}
+
+  //! Release a pin
+  virtual void unpin(int /*pin*/) {}
+
   //! Flush all elements from the latency buffer
   virtual void flush() = 0;
 };
@@ -11,6 +11,8 @@
 #include "opmonlib/InfoCollector.hpp"
 #include <nlohmann/json.hpp>
 
+#include <atomic>
+#include <cstddef>
 #include <string>
 
 namespace dunedaq {
@@ -48,6 +50,28 @@ public:
   virtual void preprocess_item(ReadoutType* item) = 0;
   //! Postprocess one element
   virtual void postprocess_item(const ReadoutType* item) = 0;
+  //! Preprocess a contiguous batch of elements
+  virtual void preprocess_items(ReadoutType* items, std::size_t amount)
+  {
+    for (std::size_t i = 0; i < amount; ++i) {
+      preprocess_item(&items[i]);
+    }
+  }
+  //! Number of batches that can be preprocessed concurrently with the ingest, 0 if preprocessing is synchronous
+  virtual std::size_t preprocess_window() const { return 0; }
+  //! Start preprocessing a batch, pending drops to 0 once the whole batch is preprocessed
+  virtual void preprocess_items_async(ReadoutType* items, std::size_t amount, std::atomic<std::size_t>& pending)
+  {
+    preprocess_items(items, amount);
+    pending.store(0);
+  }
+  //! Postprocess a batch of elements that were written to the latency buffer
+  virtual void postprocess_items(const ReadoutType* const* items, std::size_t amount)
+  {
+    for (std::size_t i = 0; i < amount; ++i) {
+      postprocess_item(items[i]);
+    }
+  }
 };
 
 } // namespace readoutlibs
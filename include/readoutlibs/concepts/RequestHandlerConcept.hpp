@@ -13,6 +13,7 @@
 #include "dfmessages/DataRequest.hpp"
 #include "opmonlib/InfoCollector.hpp"
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
@@ -46,6 +47,9 @@ public:
   //! Issue a data request to the request handler
   virtual void issue_request(dfmessages::DataRequest /*dr*/,
                              appfwk::DAQSink<std::pair<std::unique_ptr<daqdataformats::Fragment>, std::string>>& /*fragment_queue*/) = 0;
+  //! Notify the request handler about the newest timestamp after num_written elements went to the latency buffer,
+  //! called from the consumer
+  virtual void notify_new_data(std::uint64_t /*newest_timestamp*/, std::size_t /*num_written*/ = 1) {} // NOLINT
 
 protected:
   // Result code of requests
@@ -15,9 +15,21 @@
 
 #include "IterableQueueModel.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
 namespace dunedaq {
 namespace readoutlibs {
 
+/** NOTES:
+    Optionally the timestamps of every timestamp_stride-th slot of the ring are kept in a compact sidecar array, written
+    before the element is published. A search then runs over the 8 byte keys of the sidecar, which stay in the
+    cache, and only touches the elements themselves for the last log(timestamp_stride) steps of the galloping search.
+    The sidecar only provides the starting point of that search, so the result is the same with and without it.
+ */
 template<class T>
 class BinarySearchQueueModel : public IterableQueueModel<T>
 {
@@ -26,10 +38,55 @@ public:
     : IterableQueueModel<T>()
   {}
 
-  explicit BinarySearchQueueModel(uint32_t size) // NOLINT(build/unsigned)
-    : IterableQueueModel<T>(size)
-  {}
+  explicit BinarySearchQueueModel(uint32_t size, std::size_t timestamp_stride = 0) // NOLINT(build/unsigned)
+    : IterableQueueModel<T>(size, false)
+  {
+    allocate_timestamp_index(timestamp_stride);
+  }
+
+  bool write(T&& record) override
+  {
+    if (m_timestamp_stride > 0) {
+      index_timestamp(IterableQueueModel<T>::writeIndex_.load(std::memory_order_relaxed), record);
+    }
+    return IterableQueueModel<T>::write(std::move(record));
+  }
+
+  std::size_t write_bulk(T* records, std::size_t amount, const T** written) override
+  {
+    if (m_timestamp_stride > 0) {
+      auto const currentWrite = IterableQueueModel<T>::writeIndex_.load(std::memory_order_relaxed);
+      auto const currentRead = IterableQueueModel<T>::readIndex_.load(std::memory_order_acquire);
+      auto const size = IterableQueueModel<T>::size_;
+      std::size_t free_slots =
+        (currentRead > currentWrite) ? currentRead - currentWrite - 1 : size - currentWrite + currentRead - 1;
+      std::size_t slot = currentWrite;
+      for (std::size_t i = 0; i < std::min(amount, free_slots); ++i) {
+        index_timestamp(slot, records[i]);
+        if (++slot == size) { // NOLINT(runtime/increment_decrement)
+          slot = 0;
+        }
+      }
+    }
+    return IterableQueueModel<T>::write_bulk(records, amount, written);
+  }
+
+  void conf(const nlohmann::json& cfg) override
+  {
+    IterableQueueModel<T>::conf(cfg);
+    auto conf = cfg["latencybufferconf"].get<readoutconfig::LatencyBufferConf>();
+    allocate_timestamp_index(conf.latency_buffer_timestamp_index_stride);
+  }
+
+  void scrap(const nlohmann::json& cfg) override
+  {
+    IterableQueueModel<T>::scrap(cfg);
+    allocate_timestamp_index(0);
+  }
 
+  // Returns the last element that is not greater than the searched one (or end() if all elements are greater).
+  // The first probe is interpolated from the timestamps of the first and last element, the search then gallops
+  // from there, so the cost is logarithmic in the distance between the guess and the result.
   typename IterableQueueModel<T>::Iterator lower_bound(T& element, bool /*with_errors=false*/)
   {
     unsigned int start_index =
@@ -41,31 +98,159 @@ public:
       TLOG() << "Queue is empty" << std::endl;
       return IterableQueueModel<T>::end();
     }
-    end_index = end_index == 0 ? IterableQueueModel<T>::size_ - 1 : end_index - 1;
+    std::size_t count = end_index > start_index ? end_index - start_index
+                                                : IterableQueueModel<T>::size_ + end_index - start_index;
 
-    T& left_element = IterableQueueModel<T>::records_[start_index];
+    uint64_t timestamp = element.get_first_timestamp(); // NOLINT(build/unsigned)
+    if (m_timestamp_stride > 0) {
+      return search_from(element, start_index, count, indexed_guess(timestamp, start_index, count));
+    }
+    uint64_t first_ts = element_at(start_index, 0).get_first_timestamp();                  // NOLINT(build/unsigned)
+    uint64_t last_ts = element_at(start_index, count - 1).get_first_timestamp();           // NOLINT(build/unsigned)
+    std::size_t guess = 0;
+    if (timestamp >= last_ts) {
+      guess = count - 1;
+    } else if (timestamp > first_ts) {
+      guess = static_cast<std::size_t>(static_cast<double>(timestamp - first_ts) / (last_ts - first_ts) * (count - 1));
+    }
+    return search_from(element, start_index, count, guess);
+  }
 
-    if (element < left_element) {
-      TLOG() << "Could not find element" << std::endl;
-      return IterableQueueModel<T>::end();
+  //! The elements are sorted, so the number of elements to pop is found by a binary search
+  std::size_t pop_older_than(const T& element, std::size_t amount) override
+  {
+    unsigned int start_index =
+      IterableQueueModel<T>::readIndex_.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+    std::size_t lo = 0;
+    std::size_t hi = std::min(amount, IterableQueueModel<T>::occupancy());
+    // Invariant: the elements before lo are smaller than the referenced one, those from hi on are not popped
+    while (lo < hi) {
+      std::size_t middle = lo + (hi - lo) / 2;
+      if (element_at(start_index, middle) < element) {
+        lo = middle + 1;
+      } else {
+        hi = middle;
+      }
+    }
+    return IterableQueueModel<T>::pop_front_elements(lo);
+  }
+
+protected:
+  void allocate_timestamp_index(std::size_t timestamp_stride)
+  {
+    m_timestamp_stride = timestamp_stride;
+    m_timestamps.reset();
+    m_num_timestamps = 0;
+    if (timestamp_stride > 0) {
+      m_num_timestamps = (IterableQueueModel<T>::size_ + timestamp_stride - 1) / timestamp_stride;
+      m_timestamps.reset(new std::atomic<uint64_t>[m_num_timestamps]); // NOLINT(build/unsigned)
+    }
+  }
+
+  void index_timestamp(std::size_t slot, const T& record)
+  {
+    if (slot % m_timestamp_stride == 0) {
+      m_timestamps[slot / m_timestamp_stride].store(record.get_first_timestamp(), std::memory_order_relaxed);
+    }
+  }
+
+  //! Offset of the last indexed element that is not greater than the timestamp, 0 if there is none
+  std::size_t indexed_guess(uint64_t timestamp, unsigned int start_index, std::size_t count) // NOLINT
+  {
+    auto const size = IterableQueueModel<T>::size_;
+    std::size_t first_entry = (start_index + m_timestamp_stride - 1) / m_timestamp_stride;
+    // Position p of the search is the p-th indexed slot at or after the read index. The predicate "inside the
+    // buffer and not greater than the timestamp" holds for a prefix of the positions, its end is what we look for.
+    auto entry_of = [&](std::size_t position) {
+      std::size_t entry = first_entry + position;
+      return entry >= m_num_timestamps ? entry - m_num_timestamps : entry;
+    };
+    auto offset_of = [&](std::size_t position) {
+      std::size_t slot = entry_of(position) * m_timestamp_stride;
+      return slot >= start_index ? slot - start_index : size + slot - start_index;
+    };
+    auto holds = [&](std::size_t position) {
+      return offset_of(position) < count &&
+             m_timestamps[entry_of(position)].load(std::memory_order_relaxed) <= timestamp;
+    };
+    std::size_t lo = 0;
+    std::size_t hi = m_num_timestamps;
+    while (lo < hi) {
+      std::size_t middle = lo + (hi - lo) / 2;
+      if (holds(middle)) {
+        lo = middle + 1;
+      } else {
+        hi = middle;
+      }
+    }
+    return lo == 0 ? 0 : offset_of(lo - 1);
+  }
+
+  //! Element at the given logical offset from the read index
+  T& element_at(unsigned int start_index, std::size_t offset) // NOLINT(build/unsigned)
+  {
+    std::size_t index = start_index + offset;
+    if (index >= IterableQueueModel<T>::size_) {
+      index -= IterableQueueModel<T>::size_;
+    }
+    return IterableQueueModel<T>::records_[index];
+  }
+
+  //! Galloping search for the last element not greater than the searched one, starting at the guessed offset
+  typename IterableQueueModel<T>::Iterator search_from(T& element,
+                                                       unsigned int start_index, // NOLINT(build/unsigned)
+                                                       std::size_t count,
+                                                       std::size_t guess)
+  {
+    if (guess >= count) {
+      guess = count - 1;
     }
 
-    while (true) {
-      unsigned int diff =
-        start_index <= end_index ? end_index - start_index : IterableQueueModel<T>::size_ + end_index - start_index;
-      unsigned int middle_index = start_index + ((diff + 1) / 2);
-      if (middle_index >= IterableQueueModel<T>::size_)
-        middle_index -= IterableQueueModel<T>::size_;
-      T& element_between = IterableQueueModel<T>::records_[middle_index];
-      if (diff == 0) {
-        return typename IterableQueueModel<T>::Iterator(*this, middle_index);
-      } else if (element < element_between) {
-        end_index = middle_index != 0 ? middle_index - 1 : IterableQueueModel<T>::size_ - 1;
+    // Invariant: element_at(lo) <= element < element_at(hi), where hi == count means past the newest element
+    std::size_t lo = guess;
+    std::size_t hi = count;
+    std::size_t step = 1;
+    if (!(element < element_at(start_index, guess))) {
+      while (lo + step < count && !(element < element_at(start_index, lo + step))) {
+        lo += step;
+        step *= 2;
+      }
+      hi = std::min(lo + step, count);
+    } else {
+      hi = guess;
+      while (hi >= step && element < element_at(start_index, hi - step)) {
+        hi -= step;
+        step *= 2;
+      }
+      if (hi >= step) {
+        lo = hi - step;
+      } else if (!(element < element_at(start_index, 0))) {
+        lo = 0;
       } else {
-        start_index = middle_index;
+        TLOG() << "Could not find element" << std::endl;
+        return IterableQueueModel<T>::end();
       }
     }
+
+    while (hi - lo > 1) {
+      std::size_t middle = lo + (hi - lo) / 2;
+      if (element < element_at(start_index, middle)) {
+        hi = middle;
+      } else {
+        lo = middle;
+      }
+    }
+
+    std::size_t index = start_index + lo;
+    if (index >= IterableQueueModel<T>::size_) {
+      index -= IterableQueueModel<T>::size_;
+    }
+    return typename IterableQueueModel<T>::Iterator(*this, index);
   }
+
+  std::size_t m_timestamp_stride = 0;
+  std::size_t m_num_timestamps = 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_timestamps; // NOLINT(build/unsigned)
 };
 
 } // namespace readoutlibs
@@ -12,7 +12,10 @@
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/concepts/RequestHandlerConcept.hpp"
 #include "readoutlibs/utils/BufferedFileWriter.hpp"
+#include "readoutlibs/utils/LatencyHistogram.hpp"
+#include "readoutlibs/utils/RequestScheduler.hpp"
 #include "readoutlibs/utils/ReusableThread.hpp"
+#include "readoutlibs/utils/ShardedCounter.hpp"
 
 #include "readoutlibs/readoutconfig/Nljs.hpp"
 #include "readoutlibs/readoutinfo/InfoStructs.hpp"
@@ -25,13 +28,12 @@
 #include "readoutlibs/FrameErrorRegistry.hpp"
 #include "readoutlibs/ReadoutLogging.hpp"
 
-#include <boost/asio.hpp>
-
 #include <folly/concurrency/UnboundedQueue.h>
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <functional>
 #include <future>
@@ -42,6 +44,7 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -68,9 +71,6 @@ public:
     , m_pop_size_pct(0.0f)
     , m_pop_limit_size(0)
     , m_buffer_capacity(0)
-    , m_pop_counter{ 0 }
-    , m_pop_reqs(0)
-    , m_pops_count(0)
     , m_occupancy(0)
   //, m_response_time_log()
   //, m_response_time_log_lock()
@@ -86,15 +86,43 @@ public:
   {
     RequestElement(dfmessages::DataRequest data_request,
                    appfwk::DAQSink<std::pair<std::unique_ptr<daqdataformats::Fragment>, std::string>>* sink,
-                   size_t retries)
+                   std::chrono::steady_clock::time_point timeout)
       : request(data_request)
       , fragment_sink(sink)
-      , retry_count(retries)
+      , deadline(timeout)
+      , issued(std::chrono::steady_clock::now())
     {}
 
     dfmessages::DataRequest request;
     appfwk::DAQSink<std::pair<std::unique_ptr<daqdataformats::Fragment>, std::string>>* fragment_sink;
-    size_t retry_count;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::steady_clock::time_point issued;
+  };
+
+  // Requests with overlapping windows that are served together
+  struct RequestGroup
+  {
+    explicit RequestGroup(const RequestElement& first)
+      : members{ first }
+      , window_begin(first.request.request_information.window_begin)
+      , window_end(first.request.request_information.window_end)
+      , deadline(first.request.trigger_timestamp)
+    {}
+
+    std::vector<RequestElement> members;
+    uint64_t window_begin; // NOLINT(build/unsigned)
+    uint64_t window_end;   // NOLINT(build/unsigned)
+    uint64_t deadline;     // NOLINT(build/unsigned) Earliest trigger timestamp of the members
+    RequestScheduler::ticket_t ticket = 0;
+  };
+
+  // Orders the waiting requests as a min-heap on the end of their window
+  struct LaterWindowEnd
+  {
+    bool operator()(const RequestElement& left, const RequestElement& right) const
+    {
+      return left.request.request_information.window_end > right.request.request_information.window_end;
+    }
   };
 
   void init(const nlohmann::json& /*args*/) override {}
@@ -106,13 +134,33 @@ public:
     m_pop_size_pct = conf.pop_size_pct;
     m_buffer_capacity = conf.latency_buffer_size;
     m_num_request_handling_threads = conf.num_request_handling_threads;
-    m_retry_count = conf.retry_count;
+    m_request_timeout = std::chrono::milliseconds(conf.request_timeout_ms);
     m_fragment_queue_timeout = conf.fragment_queue_timeout_ms;
     m_output_file = conf.output_file;
     m_geoid.element_id = conf.element_id;
     m_geoid.region_id = conf.region_id;
     m_geoid.system_type = ReadoutType::system_type;
     m_stream_buffer_size = conf.stream_buffer_size;
+    m_max_coalesced_window_ticks = conf.max_coalesced_window_ticks;
+    if (!RequestScheduler::parse_policy(conf.request_scheduling_policy, m_scheduling_policy)) {
+      ers::error(ConfigurationError(
+        ERS_HERE, m_geoid, "Unknown request scheduling policy " + conf.request_scheduling_policy + ", using fifo."));
+      m_scheduling_policy = RequestScheduler::Policy::fifo;
+    }
+    if (conf.cleanup_mode == "retention") {
+      m_retention_mode = true;
+    } else if (conf.cleanup_mode == "occupancy") {
+      m_retention_mode = false;
+    } else {
+      ers::error(ConfigurationError(
+        ERS_HERE, m_geoid, "Unknown cleanup mode " + conf.cleanup_mode + ", using occupancy."));
+      m_retention_mode = false;
+    }
+    m_retention_ticks = conf.retention_ticks;
+    m_retention_eviction_step = std::max<size_t>(conf.retention_eviction_step, 1);
+    if (m_retention_mode && m_retention_ticks == 0) {
+      ers::warning(ConfigurationError(ERS_HERE, m_geoid, "Retention mode without retention_ticks keeps no data."));
+    }
     // if (m_configured) {
     //  ers::error(ConfigurationError(ERS_HERE, "This object is already configured!"));
     if (m_pop_limit_pct < 0.0f || m_pop_limit_pct > 1.0f || m_pop_size_pct < 0.0f || m_pop_size_pct > 1.0f) {
@@ -128,18 +176,27 @@ public:
         TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run: " << conf.output_file << std::endl;
       }
 
-      m_buffered_writer.open(conf.output_file, conf.stream_buffer_size, conf.compression_algorithm, conf.use_o_direct);
+      m_buffered_writer.open(
+        conf.output_file, conf.stream_buffer_size, conf.compression_algorithm, conf.use_o_direct, conf.io_backend);
       m_recording_configured = true;
     }
 
     m_recording_thread.set_name("recording", conf.element_id);
     m_cleanup_thread.set_name("cleanup", conf.element_id);
+    if (!m_recording_thread.set_cpus(conf.recording_cpus) || !m_cleanup_thread.set_cpus(conf.cleanup_cpus)) {
+      ers::warning(
+        ConfigurationError(ERS_HERE, m_geoid, "Could not set the CPU affinity of the request handler threads"));
+    }
+    m_request_handling_cpus = conf.request_handling_cpus;
 
     std::ostringstream oss;
     oss << "RequestHandler configured. " << std::fixed << std::setprecision(2)
         << "auto-pop limit: " << m_pop_limit_pct * 100.0f << "% "
         << "auto-pop size: " << m_pop_size_pct * 100.0f << "% "
         << "max requested elements: " << m_max_requested_elements;
+    if (m_retention_mode) {
+      oss << " retention: " << m_retention_ticks << " ticks, eviction step: " << m_retention_eviction_step;
+    }
     TLOG_DEBUG(TLVL_WORK_STEPS) << oss.str();
   }
 
@@ -153,32 +210,52 @@ public:
   void start(const nlohmann::json& /*args*/)
   {
     // Reset opmon variables
-    m_num_requests_found = 0;
-    m_num_requests_bad = 0;
-    m_num_requests_old_window = 0;
-    m_num_requests_delayed = 0;
-    m_num_requests_uncategorized = 0;
-    m_num_buffer_cleanups = 0;
-    m_num_requests_timed_out = 0;
-    m_handled_requests = 0;
-    m_response_time_acc = 0;
-    m_pop_reqs = 0;
-    m_pops_count = 0;
-    m_payloads_written = 0;
-
-    m_t0 = std::chrono::high_resolution_clock::now();
-
-    m_request_handler_thread_pool = std::make_unique<boost::asio::thread_pool>(m_num_request_handling_threads);
+    m_num_requests_found.reset();
+    m_num_requests_bad.reset();
+    m_num_requests_old_window.reset();
+    m_num_requests_delayed.reset();
+    m_num_requests_uncategorized.reset();
+    m_num_buffer_cleanups.reset();
+    m_num_requests_timed_out.reset();
+    m_num_requests_coalesced.reset();
+    m_handled_requests.reset();
+    m_response_time_acc.reset();
+    m_pop_reqs.reset();
+    m_pops_count.reset();
+    m_payloads_written.reset();
+    m_recorded_bytes.reset();
+    m_recording_wait_ns.reset();
+    m_newest_timestamp = 0;
+    m_oldest_timestamp = 0;
+
+    m_request_scheduler = std::make_unique<RequestScheduler>(m_num_request_handling_threads,
+                                                             m_scheduling_policy,
+                                                             "request-" + std::to_string(m_geoid.element_id),
+                                                             m_request_handling_cpus);
 
     m_run_marker.store(true);
-    m_cleanup_thread.set_work(&DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>::periodic_cleanups, this);
+    // In retention mode the consumer thread evicts through notify_new_data, it is the only one popping
+    if (!m_retention_mode) {
+      m_cleanup_thread.set_work(&DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>::periodic_cleanups, this);
+    }
     m_waiting_queue_thread =
       std::thread(&DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>::check_waiting_requests, this);
+    std::string waiting_thread_name = "waiting-" + std::to_string(m_geoid.element_id);
+    pthread_setname_np(m_waiting_queue_thread.native_handle(), waiting_thread_name.substr(0, 15).c_str());
+    if (!m_request_scheduler->pinned() ||
+        !set_thread_affinity(m_waiting_queue_thread.native_handle(), m_request_handling_cpus)) {
+      ers::warning(
+        ConfigurationError(ERS_HERE, m_geoid, "Could not set the CPU affinity of the request handling threads"));
+    }
   }
 
   void stop(const nlohmann::json& /*args*/)
   {
     m_run_marker.store(false);
+    {
+      std::lock_guard<std::mutex> lock_guard(m_waiting_requests_lock);
+      m_waiting_requests_cv.notify_all();
+    }
     // if (m_recording) throw CommandError(ERS_HERE, "Recording is still ongoing!");
     while (!m_recording_thread.get_readiness()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -187,7 +264,7 @@ public:
       std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
     m_waiting_queue_thread.join();
-    m_request_handler_thread_pool->join();
+    m_request_scheduler->join();
   }
 
   void record(const nlohmann::json& args) override
@@ -207,138 +284,153 @@ public:
         auto start_of_recording = std::chrono::high_resolution_clock::now();
         auto current_time = start_of_recording;
         m_next_timestamp_to_record = 0;
-        ReadoutType element_to_search;
-        while (std::chrono::duration_cast<std::chrono::seconds>(current_time - start_of_recording).count() < duration) {
-          if (!m_cleanup_requested || (m_next_timestamp_to_record == 0)) {
-            if (m_next_timestamp_to_record == 0) {
-              auto front = m_latency_buffer->front();
-              m_next_timestamp_to_record = front == nullptr ? 0 : front->get_first_timestamp();
+        // Keep the not yet recorded elements in the buffer. The pin doubles as the recording cursor, it sits on the
+        // last recorded element and the next pass resumes from there.
+        auto recording_pin = m_latency_buffer->pin();
+        const ReadoutType* last_recorded = nullptr;
+        bool write_failed = false;
+        while (!write_failed &&
+               std::chrono::duration_cast<std::chrono::seconds>(current_time - start_of_recording).count() < duration) {
+          if (m_next_timestamp_to_record == 0) {
+            auto front = m_latency_buffer->front();
+            m_next_timestamp_to_record = front == nullptr ? 0 : front->get_first_timestamp();
+          }
+          auto chunk_iter = resume_recording(last_recorded);
+          // Payloads that are adjacent in memory, e.g. consecutive elements of a ring, go out in a single write
+          const char* run_begin = nullptr;
+          size_t run_size = 0;
+          const ReadoutType* run_last = nullptr;
+          size_t run_payloads = 0;
+          // Only written data counts and releases its elements, a failed write ends the recording
+          auto write_run = [&]() {
+            if (run_size > 0) {
+              if (m_buffered_writer.write(run_begin, run_size)) {
+                m_recorded_bytes += run_size;
+                m_payloads_written += run_payloads;
+                m_latency_buffer->advance_pin(recording_pin, run_last);
+                last_recorded = run_last;
+              } else {
+                ers::error(CannotWriteToFile(ERS_HERE, m_output_file));
+                write_failed = true;
+              }
             }
-            element_to_search.set_first_timestamp(m_next_timestamp_to_record);
-            size_t processed_chunks_in_loop = 0;
-
-            {
-              std::unique_lock<std::mutex> lock(m_cv_mutex);
-              m_cv.wait(lock, [&] { return !m_cleanup_requested; });
-              m_requests_running++;
+            run_size = 0;
+            run_last = nullptr;
+            run_payloads = 0;
+            return !write_failed;
+          };
+          size_t recorded = 0;
+          scan_latency_buffer(chunk_iter, [&](ReadoutType& chunk) {
+            if (chunk.get_first_timestamp() < m_next_timestamp_to_record) {
+              return true;
             }
-            m_cv.notify_all();
-            auto chunk_iter = m_latency_buffer->lower_bound(element_to_search, true);
-            auto end = m_latency_buffer->end();
-            {
-              std::lock_guard<std::mutex> lock(m_cv_mutex);
-              m_requests_running--;
+            auto* payload = reinterpret_cast<const char*>(chunk.begin()); // NOLINT
+            if (run_size > 0 && payload != run_begin + run_size && !write_run()) {
+              return false;
             }
-            m_cv.notify_all();
-
-            for (; chunk_iter != end && chunk_iter.good() && processed_chunks_in_loop < 1000;) {
-              if ((*chunk_iter).get_first_timestamp() >= m_next_timestamp_to_record) {
-                if (!m_buffered_writer.write(reinterpret_cast<char*>(chunk_iter->begin()), // NOLINT
-                                             chunk_iter->get_payload_size())) {
-                  ers::warning(CannotWriteToFile(ERS_HERE, m_output_file));
-                }
-                m_payloads_written++;
-                processed_chunks_in_loop++;
-                m_next_timestamp_to_record = (*chunk_iter).get_first_timestamp() +
-                                             ReadoutType::expected_tick_difference * (*chunk_iter).get_num_frames();
-              }
-              ++chunk_iter;
+            if (run_size == 0) {
+              run_begin = payload;
             }
-          }
+            run_size += chunk.get_payload_size();
+            run_last = &chunk;
+            ++run_payloads;
+            recorded++;
+            m_next_timestamp_to_record =
+              chunk.get_first_timestamp() + ReadoutType::expected_tick_difference * chunk.get_num_frames();
+            return run_size < max_recording_run;
+          });
+          write_run();
           current_time = std::chrono::high_resolution_clock::now();
+          if (recorded == 0) {
+            auto t_wait_begin = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(recording_idle_sleep);
+            m_recording_wait_ns += ns_since(t_wait_begin);
+          }
         }
+        m_latency_buffer->unpin(recording_pin);
         m_next_timestamp_to_record = std::numeric_limits<uint64_t>::max(); // NOLINT (build/unsigned)
 
-        TLOG() << "Stop recording" << std::endl;
+        TLOG() << "Stop recording" << (write_failed ? " after a failed write" : "") << std::endl;
         m_recording.exchange(false);
-        m_buffered_writer.flush();
+        if (!m_buffered_writer.flush() && !write_failed) {
+          ers::warning(CannotWriteToFile(ERS_HERE, m_output_file));
+        }
       },
       conf.duration);
   }
 
   void cleanup_check() override
   {
-    std::unique_lock<std::mutex> lock(m_cv_mutex);
-    if (m_latency_buffer->occupancy() > m_pop_limit_size && !m_cleanup_requested.exchange(true)) {
-      m_cv.wait(lock, [&] { return m_requests_running == 0; });
+    if (m_retention_mode) {
+      return;
+    }
+    // Elements in use by requests or the recording are pinned, the latency buffer doesn't pop them
+    if (m_latency_buffer->occupancy() > m_pop_limit_size) {
       cleanup();
-      m_cleanup_requested = false;
-      m_cv.notify_all();
     }
   }
 
   void issue_request(dfmessages::DataRequest datarequest,
                      appfwk::DAQSink<std::pair<std::unique_ptr<daqdataformats::Fragment>, std::string>>& fragment_queue) override
   {
-    boost::asio::post(*m_request_handler_thread_pool, [&, datarequest]() { // start a thread from pool
-      auto t_req_begin = std::chrono::high_resolution_clock::now();
-      {
-        std::unique_lock<std::mutex> lock(m_cv_mutex);
-        m_cv.wait(lock, [&] { return !m_cleanup_requested; });
-        m_requests_running++;
-      }
-      m_cv.notify_all();
-      auto result = data_request(datarequest);
-      {
-        std::lock_guard<std::mutex> lock(m_cv_mutex);
-        m_requests_running--;
-      }
-      m_cv.notify_all();
-      if (result.result_code == ResultCode::kFound || result.result_code == ResultCode::kNotFound) {
-        try { // Push to Fragment queue
-          TLOG_DEBUG(TLVL_QUEUE_PUSH) << "Sending fragment with trigger_number "
-                                      << result.fragment->get_trigger_number() << ", run number "
-                                      << result.fragment->get_run_number() << ", and GeoID "
-                                      << result.fragment->get_element_id();
-          fragment_queue.push(std::make_pair(std::move(result.fragment), datarequest.data_destination), std::chrono::milliseconds(m_fragment_queue_timeout));
-        } catch (const ers::Issue& excpt) {
-          ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "fragment queue"));
-        }
-      } else if (result.result_code == ResultCode::kNotYet) {
-        TLOG_DEBUG(TLVL_WORK_STEPS) << "Re-queue request. "
-                                    << "With timestamp=" << result.data_request.trigger_timestamp;
-        std::lock_guard<std::mutex> wait_lock_guard(m_waiting_requests_lock);
-        m_waiting_requests.push_back(RequestElement(datarequest, &fragment_queue, 0));
-      }
-      auto t_req_end = std::chrono::high_resolution_clock::now();
-      auto us_req_took = std::chrono::duration_cast<std::chrono::microseconds>(t_req_end - t_req_begin);
-      TLOG_DEBUG(TLVL_WORK_STEPS) << "Responding to data request took: " << us_req_took.count() << "[us]";
-      // if (result.result_code == ResultCode::kFound) {
-      //   std::lock_guard<std::mutex> time_lock_guard(m_response_time_log_lock);
-      //   m_response_time_log.push_back( std::make_pair<int, int>(result.data_request.trigger_number,
-      //   us_req_took.count()) );
-      // }
-      m_response_time_acc.fetch_add(us_req_took.count());
-      m_handled_requests++;
-    });
+    post_request(RequestElement(datarequest, &fragment_queue, std::chrono::steady_clock::now() + m_request_timeout));
+  }
+
+  void notify_new_data(std::uint64_t newest_timestamp, std::size_t num_written = 1) override // NOLINT
+  {
+    // Cheap check on the consumer path, the waiting requests thread does the actual work. The notify is not under
+    // the mutex, a wake-up that races with the thread going to sleep is lost, but the next write notifies again. Only
+    // if the data stops right then does the request wait for the m_max_waiting_interval fallback.
+    if (newest_timestamp > m_earliest_waiting_window_end.load(std::memory_order_relaxed)) {
+      m_waiting_requests_cv.notify_one();
+    }
+    m_newest_timestamp.store(newest_timestamp, std::memory_order_relaxed);
+    // Evicting once per half step of written elements amortizes the search
+    if (!m_retention_mode) {
+      return;
+    }
+    m_writes_since_eviction += num_written;
+    if (m_writes_since_eviction >= (m_retention_eviction_step + 1) / 2) {
+      m_writes_since_eviction = 0;
+      evict_expired(newest_timestamp);
+    }
   }
 
   void get_info(opmonlib::InfoCollector& ci, int /*level*/) override
   {
     readoutinfo::RequestHandlerInfo info;
-    info.num_requests_found = m_num_requests_found.exchange(0);
-    info.num_requests_bad = m_num_requests_bad.exchange(0);
-    info.num_requests_old_window = m_num_requests_old_window.exchange(0);
-    info.num_requests_delayed = m_num_requests_delayed.exchange(0);
-    info.num_requests_uncategorized = m_num_requests_uncategorized.exchange(0);
-    info.num_buffer_cleanups = m_num_buffer_cleanups.exchange(0);
-    info.num_requests_waiting = m_waiting_requests.size();
-    info.num_requests_timed_out = m_num_requests_timed_out.exchange(0);
+    info.num_requests_found = m_num_requests_found.collect().delta;
+    info.num_requests_bad = m_num_requests_bad.collect().delta;
+    info.num_requests_old_window = m_num_requests_old_window.collect().delta;
+    info.num_requests_delayed = m_num_requests_delayed.collect().delta;
+    info.num_requests_uncategorized = m_num_requests_uncategorized.collect().delta;
+    info.num_buffer_cleanups = m_num_buffer_cleanups.collect().delta;
+    info.num_requests_waiting = m_num_waiting_requests.load(std::memory_order_relaxed);
+    info.num_requests_timed_out = m_num_requests_timed_out.collect().delta;
+    info.num_requests_coalesced = m_num_requests_coalesced.collect().delta;
+    if (m_request_scheduler) {
+      info.request_queue_depth = m_request_scheduler->depth();
+      auto dispatch_wait = m_request_scheduler->collect_dispatch_wait();
+      info.dispatch_wait_p50 = dispatch_wait.p50;
+      info.dispatch_wait_p99 = dispatch_wait.p99;
+      info.dispatch_wait_max = dispatch_wait.max;
+    }
     info.is_recording = m_recording;
-    info.num_payloads_written = m_payloads_written.exchange(0);
+    info.num_payloads_written = m_payloads_written.collect().delta;
     info.recording_status = m_recording ? "⏺" : "⏸";
-
-    int new_pop_reqs = 0;
-    int new_pop_count = 0;
-    int new_occupancy = 0;
-    int handled_requests = m_handled_requests.exchange(0);
-    int response_time_total = m_response_time_acc.exchange(0);
-    auto now = std::chrono::high_resolution_clock::now();
-    new_pop_reqs = m_pop_reqs.exchange(0);
-    new_pop_count = m_pops_count.exchange(0);
-    new_occupancy = m_occupancy;
-    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(now - m_t0).count() / 1000000.;
-    TLOG_DEBUG(TLVL_HOUSEKEEPING) << "Cleanup request rate: " << new_pop_reqs / seconds / 1. << " [Hz]"
+    auto newest = m_newest_timestamp.load(std::memory_order_relaxed);
+    auto oldest = m_oldest_timestamp.load(std::memory_order_relaxed);
+    info.buffer_time_depth = oldest != 0 && newest > oldest ? newest - oldest : 0;
+
+    auto now = ShardedCounter::clock_t::now();
+    auto handled_requests = m_handled_requests.collect(now).delta;
+    auto response_time_total = m_response_time_acc.collect(now).delta;
+    auto pop_reqs = m_pop_reqs.collect(now);
+    auto new_pop_count = m_pops_count.collect(now).delta;
+    int new_occupancy = m_occupancy;
+    info.recording_throughput = m_recorded_bytes.collect(now).rate / 1000000.;
+    info.recording_wait_time = m_recording_wait_ns.collect(now).delta / 1000;
+    TLOG_DEBUG(TLVL_HOUSEKEEPING) << "Cleanup request rate: " << pop_reqs.rate << " [Hz]"
                                   << " Dropped: " << new_pop_count << " Occupancy: " << new_occupancy;
 
     // std::unique_lock<std::mutex> time_lorunck_guard(m_response_time_log_lock);
@@ -365,7 +457,40 @@ public:
       info.avg_request_response_time = response_time_total / handled_requests;
     }
 
-    m_t0 = now;
+    auto pin_time = m_pin_latency.collect();
+    info.pin_time_p50 = pin_time.p50;
+    info.pin_time_p99 = pin_time.p99;
+    info.pin_time_p999 = pin_time.p999;
+    info.pin_time_max = pin_time.max;
+    auto search_time = m_search_latency.collect();
+    info.search_time_p50 = search_time.p50;
+    info.search_time_p99 = search_time.p99;
+    info.search_time_p999 = search_time.p999;
+    info.search_time_max = search_time.max;
+    auto pieces_time = m_pieces_latency.collect();
+    info.pieces_time_p50 = pieces_time.p50;
+    info.pieces_time_p99 = pieces_time.p99;
+    info.pieces_time_p999 = pieces_time.p999;
+    info.pieces_time_max = pieces_time.max;
+    auto fragment_time = m_fragment_latency.collect();
+    info.fragment_time_p50 = fragment_time.p50;
+    info.fragment_time_p99 = fragment_time.p99;
+    info.fragment_time_p999 = fragment_time.p999;
+    info.fragment_time_max = fragment_time.max;
+    auto push_time = m_push_latency.collect();
+    info.push_time_p50 = push_time.p50;
+    info.push_time_p99 = push_time.p99;
+    info.push_time_p999 = push_time.p999;
+    info.push_time_max = push_time.max;
+    auto response_time = m_response_latency.collect();
+    info.response_time_p50 = response_time.p50;
+    info.response_time_p99 = response_time.p99;
+    info.response_time_p999 = response_time.p999;
+    info.response_time_max = response_time.max;
+    if (response_time.count > 0) {
+      TLOG_DEBUG(TLVL_HOUSEKEEPING) << "Request response time p50: " << response_time.p50
+                                    << " p99: " << response_time.p99 << " max: " << response_time.max << " [ns]";
+    }
 
     ci.add(info);
   }
@@ -390,11 +515,21 @@ protected:
   {
     auto frag_header = create_fragment_header(dr);
     frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
-    auto fragment = std::make_unique<daqdataformats::Fragment>(std::vector<std::pair<void*, size_t>>());
+    static const std::vector<std::pair<void*, size_t>> no_pieces;
+    auto fragment = std::make_unique<daqdataformats::Fragment>(no_pieces);
     fragment->set_header_fields(frag_header);
     return fragment;
   }
 
+  // Piece list of the calling thread, cleared. Its capacity grows to the largest window seen on the thread, so
+  // collecting the pieces of a request does not allocate after the first few requests.
+  static std::vector<std::pair<void*, size_t>>& thread_local_pieces()
+  {
+    thread_local std::vector<std::pair<void*, size_t>> pieces;
+    pieces.clear();
+    return pieces;
+  }
+
   inline void dump_to_buffer(const void* data,
                              std::size_t size,
                              void* buffer,
@@ -413,6 +548,54 @@ protected:
     }
   }
 
+  // Bytes handed to the writer at once at most, and the pause of the recording when there was nothing to record
+  static constexpr size_t max_recording_run = 4 * 1024 * 1024;
+  static constexpr std::chrono::microseconds recording_idle_sleep{ 500 };
+
+  // Iterator to continue the recording at. Buffers with spans() are ring based, there the last recorded element
+  // is still in place thanks to the recording pin, the others are searched for the next timestamp to record.
+  auto resume_recording(const ReadoutType* last_recorded)
+  {
+    if constexpr (has_spans<LatencyBufferType>::value) {
+      if (last_recorded != nullptr) {
+        auto iter = m_latency_buffer->iterator_of(last_recorded);
+        if (iter.good()) {
+          return iter;
+        }
+      }
+    }
+    ReadoutType element_to_search;
+    element_to_search.set_first_timestamp(m_next_timestamp_to_record);
+    return m_latency_buffer->lower_bound(element_to_search, true);
+  }
+
+  template<class LB, class = void>
+  struct has_spans : std::false_type
+  {};
+  template<class LB>
+  struct has_spans<LB, std::void_t<decltype(std::declval<LB&>().spans(std::declval<typename LB::Iterator&>()))>>
+    : std::true_type
+  {};
+
+  // Visits the elements from iter on until f returns false, returns the number of elements f accepted. Buffers that
+  // provide a spans() snapshot are walked as plain arrays, the others step by step through their iterator.
+  template<class Iterator, class F>
+  std::size_t scan_latency_buffer(Iterator& iter, F&& f)
+  {
+    if constexpr (has_spans<LatencyBufferType>::value) {
+      return m_latency_buffer->scan(iter, std::forward<F>(f));
+    } else {
+      std::size_t visited = 0;
+      for (; iter != m_latency_buffer->end() && iter.good(); ++iter) {
+        if (!f(*iter)) {
+          break;
+        }
+        ++visited;
+      }
+      return visited;
+    }
+  }
+
   void periodic_cleanups()
   {
     while (m_run_marker.load()) {
@@ -430,96 +613,405 @@ protected:
       unsigned to_pop = m_pop_size_pct * m_latency_buffer->occupancy();
 
       unsigned popped = 0;
-      for (size_t i = 0; i < to_pop; ++i) {
-        if (m_latency_buffer->front()->get_first_timestamp() < m_next_timestamp_to_record) {
-          m_latency_buffer->pop(1);
-          popped++;
-        } else {
-          break;
-        }
+      if (m_recording.load()) {
+        // Stop at the next element to record instead of relying on the recording pin alone
+        ReadoutType next_to_record;
+        next_to_record.set_first_timestamp(m_next_timestamp_to_record);
+        popped = m_latency_buffer->pop_older_than(next_to_record, to_pop);
+        m_occupancy = m_latency_buffer->occupancy();
+      } else {
+        // Pops are limited to the oldest pinned element
+        m_latency_buffer->pop(to_pop);
+        auto occupancy_after_pop = m_latency_buffer->occupancy();
+        m_occupancy = occupancy_after_pop;
+        popped = size_guess > occupancy_after_pop ? size_guess - occupancy_after_pop : 0;
       }
-      // m_pops_count += to_pop;
-      m_occupancy = m_latency_buffer->occupancy();
       m_pops_count += popped;
-      m_error_registry->remove_errors_until(m_latency_buffer->front()->get_first_timestamp());
+      auto front = m_latency_buffer->front();
+      if (front != nullptr) {
+        m_oldest_timestamp.store(front->get_first_timestamp(), std::memory_order_relaxed);
+        m_error_registry->remove_errors_until(front->get_first_timestamp());
+      }
     }
-    m_num_buffer_cleanups++;
+    ++m_num_buffer_cleanups;
   }
 
-  void check_waiting_requests()
+  // Retention mode: called by the consumer once half an eviction step of elements was written, it pops the elements
+  // older than the retention window in passes of m_retention_eviction_step, until a pass comes back short. The buffer
+  // then holds the newest m_retention_ticks of data instead of oscillating between the pop limit and the occupancy
+  // left after a cleanup. If the data rate is too high for the retention window to fit below the pop limit, the depth
+  // is shortened instead of the buffer running full.
+  void evict_expired(uint64_t newest_timestamp) // NOLINT(build/unsigned)
   {
-    while (m_run_marker.load() || m_waiting_requests.size() > 0) {
+    uint64_t cutoff = newest_timestamp > m_retention_ticks ? newest_timestamp - m_retention_ticks : 0; // NOLINT
+    bool recording = m_recording.load();
+    if (recording) {
+      // Stop at the next element to record instead of relying on the recording pin alone
+      cutoff = std::min<uint64_t>(cutoff, m_next_timestamp_to_record); // NOLINT(build/unsigned)
+    }
+    ReadoutType oldest_kept;
+    oldest_kept.set_first_timestamp(cutoff);
+    std::size_t popped = 0;
+    std::size_t popped_in_pass = 0;
+    do {
+      popped_in_pass = m_latency_buffer->pop_older_than(oldest_kept, m_retention_eviction_step);
+      popped += popped_in_pass;
+    } while (popped_in_pass == m_retention_eviction_step);
+
+    auto occupancy = m_latency_buffer->occupancy();
+    if (occupancy > m_pop_limit_size) {
+      std::size_t excess = occupancy - m_pop_limit_size;
+      if (recording) {
+        ReadoutType next_to_record;
+        next_to_record.set_first_timestamp(m_next_timestamp_to_record);
+        popped += m_latency_buffer->pop_older_than(next_to_record, excess);
+      } else {
+        // Pops are limited to the oldest pinned element
+        m_latency_buffer->pop(excess);
+        auto occupancy_after_pop = m_latency_buffer->occupancy();
+        popped += occupancy > occupancy_after_pop ? occupancy - occupancy_after_pop : 0;
+      }
+      occupancy = m_latency_buffer->occupancy();
+    }
+
+    if (popped > 0) {
+      ++m_pop_reqs;
+      m_pops_count += popped;
+      m_occupancy = occupancy;
+      auto front = m_latency_buffer->front();
+      if (front != nullptr) {
+        m_oldest_timestamp.store(front->get_first_timestamp(), std::memory_order_relaxed);
+        m_error_registry->remove_errors_until(front->get_first_timestamp());
+      }
+    } else if (m_oldest_timestamp.load(std::memory_order_relaxed) == 0) {
+      auto front = m_latency_buffer->front();
+      if (front != nullptr) {
+        m_oldest_timestamp.store(front->get_first_timestamp(), std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Requests that are queued for the thread pool absorb later requests with overlapping windows, so the group
+  // shares a single search of the latency buffer.
+  RequestScheduler::Key group_key(const RequestGroup& group) const
+  {
+    return { group.deadline, group.window_end - group.window_begin, group.members.front().request.data_destination };
+  }
+
+  // A request joins a queued group if the windows overlap and the union stays within m_max_coalesced_window_ticks.
+  // The group is rekeyed, so that it is scheduled on its earliest deadline and its grown window.
+  void post_request(RequestElement request_element)
+  {
+    auto& window = request_element.request.request_information;
+    std::lock_guard<std::mutex> lock_guard(m_pending_groups_lock);
+    for (auto& pending : m_pending_groups) {
+      if (window.window_begin < pending->window_end && pending->window_begin < window.window_end) {
+        auto union_begin = std::min(pending->window_begin, window.window_begin);
+        auto union_end = std::max(pending->window_end, window.window_end);
+        if (union_end - union_begin > m_max_coalesced_window_ticks) {
+          continue;
+        }
+        pending->window_begin = union_begin;
+        pending->window_end = union_end;
+        pending->deadline = std::min(pending->deadline, request_element.request.trigger_timestamp);
+        pending->members.push_back(request_element);
+        m_request_scheduler->rekey(pending->ticket, group_key(*pending));
+        ++m_num_requests_coalesced;
+        return;
+      }
+    }
+    auto group = std::make_shared<RequestGroup>(request_element);
+    m_pending_groups.push_back(group);
+    // Submitted under the lock, so that a joining request always finds the ticket
+    group->ticket = m_request_scheduler->submit(group_key(*group), [&, group]() {
       {
-        std::lock_guard<std::mutex> lock_guard(m_waiting_requests_lock);
-
-        auto last_frame = m_latency_buffer->back();                                       // NOLINT
-        uint64_t newest_ts = last_frame == nullptr ? std::numeric_limits<uint64_t>::min() // NOLINT(build/unsigned)
-                                                   : last_frame->get_first_timestamp();
-
-        size_t size = m_waiting_requests.size();
-        for (size_t i = 0; i < size;) {
-          if (m_waiting_requests[i].request.request_information.window_end < newest_ts) {
-            issue_request(m_waiting_requests[i].request, *(m_waiting_requests[i].fragment_sink));
-            std::swap(m_waiting_requests[i], m_waiting_requests.back());
-            m_waiting_requests.pop_back();
-            size--;
-          } else if (m_waiting_requests[i].retry_count >= m_retry_count) {
-            auto fragment = create_empty_fragment(m_waiting_requests[i].request);
-
-            ers::warning(dunedaq::readoutlibs::RequestTimedOut(ERS_HERE, m_geoid));
-            m_num_requests_bad++;
-            m_num_requests_timed_out++;
-            try { // Push to Fragment queue
-              TLOG_DEBUG(TLVL_QUEUE_PUSH)
-                << "Sending fragment with trigger_number " << fragment->get_trigger_number() << ", run number "
-                << fragment->get_run_number() << ", and GeoID " << fragment->get_element_id();
-              
-              m_waiting_requests[i].fragment_sink->push(std::make_pair(std::move(fragment), m_waiting_requests[i].request.data_destination),
-                                                        std::chrono::milliseconds(m_fragment_queue_timeout));
-            } catch (const ers::Issue& excpt) {
-              std::ostringstream oss;
-              oss << "fragments output queue for link " << m_geoid.element_id;
-              ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "fragment queue"));
-            }
-            std::swap(m_waiting_requests[i], m_waiting_requests.back());
-            m_waiting_requests.pop_back();
-            size--;
-          } else if (!m_run_marker.load()) {
-            auto fragment = create_empty_fragment(m_waiting_requests[i].request);
-
-            ers::warning(dunedaq::readoutlibs::EndOfRunEmptyFragment(ERS_HERE, m_geoid));
-            m_num_requests_bad++;
-            try { // Push to Fragment queue
-              TLOG_DEBUG(TLVL_QUEUE_PUSH)
-                << "Sending fragment with trigger_number " << fragment->get_trigger_number() << ", run number "
-                << fragment->get_run_number() << ", and GeoID " << fragment->get_element_id();
-              m_waiting_requests[i].fragment_sink->push(std::make_pair(std::move(fragment), m_waiting_requests[i].request.data_destination),
-                                                        std::chrono::milliseconds(m_fragment_queue_timeout));
-            } catch (const ers::Issue& excpt) {
-              ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "fragment queue"));
-            }
-            std::swap(m_waiting_requests[i], m_waiting_requests.back());
-            m_waiting_requests.pop_back();
-            size--;
-          } else {
-            m_waiting_requests[i].retry_count++;
-            i++;
+        std::lock_guard<std::mutex> lock_guard(m_pending_groups_lock);
+        m_pending_groups.erase(std::find(m_pending_groups.begin(), m_pending_groups.end(), group));
+      }
+      if (group->members.size() == 1 || !handle_request_group(*group)) {
+        for (auto& member : group->members) {
+          handle_request(member);
+        }
+      }
+    });
+  }
+
+  void handle_request(const RequestElement& request_element)
+  {
+    const auto& datarequest = request_element.request;
+    auto t_req_begin = std::chrono::high_resolution_clock::now();
+    auto result = data_request(datarequest);
+    if (result.result_code == ResultCode::kFound || result.result_code == ResultCode::kNotFound) {
+      send_fragment(request_element, std::move(result.fragment));
+    } else if (result.result_code == ResultCode::kNotYet) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Re-queue request. "
+                                  << "With timestamp=" << result.data_request.trigger_timestamp;
+      add_waiting_request(request_element);
+    }
+    auto t_req_end = std::chrono::high_resolution_clock::now();
+    auto us_req_took = std::chrono::duration_cast<std::chrono::microseconds>(t_req_end - t_req_begin);
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Responding to data request took: " << us_req_took.count() << "[us]";
+    // if (result.result_code == ResultCode::kFound) {
+    //   std::lock_guard<std::mutex> time_lock_guard(m_response_time_log_lock);
+    //   m_response_time_log.push_back( std::make_pair<int, int>(result.data_request.trigger_number,
+    //   us_req_took.count()) );
+    // }
+    m_response_time_acc += us_req_took.count();
+    ++m_handled_requests;
+  }
+
+  // Resolves the elements of the union window once and builds the fragment of every member from them. Returns false
+  // without sending anything if the union window is not completely available, the members are then handled one by one.
+  bool handle_request_group(const RequestGroup& group)
+  {
+    auto t_req_begin = std::chrono::high_resolution_clock::now();
+    auto t_phase_begin = std::chrono::steady_clock::now();
+    auto pin = m_latency_buffer->pin();
+    m_pin_latency.record(ns_since(t_phase_begin));
+
+    std::vector<ReadoutType*> elements;
+    if (m_latency_buffer->occupancy() != 0) {
+      uint64_t last_ts = m_latency_buffer->front()->get_first_timestamp();  // NOLINT(build/unsigned)
+      uint64_t newest_ts = m_latency_buffer->back()->get_first_timestamp(); // NOLINT(build/unsigned)
+      if (last_ts <= group.window_begin && group.window_end <= newest_ts) {
+        t_phase_begin = std::chrono::steady_clock::now();
+        ReadoutType request_element;
+        request_element.set_first_timestamp(group.window_begin);
+        auto iter =
+          m_latency_buffer->lower_bound(request_element, m_error_registry->has_error(FrameErrorRegistry::missing_frames));
+        // Only the union window has to stay, the older elements can be cleaned up while the fragments are built
+        if (iter != m_latency_buffer->end()) {
+          m_latency_buffer->advance_pin(pin, &*iter);
+        }
+        scan_latency_buffer(iter, [&](ReadoutType& element) {
+          if (element.get_first_timestamp() >= group.window_end) {
+            return false;
           }
+          elements.push_back(&element);
+          return true;
+        });
+        m_search_latency.record(ns_since(t_phase_begin));
+      }
+    }
+    if (elements.empty()) {
+      m_latency_buffer->unpin(pin);
+      return false;
+    }
+
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Serving " << group.members.size() << " coalesced requests from window "
+                                << group.window_begin << " - " << group.window_end;
+    std::vector<std::unique_ptr<daqdataformats::Fragment>> fragments;
+    auto& frag_pieces = thread_local_pieces();
+    for (auto& member : group.members) {
+      t_phase_begin = std::chrono::steady_clock::now();
+      uint64_t start_win_ts = member.request.request_information.window_begin; // NOLINT(build/unsigned)
+      uint64_t end_win_ts = member.request.request_information.window_end;     // NOLINT(build/unsigned)
+      // Last element starting not after the window begin, like lower_bound of the latency buffer
+      auto element = std::upper_bound(elements.begin(), elements.end(), start_win_ts, [](uint64_t ts, auto* elem) {
+        return ts < elem->get_first_timestamp();
+      });
+      if (element != elements.begin()) {
+        --element;
+      }
+      frag_pieces.clear();
+      for (; element != elements.end() && (*element)->get_first_timestamp() < end_win_ts; ++element) {
+        add_fragment_pieces(*element, start_win_ts, end_win_ts, frag_pieces);
+      }
+      m_pieces_latency.record(ns_since(t_phase_begin));
+
+      t_phase_begin = std::chrono::steady_clock::now();
+      fragments.push_back(std::make_unique<daqdataformats::Fragment>(frag_pieces));
+      fragments.back()->set_header_fields(create_fragment_header(member.request));
+      m_fragment_latency.record(ns_since(t_phase_begin));
+      ++m_num_requests_found;
+    }
+    // Don't hold the pin while the fragment queue applies backpressure
+    m_latency_buffer->unpin(pin);
+    for (size_t i = 0; i < group.members.size(); ++i) {
+      send_fragment(group.members[i], std::move(fragments[i]));
+    }
+
+    auto us_req_took =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t_req_begin);
+    m_response_time_acc += us_req_took.count() * group.members.size();
+    m_handled_requests += group.members.size();
+    return true;
+  }
+
+  void send_fragment(const RequestElement& request_element, std::unique_ptr<daqdataformats::Fragment> fragment)
+  {
+    auto t_push_begin = std::chrono::steady_clock::now();
+    try { // Push to Fragment queue
+      TLOG_DEBUG(TLVL_QUEUE_PUSH) << "Sending fragment with trigger_number " << fragment->get_trigger_number()
+                                  << ", run number " << fragment->get_run_number() << ", and GeoID "
+                                  << fragment->get_element_id();
+      request_element.fragment_sink->push(std::make_pair(std::move(fragment), request_element.request.data_destination),
+                                          std::chrono::milliseconds(m_fragment_queue_timeout));
+    } catch (const ers::Issue& excpt) {
+      ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "fragment queue"));
+    }
+    m_push_latency.record(ns_since(t_push_begin));
+    // From issuing the request, including the time spent waiting for the data
+    m_response_latency.record(ns_since(request_element.issued));
+  }
+
+  static uint64_t ns_since(const std::chrono::steady_clock::time_point& since) // NOLINT(build/unsigned)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+  }
+
+  // Adds the frames of the element that are inside of the window
+  inline void add_fragment_pieces(ReadoutType* element,
+                                  uint64_t start_win_ts, // NOLINT(build/unsigned)
+                                  uint64_t end_win_ts,   // NOLINT(build/unsigned)
+                                  std::vector<std::pair<void*, size_t>>& frag_pieces)
+  {
+    if (element->get_first_timestamp() < start_win_ts ||
+        element->get_first_timestamp() + (element->get_num_frames() - 1) * ReadoutType::expected_tick_difference >=
+          end_win_ts) {
+      // We don't need the whole aggregated object (e.g.: superchunk). The frames are time ordered, so the ones in
+      // the window are contiguous and can be added as a single piece.
+      size_t first_frame = first_frame_not_before(element, start_win_ts);
+      size_t last_frame = first_frame_not_before(element, end_win_ts);
+      if (first_frame < last_frame) {
+        frag_pieces.emplace_back(static_cast<void*>(&element->begin()[first_frame]),
+                                 (last_frame - first_frame) * element->get_frame_size());
+      }
+    } else {
+      // We are somewhere in the middle -> the whole aggregated object (e.g.: superchunk) can be copied
+      frag_pieces.emplace_back(
+        std::make_pair<void*, size_t>(static_cast<void*>(element->begin()), element->get_payload_size()));
+    }
+  }
+
+  // Index of the first frame of the element with a timestamp not before ts, or the number of frames if there is none.
+  // The index is guessed from the expected tick difference and corrected by a short scan for missing frames.
+  static size_t first_frame_not_before(ReadoutType* element, uint64_t ts) // NOLINT(build/unsigned)
+  {
+    auto frames = element->begin();
+    const size_t num_frames = element->get_num_frames();
+    const uint64_t first_ts = element->get_first_timestamp(); // NOLINT(build/unsigned)
+    size_t index = 0;
+    if (ts > first_ts) {
+      index = std::min<uint64_t>( // NOLINT(build/unsigned)
+        num_frames,
+        (ts - first_ts + ReadoutType::expected_tick_difference - 1) / ReadoutType::expected_tick_difference);
+    }
+    while (index > 0 && frames[index - 1].get_timestamp() >= ts) {
+      --index;
+    }
+    while (index < num_frames && frames[index].get_timestamp() < ts) {
+      ++index;
+    }
+    return index;
+  }
+
+  void add_waiting_request(const RequestElement& request_element)
+  {
+    std::lock_guard<std::mutex> lock_guard(m_waiting_requests_lock);
+    m_waiting_requests.push_back(request_element);
+    std::push_heap(m_waiting_requests.begin(), m_waiting_requests.end(), LaterWindowEnd());
+    m_earliest_waiting_window_end = m_waiting_requests.front().request.request_information.window_end;
+    m_num_waiting_requests.store(m_waiting_requests.size(), std::memory_order_relaxed);
+    m_waiting_requests_cv.notify_one();
+  }
+
+  void send_empty_fragment(const RequestElement& request_element)
+  {
+    send_fragment(request_element, create_empty_fragment(request_element.request));
+  }
+
+  // Waiting requests are kept in a min-heap on window_end. The thread sleeps until the consumer reports data newer
+  // than the earliest window end, a new request is added, or the earliest timeout expires. Requests that are ready or
+  // expired are moved out under the lock, their fragments are built and sent after releasing it.
+  void check_waiting_requests()
+  {
+    std::unique_lock<std::mutex> lock(m_waiting_requests_lock);
+    while (m_run_marker.load() || m_waiting_requests.size() > 0) {
+      auto last_frame = m_latency_buffer->back();                                       // NOLINT
+      uint64_t newest_ts = last_frame == nullptr ? std::numeric_limits<uint64_t>::min() // NOLINT(build/unsigned)
+                                                 : last_frame->get_first_timestamp();
+
+      // Data arrived for these requests
+      while (!m_waiting_requests.empty() &&
+             m_waiting_requests.front().request.request_information.window_end < newest_ts) {
+        std::pop_heap(m_waiting_requests.begin(), m_waiting_requests.end(), LaterWindowEnd());
+        m_ready_requests.push_back(std::move(m_waiting_requests.back()));
+        m_waiting_requests.pop_back();
+      }
+
+      // Timeouts in wall-clock time, or all remaining requests at the end of the run
+      auto now = std::chrono::steady_clock::now();
+      auto next_wakeup = now + m_max_waiting_interval;
+      bool removed = false;
+      for (size_t i = 0; i < m_waiting_requests.size();) {
+        if (m_waiting_requests[i].deadline <= now) {
+          m_timed_out_requests.push_back(std::move(m_waiting_requests[i]));
+        } else if (!m_run_marker.load()) {
+          m_end_of_run_requests.push_back(std::move(m_waiting_requests[i]));
+        } else {
+          next_wakeup = std::min(next_wakeup, m_waiting_requests[i].deadline);
+          i++;
+          continue;
         }
+        std::swap(m_waiting_requests[i], m_waiting_requests.back());
+        m_waiting_requests.pop_back();
+        removed = true;
+      }
+      if (removed) {
+        std::make_heap(m_waiting_requests.begin(), m_waiting_requests.end(), LaterWindowEnd());
+      }
+      m_earliest_waiting_window_end = m_waiting_requests.empty()
+                                        ? std::numeric_limits<uint64_t>::max() // NOLINT(build/unsigned)
+                                        : m_waiting_requests.front().request.request_information.window_end;
+      m_num_waiting_requests.store(m_waiting_requests.size(), std::memory_order_relaxed);
+
+      if (!m_ready_requests.empty() || !m_timed_out_requests.empty() || !m_end_of_run_requests.empty()) {
+        lock.unlock();
+        for (auto& request_element : m_ready_requests) {
+          post_request(std::move(request_element));
+        }
+        for (auto& request_element : m_timed_out_requests) {
+          ers::warning(dunedaq::readoutlibs::RequestTimedOut(ERS_HERE, m_geoid));
+          ++m_num_requests_bad;
+          ++m_num_requests_timed_out;
+          send_empty_fragment(request_element);
+        }
+        for (auto& request_element : m_end_of_run_requests) {
+          ers::warning(dunedaq::readoutlibs::EndOfRunEmptyFragment(ERS_HERE, m_geoid));
+          ++m_num_requests_bad;
+          send_empty_fragment(request_element);
+        }
+        m_ready_requests.clear();
+        m_timed_out_requests.clear();
+        m_end_of_run_requests.clear();
+        lock.lock();
+        // Requests may have been added or become ready meanwhile, check again before sleeping
+        continue;
+      }
+
+      if (m_run_marker.load()) {
+        m_waiting_requests_cv.wait_until(lock, next_wakeup);
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
   }
 
+  // The fragment copies the data, so the elements of the window only need to stay in the buffer while it is built.
+  // The pin protects everything from the oldest element until the window begin is found, then only the window.
   RequestResult data_request(dfmessages::DataRequest dr) override
   {
+    auto t_pin_begin = std::chrono::steady_clock::now();
+    auto pin = m_latency_buffer->pin();
+    m_pin_latency.record(ns_since(t_pin_begin));
+
     // Prepare response
     RequestResult rres(ResultCode::kUnknown, dr);
 
     // Prepare FragmentHeader and empty Fragment pieces list
     auto frag_header = create_fragment_header(dr);
-    std::vector<std::pair<void*, size_t>> frag_pieces;
-    std::ostringstream oss;
+    auto& frag_pieces = thread_local_pieces();
+    // Only formatted if it is logged or reported
+    std::string match_description;
 
     if (m_latency_buffer->occupancy() != 0) {
       // Data availability is calculated here
@@ -539,11 +1031,13 @@ protected:
 
       // List of safe-extraction conditions
       if (last_ts <= start_win_ts && end_win_ts <= newest_ts) { // data is there
+        auto t_phase_begin = std::chrono::steady_clock::now();
         ReadoutType request_element;
         request_element.set_first_timestamp(start_win_ts);
-        auto start_iter = m_error_registry->has_error("MISSING_FRAMES")
+        auto start_iter = m_error_registry->has_error(FrameErrorRegistry::missing_frames)
                             ? m_latency_buffer->lower_bound(request_element, true)
                             : m_latency_buffer->lower_bound(request_element, false);
+        m_search_latency.record(ns_since(t_phase_begin));
         if (start_iter == m_latency_buffer->end()) {
           // Due to some concurrent access, the start_iter could not be retrieved successfully, try again
           ++m_num_requests_delayed;
@@ -551,32 +1045,17 @@ protected:
         } else {
           rres.result_code = ResultCode::kFound;
           ++m_num_requests_found;
+          m_latency_buffer->advance_pin(pin, &*start_iter);
 
-          auto elements_handled = 0;
-
-          ReadoutType* element = &(*start_iter);
-          while (start_iter.good() && element->get_first_timestamp() < end_win_ts) {
-            if (element->get_first_timestamp() < start_win_ts ||
-                element->get_first_timestamp() +
-                    (element->get_num_frames() - 1) * ReadoutType::expected_tick_difference >=
-                  end_win_ts) {
-              // We don't need the whole aggregated object (e.g.: superchunk)
-              for (auto frame_iter = element->begin(); frame_iter != element->end(); frame_iter++) {
-                if ((*frame_iter).get_timestamp() >= start_win_ts && (*frame_iter).get_timestamp() < end_win_ts) {
-                  frag_pieces.emplace_back(
-                    std::make_pair<void*, size_t>(static_cast<void*>(&(*frame_iter)), element->get_frame_size()));
-                }
-              }
-            } else {
-              // We are somewhere in the middle -> the whole aggregated object (e.g.: superchunk) can be copied
-              frag_pieces.emplace_back(
-                std::make_pair<void*, size_t>(static_cast<void*>((*start_iter).begin()), element->get_payload_size()));
+          t_phase_begin = std::chrono::steady_clock::now();
+          scan_latency_buffer(start_iter, [&](ReadoutType& element) {
+            if (element.get_first_timestamp() >= end_win_ts) {
+              return false;
             }
-
-            elements_handled++;
-            ++start_iter;
-            element = &(*start_iter);
-          }
+            add_fragment_pieces(&element, start_win_ts, end_win_ts, frag_pieces);
+            return true;
+          });
+          m_pieces_latency.record(ns_since(t_phase_begin));
         }
       } else if (last_ts > start_win_ts) { // data is gone.
         frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
@@ -597,6 +1076,7 @@ protected:
       // Requeue if needed
       if (rres.result_code == ResultCode::kNotYet) {
         if (m_run_marker.load()) {
+          m_latency_buffer->unpin(pin);
           return rres; // If kNotYet, return immediately, don't check for fragment pieces.
         } else {
           frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
@@ -606,14 +1086,21 @@ protected:
       }
 
       // Build fragment
-      oss << "TS match result on link " << m_geoid.element_id << ": " << ' ' << "Trigger number=" << dr.trigger_number
-          << " "
-          << "Oldest stored TS=" << last_ts << " "
-          << "Start of window TS=" << start_win_ts << " "
-          << "End of window TS=" << end_win_ts << " "
-          << "Estimated newest stored TS=" << newest_ts << " "
-          << "Requestor=" << dr.data_destination;
-      TLOG_DEBUG(TLVL_WORK_STEPS) << oss.str();
+      auto describe_match = [&]() {
+        std::ostringstream oss;
+        oss << "TS match result on link " << m_geoid.element_id << ": " << ' ' << "Trigger number=" << dr.trigger_number
+            << " "
+            << "Oldest stored TS=" << last_ts << " "
+            << "Start of window TS=" << start_win_ts << " "
+            << "End of window TS=" << end_win_ts << " "
+            << "Estimated newest stored TS=" << newest_ts << " "
+            << "Requestor=" << dr.data_destination;
+        return oss.str();
+      };
+      TLOG_DEBUG(TLVL_WORK_STEPS) << describe_match();
+      if (rres.result_code != ResultCode::kFound) {
+        match_description = describe_match();
+      }
     } else {
       ers::warning(RequestOnEmptyBuffer(ERS_HERE, m_geoid, "Data not found"));
       frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
@@ -622,14 +1109,17 @@ protected:
     }
 
     if (rres.result_code != ResultCode::kFound) {
-      ers::warning(dunedaq::readoutlibs::TrmWithEmptyFragment(ERS_HERE, m_geoid, oss.str()));
+      ers::warning(dunedaq::readoutlibs::TrmWithEmptyFragment(ERS_HERE, m_geoid, match_description));
     }
 
     // Create fragment from pieces
+    auto t_fragment_begin = std::chrono::steady_clock::now();
     rres.fragment = std::make_unique<daqdataformats::Fragment>(frag_pieces);
+    m_latency_buffer->unpin(pin);
 
     // Set header
     rres.fragment->set_header_fields(frag_header);
+    m_fragment_latency.record(ns_since(t_fragment_begin));
 
     return rres;
   }
@@ -648,20 +1138,32 @@ protected:
 
   // Requests
   std::size_t m_max_requested_elements;
-  std::mutex m_cv_mutex;
-  std::condition_variable m_cv;
-  std::atomic<bool> m_cleanup_requested = false;
-  std::atomic<int> m_requests_running = 0;
   std::vector<RequestElement> m_waiting_requests;
   std::mutex m_waiting_requests_lock;
+  std::condition_variable m_waiting_requests_cv;
+  std::atomic<uint64_t> m_earliest_waiting_window_end{ std::numeric_limits<uint64_t>::max() }; // NOLINT(build/unsigned)
+  // Published for get_info whenever the heap changes, the heap itself is only read under the lock
+  std::atomic<std::size_t> m_num_waiting_requests{ 0 };
+  // Taken out of the waiting requests, only used by the waiting requests thread
+  std::vector<RequestElement> m_ready_requests;
+  std::vector<RequestElement> m_timed_out_requests;
+  std::vector<RequestElement> m_end_of_run_requests;
+  // Upper limit for the sleep of the waiting requests thread, in case a wake-up was missed
+  static constexpr std::chrono::milliseconds m_max_waiting_interval{ 100 };
+
+  // Request groups that are queued in the thread pool but not started yet
+  std::vector<std::shared_ptr<RequestGroup>> m_pending_groups;
+  std::mutex m_pending_groups_lock;
 
   // Data extractor threads pool and corresponding requests
-  std::unique_ptr<boost::asio::thread_pool> m_request_handler_thread_pool;
+  std::unique_ptr<RequestScheduler> m_request_scheduler;
+  RequestScheduler::Policy m_scheduling_policy = RequestScheduler::Policy::fifo;
+  uint64_t m_max_coalesced_window_ticks = 0; // NOLINT(build/unsigned)
   size_t m_num_request_handling_threads = 0;
+  std::vector<int> m_request_handling_cpus;
 
   // Error registry
   std::unique_ptr<FrameErrorRegistry>& m_error_registry;
-  std::chrono::time_point<std::chrono::high_resolution_clock> m_t0;
 
   // The run marker
   std::atomic<bool> m_run_marker = false;
@@ -675,7 +1177,11 @@ protected:
   float m_pop_limit_pct;     // buffer occupancy percentage to issue a pop request
   float m_pop_size_pct;      // buffer percentage to pop
   unsigned m_pop_limit_size; // pop_limit_pct * buffer_capacity
-  size_t m_retry_count;
+  bool m_retention_mode = false;
+  uint64_t m_retention_ticks = 0;          // NOLINT(build/unsigned)
+  std::size_t m_retention_eviction_step = 64;
+  std::size_t m_writes_since_eviction = 0; // Only used by the consumer
+  std::chrono::milliseconds m_request_timeout{ 1000 };
   size_t m_buffer_capacity;
   daqdataformats::GeoID m_geoid;
   static const constexpr uint32_t m_min_delay_us = 30000; // NOLINT(build/unsigned)
@@ -685,20 +1191,31 @@ protected:
   bool m_recording_configured = false;
 
   // Stats
-  std::atomic<int> m_pop_counter;
-  std::atomic<int> m_num_buffer_cleanups{ 0 };
-  std::atomic<int> m_pop_reqs;
-  std::atomic<int> m_pops_count;
+  ShardedCounter m_num_buffer_cleanups;
+  ShardedCounter m_pop_reqs;
+  ShardedCounter m_pops_count;
   std::atomic<int> m_occupancy;
-  std::atomic<int> m_num_requests_found{ 0 };
-  std::atomic<int> m_num_requests_bad{ 0 };
-  std::atomic<int> m_num_requests_old_window{ 0 };
-  std::atomic<int> m_num_requests_delayed{ 0 };
-  std::atomic<int> m_num_requests_uncategorized{ 0 };
-  std::atomic<int> m_num_requests_timed_out{ 0 };
-  std::atomic<int> m_handled_requests{ 0 };
-  std::atomic<int> m_response_time_acc{ 0 };
-  std::atomic<int> m_payloads_written{ 0 };
+  std::atomic<uint64_t> m_newest_timestamp{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_oldest_timestamp{ 0 }; // NOLINT(build/unsigned)
+  ShardedCounter m_num_requests_found;
+  ShardedCounter m_num_requests_bad;
+  ShardedCounter m_num_requests_old_window;
+  ShardedCounter m_num_requests_delayed;
+  ShardedCounter m_num_requests_uncategorized;
+  ShardedCounter m_num_requests_timed_out;
+  ShardedCounter m_num_requests_coalesced;
+  ShardedCounter m_handled_requests;
+  ShardedCounter m_response_time_acc; // in us
+  // Latencies of the request handling phases in ns
+  LatencyHistogram m_pin_latency;
+  LatencyHistogram m_search_latency;
+  LatencyHistogram m_pieces_latency;
+  LatencyHistogram m_fragment_latency;
+  LatencyHistogram m_push_latency;
+  LatencyHistogram m_response_latency;
+  ShardedCounter m_payloads_written;
+  ShardedCounter m_recorded_bytes;
+  ShardedCounter m_recording_wait_ns;
   // std::atomic<int> m_avg_req_count{ 0 }; // for opmon, later
   // std::atomic<int> m_avg_resp_time{ 0 };
   // Request response time log (kept for debugging if needed)
@@ -41,10 +41,7 @@ public:
   void issue_request(dfmessages::DataRequest datarequest,
                      appfwk::DAQSink<std::pair<std::unique_ptr<daqdataformats::Fragment>, std::string>>& fragment_queue) override
   {
-    auto frag_header = inherited::create_fragment_header(datarequest);
-    frag_header.error_bits |= (0x1 << static_cast<size_t>(daqdataformats::FragmentErrorBits::kDataNotFound));
-    auto fragment = std::make_unique<daqdataformats::Fragment>(std::vector<std::pair<void*, size_t>>());
-    fragment->set_header_fields(frag_header);
+    auto fragment = inherited::create_empty_fragment(datarequest);
 
     // ers::warning(dunedaq::readoutlibs::TrmWithEmptyFragment(ERS_HERE, "DLH is configured to send empty fragment"));
     TLOG_DEBUG(TLVL_WORK_STEPS) << "DLH is configured to send empty fragment";
@@ -30,32 +30,49 @@ public:
     : BinarySearchQueueModel<T>(size)
   {}
 
+  // The element offset is derived from the timestamp distance to the oldest element. The guess is validated and,
+  // if earlier frames were missing, corrected by a local galloping search instead of a full binary search.
   typename IterableQueueModel<T>::Iterator lower_bound(T& element, bool with_errors = false)
   {
-    if (with_errors) {
-      return BinarySearchQueueModel<T>::lower_bound(element, with_errors);
-    }
     uint64_t timestamp = element.get_first_timestamp(); // NOLINT(build/unsigned)
     unsigned int start_index =
       IterableQueueModel<T>::readIndex_.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
-    size_t occupancy_guess = IterableQueueModel<T>::occupancy();
+    unsigned int end_index =
+      IterableQueueModel<T>::writeIndex_.load(std::memory_order_acquire); // NOLINT(build/unsigned)
+    if (start_index == end_index) {
+      return IterableQueueModel<T>::end();
+    }
+    size_t occupancy_guess = end_index > start_index ? end_index - start_index
+                                                     : IterableQueueModel<T>::size_ + end_index - start_index;
     uint64_t last_ts = IterableQueueModel<T>::records_[start_index].get_first_timestamp(); // NOLINT(build/unsigned)
     uint64_t newest_ts =                                                                   // NOLINT(build/unsigned)
       last_ts +
       occupancy_guess * T::expected_tick_difference * IterableQueueModel<T>::records_[start_index].get_num_frames();
 
-    if (last_ts > timestamp || timestamp > newest_ts) {
+    // Without missing frames the timestamp range is fully determined by the occupancy. With missing frames the
+    // newest timestamp is larger than predicted, so only the lower end can be rejected upfront.
+    if (last_ts > timestamp || (!with_errors && timestamp > newest_ts)) {
       return IterableQueueModel<T>::end();
     }
 
     int64_t time_tick_diff = (timestamp - last_ts) / T::expected_tick_difference;
-    uint32_t num_element_offset = // NOLINT(build/unsigned)
-      time_tick_diff / IterableQueueModel<T>::records_[start_index].get_num_frames();
-    uint32_t target_index = start_index + num_element_offset; // NOLINT(build/unsigned)
-    if (target_index >= IterableQueueModel<T>::size_) {
-      target_index -= IterableQueueModel<T>::size_;
+    size_t num_element_offset = time_tick_diff / IterableQueueModel<T>::records_[start_index].get_num_frames();
+    if (num_element_offset >= occupancy_guess) {
+      num_element_offset = occupancy_guess - 1;
+    }
+
+    // Fast path: the guessed element is the last one not greater than the searched one
+    T& guessed_element = BinarySearchQueueModel<T>::element_at(start_index, num_element_offset);
+    if (!(element < guessed_element) &&
+        (num_element_offset + 1 == occupancy_guess ||
+         element < BinarySearchQueueModel<T>::element_at(start_index, num_element_offset + 1))) {
+      uint32_t target_index = start_index + num_element_offset; // NOLINT(build/unsigned)
+      if (target_index >= IterableQueueModel<T>::size_) {
+        target_index -= IterableQueueModel<T>::size_;
+      }
+      return typename IterableQueueModel<T>::Iterator(*this, target_index);
     }
-    return typename IterableQueueModel<T>::Iterator(*this, target_index);
+    return BinarySearchQueueModel<T>::search_from(element, start_index, occupancy_guess, num_element_offset);
   }
 };
 
@@ -33,8 +33,11 @@
 
 #include <folly/lang/Align.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdlib>
 #include <cxxabi.h>
@@ -45,14 +48,19 @@
 #include <mutex>
 #include <new>
 #include <stdexcept>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <sys/mman.h>
+#include <unistd.h>
 #include <xmmintrin.h>
 
 #ifdef WITH_LIBNUMA_SUPPORT
 #include <numa.h>
+#include <numaif.h>
 #endif
 
 namespace dunedaq {
@@ -77,6 +85,7 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     , numa_node_(0)
     , intrinsic_allocator_(false)
     , alignment_size_(0)
+    , mapped_size_(0)
     , invalid_configuration_requested_(false)
     , size_(2)
     , records_(static_cast<T*>(std::malloc(sizeof(T) * 2)))
@@ -95,6 +104,7 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     , numa_node_(0)
     , intrinsic_allocator_(false)
     , alignment_size_(0)
+    , mapped_size_(0)
     , invalid_configuration_requested_(false)
     , size_(size)
     , records_(static_cast<T*>(std::malloc(sizeof(T) * size)))
@@ -131,6 +141,7 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     , numa_node_(numa_node)
     , intrinsic_allocator_(intrinsic_allocator)
     , alignment_size_(alignment_size)
+    , mapped_size_(0)
     , invalid_configuration_requested_(false)
     , size_(size)
     , readIndex_(0)
@@ -174,7 +185,10 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
       }
     }
 
-    if (intrinsic_allocator_) {
+    if (mapped_size_ > 0) {
+      munmap(records_, mapped_size_);
+      mapped_size_ = 0;
+    } else if (intrinsic_allocator_) {
       _mm_free(records_);
     } else if (numa_aware_) {
 #ifdef WITH_LIBNUMA_SUPPORT
@@ -224,6 +238,109 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     alignment_size_ = alignment_size;
   }
 
+  // Anonymous mapping, optionally backed by huge pages, bound to a NUMA node and locked in memory.
+  // huge_pages is one of "none", "thp" (transparent huge pages), "huge_2mb" or "huge_1gb" (MAP_HUGETLB).
+  void allocate_mapped_memory(std::size_t size,
+                              const std::string& huge_pages = "none",
+                              bool lock_memory = false,
+                              bool numa_aware = false,
+                              uint8_t numa_node = 0) // NOLINT (build/unsigned)
+  {
+    assert(size >= 2);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    const std::size_t base_page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t page_size = base_page_size;
+    if (huge_pages == "huge_2mb") {
+      flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+      page_size = std::size_t(1) << 21;
+    } else if (huge_pages == "huge_1gb") {
+      flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+      page_size = std::size_t(1) << 30;
+    } else if (huge_pages != "none" && huge_pages != "thp") {
+      throw GenericConfigurationError(ERS_HERE, "Unknown latency buffer huge page mode: " + huge_pages);
+    }
+    std::size_t mapped_size = (sizeof(T) * size + page_size - 1) / page_size * page_size;
+
+    void* memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED && (flags & MAP_HUGETLB)) {
+      ers::warning(GenericConfigurationError(
+        ERS_HERE, "No " + huge_pages + " pages available for the latency buffer, using transparent huge pages"));
+      flags = MAP_PRIVATE | MAP_ANONYMOUS;
+      mapped_size = (sizeof(T) * size + base_page_size - 1) / base_page_size * base_page_size;
+      memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+    if (memory == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (!(flags & MAP_HUGETLB) && huge_pages != "none") {
+      madvise(memory, mapped_size, MADV_HUGEPAGE);
+    }
+
+    if (numa_aware) {
+#ifdef WITH_LIBNUMA_SUPPORT
+      unsigned long nodemask = 1UL << numa_node; // NOLINT(runtime/int)
+      if (mbind(memory, mapped_size, MPOL_BIND, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+        ers::warning(GenericConfigurationError(ERS_HERE, "Failed to bind the latency buffer to its NUMA node"));
+      }
+#else
+      munmap(memory, mapped_size);
+      throw GenericConfigurationError(ERS_HERE,
+                                      "NUMA allocation was requested but program was built without USE_LIBNUMA");
+#endif
+    }
+
+    // Locking faults in all pages of the mapping, so no separate pre-faulting is needed
+    if (lock_memory && mlock(memory, mapped_size) != 0) {
+      ers::warning(
+        GenericConfigurationError(ERS_HERE, "Failed to lock the latency buffer in memory, check RLIMIT_MEMLOCK"));
+    }
+
+    records_ = static_cast<T*>(memory);
+    mapped_size_ = mapped_size;
+    size_ = size;
+    numa_aware_ = numa_aware;
+    numa_node_ = numa_node;
+    intrinsic_allocator_ = false;
+    alignment_size_ = 0;
+  }
+
+  //! Touch every page of the buffer so that the page faults don't hit the first writes of a run.
+  //! The pages are split over num_threads threads, which run on the NUMA node of the buffer if it is NUMA aware.
+  void prefault_memory(std::size_t num_threads = 1)
+  {
+    const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t num_pages = (sizeof(T) * size_ + page_size - 1) / page_size;
+    num_threads = std::max<std::size_t>(1, std::min(num_threads, num_pages / min_pages_per_prefault_thread));
+    auto* bytes = reinterpret_cast<volatile char*>(records_);
+    const std::size_t num_bytes = sizeof(T) * size_;
+
+    auto touch_pages = [&](std::size_t first_page, std::size_t last_page) {
+#ifdef WITH_LIBNUMA_SUPPORT
+      if (numa_aware_) {
+        numa_run_on_node(numa_node_);
+      }
+#endif
+      for (std::size_t offset = first_page * page_size; offset < std::min(last_page * page_size, num_bytes);
+           offset += page_size) {
+        bytes[offset] = 0;
+      }
+    };
+
+    auto t_begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    const std::size_t pages_per_thread = (num_pages + num_threads - 1) / num_threads;
+    // The calling thread only waits, so that its affinity is left untouched
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      threads.emplace_back(touch_pages, i * pages_per_thread, (i + 1) * pages_per_thread);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t_begin);
+    TLOG() << "Pre-faulted " << num_pages << " pages of the latency buffer with " << num_threads << " thread(s) in "
+           << took.count() << " ms";
+  }
+
   // bool put(T& record) { return write(record); }
 
   bool write(T&& record) override
@@ -246,6 +363,34 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     return false;
   }
 
+  // Moves as many records as there are free slots, then publishes all of them with a single
+  // store of the write index. Records that do not fit are dropped and counted as overflow.
+  std::size_t write_bulk(T* records, std::size_t amount, const T** written) override
+  {
+    auto const currentWrite = writeIndex_.load(std::memory_order_relaxed);
+    auto const currentRead = readIndex_.load(std::memory_order_acquire);
+    std::size_t free_slots =
+      (currentRead > currentWrite) ? currentRead - currentWrite - 1 : size_ - currentWrite + currentRead - 1;
+    std::size_t to_write = std::min(amount, free_slots);
+
+    auto nextRecord = currentWrite;
+    for (std::size_t i = 0; i < to_write; ++i) {
+      new (&records_[nextRecord]) T(std::move(records[i]));
+      if (written != nullptr) {
+        written[i] = &records_[nextRecord];
+      }
+      if (++nextRecord == size_) { // NOLINT(runtime/increment_decrement)
+        nextRecord = 0;
+      }
+    }
+    writeIndex_.store(nextRecord, std::memory_order_release);
+
+    if (to_write < amount) {
+      overflow_ctr += static_cast<int>(amount - to_write);
+    }
+    return to_write;
+  }
+
   // move (or copy) the value at the front of the queue to given variable
   bool read(T& record) override
   {
@@ -280,12 +425,88 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     readIndex_.store(nextRecord, std::memory_order_release);
   }
 
-  // RS: Will this work?
-  void pop(std::size_t x)
+  // Pops at most x elements, never passing the oldest pinned element.
+  // Only pop() respects pins, read() and popFront() must not be mixed with readers holding pins.
+  void pop(std::size_t x) override { pop_front_elements(x); }
+
+protected:
+  // Bulk version of pop(), returns the number of popped elements. The read index moves with a single store and
+  // trivially destructible elements are not visited at all.
+  std::size_t pop_front_elements(std::size_t x)
   {
-    for (std::size_t i = 0; i < x; i++) {
-      popFront();
+    pop_intent_.store(true);
+    auto const currentRead = readIndex_.load(std::memory_order_relaxed);
+    auto const currentWrite = writeIndex_.load(std::memory_order_acquire);
+    x = std::min<std::size_t>(x, currentWrite >= currentRead ? currentWrite - currentRead : size_ + currentWrite - currentRead);
+    if (num_pins_.load() > 0) {
+      for (auto& slot : pins_) {
+        auto const pinned = slot.index.load();
+        if (pinned != no_pin) {
+          std::size_t distance = pinned >= currentRead ? pinned - currentRead : size_ + pinned - currentRead;
+          x = std::min(x, distance);
+        }
+      }
+    }
+    std::size_t nextRecord = currentRead + x;
+    if (nextRecord >= size_) {
+      nextRecord -= size_;
+    }
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      for (std::size_t i = 0, index = currentRead; i < x; ++i) {
+        records_[index].~T();
+        if (++index == size_) {
+          index = 0;
+        }
+      }
+    }
+    if (x > 0) {
+      readIndex_.store(nextRecord, std::memory_order_release);
     }
+    pop_intent_.store(false);
+    return x;
+  }
+
+public:
+  // Pins the element at the read index. The pin is only established once it was published while no pop was in
+  // progress and the read index did not move, so a concurrent pop() either sees the pin or completes before it.
+  int pin() override
+  {
+    int pin = -1;
+    while (pin < 0) {
+      auto const currentRead = readIndex_.load();
+      for (std::size_t i = 0; i < max_pins; ++i) {
+        auto expected = no_pin;
+        if (pins_[i].index.compare_exchange_strong(expected, currentRead)) {
+          pin = static_cast<int>(i);
+          break;
+        }
+      }
+      if (pin < 0) {
+        std::this_thread::yield();
+      }
+    }
+    ++num_pins_;
+    while (true) {
+      auto const currentRead = readIndex_.load();
+      pins_[pin].index.store(currentRead);
+      if (!pop_intent_.load() && readIndex_.load() == currentRead) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+    return pin;
+  }
+
+  // The referenced element has to be within the pinned range
+  void advance_pin(int pin, const T* element) override
+  {
+    pins_[pin].index.store(static_cast<unsigned int>(element - records_)); // NOLINT(build/unsigned)
+  }
+
+  void unpin(int pin) override
+  {
+    pins_[pin].index.store(no_pin);
+    --num_pins_;
   }
 
   bool isEmpty() const
@@ -344,14 +565,14 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     pointer operator->() { return &m_queue.records_[m_index]; }
     Iterator& operator++() // NOLINT(runtime/increment_decrement) :)
     {
-      if (good()) {
-        m_index++;
-        if (m_index == m_queue.size_) {
-          m_index = 0;
-        }
+      if (m_index == end_index) {
+        return *this;
+      }
+      if (++m_index == m_queue.size_) { // NOLINT(runtime/increment_decrement)
+        m_index = 0;
       }
       if (!good()) {
-        m_index = std::numeric_limits<uint32_t>::max(); // NOLINT(build/unsigned)
+        m_index = end_index;
       }
       return *this;
     }
@@ -366,23 +587,99 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     friend bool operator==(const Iterator& a, const Iterator& b) { return a.m_index == b.m_index; }
     friend bool operator!=(const Iterator& a, const Iterator& b) { return a.m_index != b.m_index; }
 
-    bool good()
+    bool good() const
     {
+      if (m_index == end_index) {
+        return false;
+      }
       auto const currentRead = m_queue.readIndex_.load(std::memory_order_relaxed);
-      auto const currentWrite = m_queue.writeIndex_.load(std::memory_order_relaxed);
-      return (*this != m_queue.end()) &&
-             ((m_index >= currentRead && m_index < currentWrite) ||
-              (m_index >= currentRead && currentWrite < currentRead) ||
-              (currentWrite < currentRead && m_index < currentRead && m_index < currentWrite));
+      auto const currentWrite = m_queue.writeIndex_.load(std::memory_order_acquire);
+      return currentRead <= currentWrite ? (m_index >= currentRead && m_index < currentWrite)
+                                         : (m_index >= currentRead || m_index < currentWrite);
     }
 
-    uint32_t get_index() { return m_index; } // NOLINT(build/unsigned)
+    uint32_t get_index() const { return m_index; } // NOLINT(build/unsigned)
+
+    static constexpr uint32_t end_index = std::numeric_limits<uint32_t>::max(); // NOLINT(build/unsigned)
 
   private:
     IterableQueueModel<T>& m_queue;
     uint32_t m_index; // NOLINT(build/unsigned)
   };
 
+  //! Contiguous run of elements in the ring
+  struct Span
+  {
+    T* first = nullptr;
+    std::size_t count = 0;
+
+    T* begin() const { return first; }
+    T* end() const { return first + count; }
+  };
+
+  //! The elements from an iterator up to the newest one at the time of the call, at most two runs because of the wrap
+  struct Spans
+  {
+    std::array<Span, 2> parts;
+
+    std::size_t size() const { return parts[0].count + parts[1].count; }
+  };
+
+  // How many elements sequential scans prefetch ahead of the current one
+  static constexpr std::size_t prefetch_distance = 4;
+
+  // Takes the read and write index once. The spans stay valid as long as the iterator would, i.e. while their
+  // elements are pinned or there is no concurrent pop.
+  Spans spans(const Iterator& from)
+  {
+    Spans result;
+    if (!from.good()) {
+      return result;
+    }
+    std::size_t const index = from.get_index();
+    std::size_t const currentWrite = writeIndex_.load(std::memory_order_acquire);
+    if (index < currentWrite) {
+      result.parts[0] = Span{ &records_[index], currentWrite - index };
+    } else {
+      result.parts[0] = Span{ &records_[index], size_ - index };
+      result.parts[1] = Span{ &records_[0], currentWrite };
+    }
+    for (auto& part : result.parts) {
+      for (std::size_t i = 0; i < std::min(part.count, prefetch_distance); ++i) {
+        __builtin_prefetch(&part.first[i]);
+      }
+    }
+    return result;
+  }
+
+  // Calls f on the elements from an iterator on, in order, until f returns false or the snapshot of spans() ends.
+  // Returns the number of elements for which f returned true.
+  template<class F>
+  std::size_t scan(const Iterator& from, F&& f)
+  {
+    auto snapshot = spans(from);
+    std::size_t visited = 0;
+    for (auto& part : snapshot.parts) {
+      for (std::size_t i = 0; i < part.count; ++i) {
+        if (i + prefetch_distance < part.count) {
+          __builtin_prefetch(&part.first[i + prefetch_distance]);
+        }
+        if (!f(part.first[i])) {
+          return visited;
+        }
+        ++visited;
+      }
+    }
+    return visited;
+  }
+
+  //! Iterator at an element of the buffer, e.g. a pinned one, end() if it is not stored anymore
+  Iterator iterator_of(const T* element)
+  {
+    Iterator iter(*this, static_cast<uint32_t>(element - records_)); // NOLINT(build/unsigned)
+    return iter.good() ? iter : end();
+  }
+
   Iterator begin()
   {
     auto const currentRead = readIndex_.load(std::memory_order_relaxed);
@@ -423,7 +720,7 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
 
   Iterator end()
   {
-    return Iterator(*this, std::numeric_limits<uint32_t>::max()); // NOLINT(build/unsigned)
+    return Iterator(*this, Iterator::end_index);
   }
 
   void conf(const nlohmann::json& cfg) override
@@ -432,11 +729,19 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     assert(conf.latency_buffer_size >= 2);
     free_memory();
 
-    allocate_memory(conf.latency_buffer_size,
-                    conf.latency_buffer_numa_aware,
-                    conf.latency_buffer_numa_node,
-                    conf.latency_buffer_intrinsic_allocator,
-                    conf.latency_buffer_alignment_size);
+    if (conf.latency_buffer_mmap_allocator) {
+      allocate_mapped_memory(conf.latency_buffer_size,
+                             conf.latency_buffer_huge_pages,
+                             conf.latency_buffer_mlock,
+                             conf.latency_buffer_numa_aware,
+                             conf.latency_buffer_numa_node);
+    } else {
+      allocate_memory(conf.latency_buffer_size,
+                      conf.latency_buffer_numa_aware,
+                      conf.latency_buffer_numa_node,
+                      conf.latency_buffer_intrinsic_allocator,
+                      conf.latency_buffer_alignment_size);
+    }
     readIndex_ = 0;
     writeIndex_ = 0;
 
@@ -444,12 +749,9 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
       throw std::bad_alloc();
     }
 
-    if (conf.latency_buffer_preallocation) {
-      for (size_t i = 0; i < size_ - 1; ++i) {
-        T element;
-        write_(std::move(element));
-      }
-      flush();
+    if (conf.latency_buffer_preallocation && !(conf.latency_buffer_mmap_allocator && conf.latency_buffer_mlock)) {
+      prefault_memory(conf.latency_buffer_prefault_threads > 0 ? conf.latency_buffer_prefault_threads
+                                                               : std::thread::hardware_concurrency());
     }
   }
 
@@ -460,6 +762,7 @@ struct IterableQueueModel : public LatencyBufferConcept<T>
     numa_node_ = 0;
     intrinsic_allocator_ = false;
     alignment_size_ = 0;
+    mapped_size_ = 0;
     invalid_configuration_requested_ = false;
     size_ = 2;
     records_ = static_cast<T*>(std::malloc(sizeof(T) * 2));
@@ -510,10 +813,25 @@ protected:
   uint8_t numa_node_; // NOLINT (build/unsigned)
   bool intrinsic_allocator_;
   std::size_t alignment_size_;
+  std::size_t mapped_size_; // Non-zero if records_ was allocated with mmap
   bool invalid_configuration_requested_;
 
   std::thread ptrlogger;
 
+  // Avoid spawning threads for small buffers
+  static constexpr std::size_t min_pages_per_prefault_thread = 4096;
+
+  // Pins of readers that require elements to stay in the buffer
+  static constexpr std::size_t max_pins = 64;
+  static constexpr unsigned int no_pin = std::numeric_limits<unsigned int>::max(); // NOLINT(build/unsigned)
+  struct alignas(folly::hardware_destructive_interference_size) PinSlot
+  {
+    std::atomic<unsigned int> index{ no_pin }; // NOLINT(build/unsigned)
+  };
+  std::array<PinSlot, max_pins> pins_;
+  std::atomic<int> num_pins_{ 0 };
+  std::atomic<bool> pop_intent_{ false };
+
   char pad0_[folly::hardware_destructive_interference_size]; // NOLINT(runtime/arrays)
   uint32_t size_;                                            // NOLINT(build/unsigned)
   T* records_;
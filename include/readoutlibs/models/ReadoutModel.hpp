@@ -41,9 +41,16 @@
 
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/utils/ReusableThread.hpp"
+#include "readoutlibs/utils/ShardedCounter.hpp"
+#include "readoutlibs/utils/ThreadAffinity.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -121,12 +128,44 @@ public:
     m_timesync_connection_name = conf.timesync_connection_name;
     m_timesync_topic_name = conf.timesync_topic_name;
 
+    m_consumer_batch_size = conf.consumer_batch_size > 1 ? static_cast<size_t>(conf.consumer_batch_size) : 1;
+    m_consumer_batch.clear();
+    m_consumer_batch_written.clear();
+    if (m_consumer_batch_size > 1) {
+      m_consumer_batch.resize(m_consumer_batch_size);
+      m_consumer_batch_written.resize(m_consumer_batch_size);
+    }
+
     // Configure implementations:
     m_raw_processor_impl->conf(args);
+
+    // Batches that are preprocessed while the next ones are read, committed to the latency buffer in order
+    m_preprocess_slots.clear();
+    for (size_t i = 0; i < m_raw_processor_impl->preprocess_window(); ++i) {
+      m_preprocess_slots.push_back(std::make_unique<PreprocessSlot>());
+      m_preprocess_slots.back()->items.resize(m_consumer_batch_size);
+    }
+    if (!m_preprocess_slots.empty()) {
+      m_consumer_batch_written.resize(m_consumer_batch_size);
+    }
+    // A latency buffer without a fixed NUMA node goes on the node of the consumer, which writes every element
+    nlohmann::json latency_buffer_args = args;
+    auto latency_buffer_conf = args["latencybufferconf"].get<readoutconfig::LatencyBufferConf>();
+    if (latency_buffer_conf.latency_buffer_numa_node < 0) {
+      int numa_node = conf.consumer_cpus.empty() ? -1 : numa_node_of_cpu_id(conf.consumer_cpus.front());
+      if (numa_node < 0) {
+        // Without libnuma or consumer_cpus there is no node to derive
+        ers::warning(ConfigurationError(ERS_HERE, m_geoid, "NUMA node of the consumer CPU is unknown, using node 0"));
+        numa_node = 0;
+      }
+      latency_buffer_conf.latency_buffer_numa_node = numa_node;
+      latency_buffer_args["latencybufferconf"] = latency_buffer_conf;
+    }
+
     // Configure the latency buffer before the request handler so the request handler can check for alignment
     // restrictions
     try {
-      m_latency_buffer_impl->conf(args);
+      m_latency_buffer_impl->conf(latency_buffer_args);
     } catch (const std::bad_alloc& be) {
       ers::error(ConfigurationError(ERS_HERE, m_geoid, "Latency Buffer can't be allocated with size!"));
     }
@@ -137,6 +176,11 @@ public:
     m_consumer_thread.set_name("consumer", conf.element_id);
     m_timesync_thread.set_name("timesync", conf.element_id);
     m_requester_thread.set_name("requests", conf.element_id);
+    // Pinned at configuration, so that the placement is in effect from the first payload on
+    if (!m_consumer_thread.set_cpus(conf.consumer_cpus) || !m_timesync_thread.set_cpus(conf.timesync_cpus) ||
+        !m_requester_thread.set_cpus(conf.requests_cpus)) {
+      ers::warning(ConfigurationError(ERS_HERE, m_geoid, "Could not set the CPU affinity of the readout threads"));
+    }
   }
 
   void scrap(const nlohmann::json& args)
@@ -148,16 +192,11 @@ public:
 
   void start(const nlohmann::json& args)
   {
-    // Reset opmon variables
-    m_sum_payloads = 0;
-    m_num_payloads = 0;
-    m_sum_requests = 0;
-    m_num_requests = 0;
-    m_num_payloads_overwritten = 0;
-    m_stats_packet_count = 0;
-    m_rawq_timeout_count = 0;
-
-    m_t0 = std::chrono::high_resolution_clock::now();
+    // Reset opmon variables, before the threads incrementing them start
+    m_payloads.reset();
+    m_requests.reset();
+    m_num_payloads_overwritten.reset();
+    m_rawq_timeout_count.reset();
 
     m_run_number = args.value<dunedaq::daqdataformats::run_number_t>("run", 1);
 
@@ -182,6 +221,10 @@ public:
     while (!m_consumer_thread.get_readiness()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+    {
+      std::lock_guard<std::mutex> lock(m_request_wakeup_mutex);
+      m_request_wakeup.notify_all();
+    }
     while (!m_requester_thread.get_readiness()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
@@ -196,25 +239,23 @@ public:
   void get_info(opmonlib::InfoCollector& ci, int level)
   {
     readoutinfo::ReadoutInfo ri;
-    ri.sum_payloads = m_sum_payloads.load();
-    ri.num_payloads = m_num_payloads.exchange(0);
-    ri.sum_requests = m_sum_requests.load();
-    ri.num_requests = m_num_requests.exchange(0);
-    ri.num_payloads_overwritten = m_num_payloads_overwritten.exchange(0);
+    auto payloads = m_payloads.collect();
+    auto requests = m_requests.collect();
+    ri.sum_payloads = m_payloads.total();
+    ri.num_payloads = payloads.delta;
+    ri.sum_requests = m_requests.total();
+    ri.num_requests = requests.delta;
+    ri.num_payloads_overwritten = m_num_payloads_overwritten.collect().delta;
     ri.num_buffer_elements = m_latency_buffer_impl->occupancy();
 
-    auto now = std::chrono::high_resolution_clock::now();
-    int new_packets = m_stats_packet_count.exchange(0);
-    double seconds = std::chrono::duration_cast<std::chrono::microseconds>(now - m_t0).count() / 1000000.;
-    TLOG_DEBUG(TLVL_TAKE_NOTE) << "Consumed Packet rate: " << std::to_string(new_packets / seconds / 1000.) << " [kHz]";
-    auto rawq_timeouts = m_rawq_timeout_count.exchange(0);
+    TLOG_DEBUG(TLVL_TAKE_NOTE) << "Consumed Packet rate: " << std::to_string(payloads.rate / 1000.) << " [kHz]";
+    auto rawq_timeouts = m_rawq_timeout_count.collect().delta;
     if (rawq_timeouts > 0) {
       TLOG_DEBUG(TLVL_TAKE_NOTE) << "***ERROR: Raw input queue timed out " << std::to_string(rawq_timeouts)
                                  << " times!";
     }
-    m_t0 = now;
 
-    ri.rate_payloads_consumed = new_packets / seconds / 1000.;
+    ri.rate_payloads_consumed = payloads.rate / 1000.;
     ri.num_raw_queue_timeouts = rawq_timeouts;
 
     ci.add(ri);
@@ -224,6 +265,14 @@ public:
   }
 
 private:
+  // A batch in the preprocess window of the pipelined consumer
+  struct PreprocessSlot
+  {
+    std::vector<ReadoutType> items;
+    size_t size{ 0 };
+    std::atomic<size_t> pending{ 0 };
+  };
+
   void setup_request_queues(const nlohmann::json& args)
   {
     auto queue_index = appfwk::queue_index(args, {});
@@ -237,12 +286,17 @@ private:
 
   void run_consume()
   {
-    m_rawq_timeout_count = 0;
-    m_num_payloads = 0;
-    m_sum_payloads = 0;
-    m_stats_packet_count = 0;
-
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Consumer thread started...";
+    if (!m_preprocess_slots.empty()) {
+      run_consume_pipelined();
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Consumer thread joins... ";
+      return;
+    }
+    if (m_consumer_batch_size > 1) {
+      run_consume_batches();
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Consumer thread joins... ";
+      return;
+    }
     while (m_run_marker.load() || m_raw_data_source->can_pop()) {
       ReadoutType payload;
       // Try to acquire data
@@ -251,12 +305,14 @@ private:
         m_raw_processor_impl->preprocess_item(&payload);
         if (!m_latency_buffer_impl->write(std::move(payload))) {
           TLOG_DEBUG(TLVL_TAKE_NOTE) << "***ERROR: Latency buffer is full and data was overwritten!";
-          m_num_payloads_overwritten++;
+          ++m_num_payloads_overwritten;
+        }
+        auto newest_element = m_latency_buffer_impl->back();
+        m_raw_processor_impl->postprocess_item(newest_element);
+        if (newest_element != nullptr) {
+          m_request_handler_impl->notify_new_data(newest_element->get_first_timestamp());
         }
-        m_raw_processor_impl->postprocess_item(m_latency_buffer_impl->back());
-        ++m_num_payloads;
-        ++m_sum_payloads;
-        ++m_stats_packet_count;
+        ++m_payloads;
       } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
         ++m_rawq_timeout_count;
         // ers::error(QueueTimeoutError(ERS_HERE, " raw source "));
@@ -265,11 +321,102 @@ private:
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Consumer thread joins... ";
   }
 
+  // Drains whatever is already available on the raw input (up to the batch size) after a blocking pop,
+  // then hands the whole batch to the raw processor and the latency buffer in one go.
+  void run_consume_batches()
+  {
+    while (m_run_marker.load() || m_raw_data_source->can_pop()) {
+      size_t batch_size = pop_batch(m_consumer_batch.data());
+      if (batch_size == 0) {
+        continue;
+      }
+      m_raw_processor_impl->preprocess_items(m_consumer_batch.data(), batch_size);
+      commit_batch(m_consumer_batch.data(), batch_size);
+    }
+  }
+
+  // Keeps up to a window of batches in preprocessing while reading the next ones. Batches are committed to the
+  // latency buffer in the order they were read, a batch that is still being preprocessed holds back the later ones.
+  // The consumer only blocks on the raw input with nothing in flight, otherwise an idle input commits the oldest batch.
+  void run_consume_pipelined()
+  {
+    size_t window = m_preprocess_slots.size();
+    size_t oldest = 0;
+    size_t in_flight = 0;
+    while (m_run_marker.load() || m_raw_data_source->can_pop()) {
+      while (in_flight > 0 && (in_flight == window || m_preprocess_slots[oldest]->pending.load() == 0)) {
+        commit_slot(*m_preprocess_slots[oldest]);
+        oldest = (oldest + 1) % window;
+        --in_flight;
+      }
+      auto& slot = *m_preprocess_slots[(oldest + in_flight) % window];
+      slot.size = pop_batch(slot.items.data(), in_flight == 0);
+      if (slot.size == 0) {
+        if (in_flight > 0) {
+          commit_slot(*m_preprocess_slots[oldest]);
+          oldest = (oldest + 1) % window;
+          --in_flight;
+        }
+        continue;
+      }
+      m_raw_processor_impl->preprocess_items_async(slot.items.data(), slot.size, slot.pending);
+      ++in_flight;
+    }
+    for (; in_flight > 0; --in_flight) {
+      commit_slot(*m_preprocess_slots[oldest]);
+      oldest = (oldest + 1) % window;
+    }
+  }
+
+  // Pops one element, waiting up to the source queue timeout unless wait is false, and then whatever is already
+  // available up to the batch size.
+  size_t pop_batch(ReadoutType* batch, bool wait = true)
+  {
+    size_t batch_size = 0;
+    if (!wait && !m_raw_data_source->can_pop()) {
+      return batch_size;
+    }
+    try {
+      m_raw_data_source->pop(batch[batch_size], m_source_queue_timeout_ms);
+      ++batch_size;
+      while (batch_size < m_consumer_batch_size && m_raw_data_source->can_pop()) {
+        m_raw_data_source->pop(batch[batch_size], std::chrono::milliseconds(0));
+        ++batch_size;
+      }
+    } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
+      if (batch_size == 0) {
+        ++m_rawq_timeout_count;
+      }
+    }
+    return batch_size;
+  }
+
+  void commit_slot(PreprocessSlot& slot)
+  {
+    while (slot.pending.load(std::memory_order_acquire) > 0) {
+      std::this_thread::yield();
+    }
+    commit_batch(slot.items.data(), slot.size);
+  }
+
+  // Writes a preprocessed batch to the latency buffer and hands it to the postprocessing
+  void commit_batch(ReadoutType* batch, size_t batch_size)
+  {
+    auto written = m_latency_buffer_impl->write_bulk(batch, batch_size, m_consumer_batch_written.data());
+    if (written < batch_size) {
+      TLOG_DEBUG(TLVL_TAKE_NOTE) << "***ERROR: Latency buffer is full and data was overwritten!";
+      m_num_payloads_overwritten += batch_size - written;
+    }
+    m_raw_processor_impl->postprocess_items(m_consumer_batch_written.data(), written);
+    if (written > 0) {
+      m_request_handler_impl->notify_new_data(m_consumer_batch_written[written - 1]->get_first_timestamp(), written);
+    }
+    m_payloads += batch_size;
+  }
+
   void run_timesync()
   {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "TimeSync thread started...";
-    m_num_requests = 0;
-    m_sum_requests = 0;
     uint64_t msg_seqno = 0;
     auto once_per_run = true;
     while (m_run_marker.load()) {
@@ -309,8 +456,7 @@ private:
                                         << " ts=" << dr.trigger_timestamp << " window_begin=" << dr.request_information.window_begin
                                         << " window_end=" << dr.request_information.window_end;
             m_request_handler_impl->issue_request(dr, *m_fragment_queue);
-            ++m_num_requests;
-            ++m_sum_requests;
+            ++m_requests;
           }
         } else {
           if (once_per_run) {
@@ -327,36 +473,66 @@ private:
     TLOG_DEBUG(TLVL_WORK_STEPS) << "TimeSync thread joins...";
   }
 
+  // Hands a request to the request handler, false if it was sent to the wrong link
+  bool dispatch_request(dfmessages::DataRequest& data_request)
+  {
+    if (data_request.request_information.component != m_geoid) {
+      ers::error(RequestGeoIDMismatch(ERS_HERE, m_geoid, data_request.request_information.component));
+      return false;
+    }
+    m_request_handler_impl->issue_request(data_request, *m_fragment_queue);
+    ++m_requests;
+    TLOG_DEBUG(TLVL_QUEUE_POP) << "Received DataRequest for trigger_number " << data_request.trigger_number
+                               << ", run number " << data_request.run_number << " (APA number " << m_geoid.region_id
+                               << ", link number " << m_geoid.element_id << ")";
+    return true;
+  }
+
+  // Sources are drained without exceptions through can_pop. Idle rounds back off from yielding to sleeps of at most
+  // max_request_backoff, once idle for idle_rounds_before_wait of those the thread waits on m_request_wakeup, which
+  // stop() notifies, so the first request after a quiet period is picked up within max_request_wait.
+  static constexpr std::chrono::microseconds max_request_backoff{ 16 };
+  static constexpr size_t idle_rounds_before_wait = 64;
+  static constexpr std::chrono::milliseconds max_request_wait{ 1 };
+  static constexpr size_t max_requests_per_source = 16;
+
   void run_requests()
   {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Requester thread started...";
-    m_num_requests = 0;
-    m_sum_requests = 0;
     dfmessages::DataRequest data_request;
 
+    std::chrono::microseconds backoff(0);
+    size_t idle_rounds = 0;
     while (m_run_marker.load()) {
       bool popped_element = false;
-      for (size_t i = 0; i < m_data_request_queues.size(); ++i) {
-        auto& request_source = *m_data_request_queues[i];
-        try {
-          request_source.pop(data_request, std::chrono::milliseconds(0));
+      for (auto& request_source : m_data_request_queues) {
+        for (size_t n = 0; n < max_requests_per_source && request_source->can_pop(); ++n) {
+          try {
+            request_source->pop(data_request, std::chrono::milliseconds(0));
+          } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
+            break; // raced with another consumer of the queue
+          }
           popped_element = true;
-          if (data_request.request_information.component != m_geoid) {
-            ers::error(RequestGeoIDMismatch(ERS_HERE, m_geoid, data_request.request_information.component));
+          if (!dispatch_request(data_request)) {
             return;
           }
-          m_request_handler_impl->issue_request(data_request, *m_fragment_queue);
-          ++m_num_requests;
-          ++m_sum_requests;
-          TLOG_DEBUG(TLVL_QUEUE_POP) << "Received DataRequest for trigger_number " << data_request.trigger_number
-                                     << ", run number " << data_request.run_number << " (APA number "
-                                     << m_geoid.region_id << ", link number " << m_geoid.element_id << ")";
-        } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
-          // not an error, safe to continue
         }
       }
-      if (!popped_element) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      if (popped_element) {
+        backoff = std::chrono::microseconds(0);
+        idle_rounds = 0;
+      } else if (backoff.count() == 0) {
+        std::this_thread::yield();
+        backoff = std::chrono::microseconds(1);
+      } else if (backoff < max_request_backoff || idle_rounds < idle_rounds_before_wait) {
+        std::this_thread::sleep_for(backoff);
+        if (backoff == max_request_backoff) {
+          ++idle_rounds;
+        }
+        backoff = std::min(backoff * 2, max_request_backoff);
+      } else {
+        std::unique_lock<std::mutex> lock(m_request_wakeup_mutex);
+        m_request_wakeup.wait_for(lock, max_request_wait, [this]() { return !m_run_marker.load(); });
       }
     }
 
@@ -380,16 +556,17 @@ private:
   daqdataformats::run_number_t m_run_number;
 
   // STATS
-  std::atomic<int> m_num_payloads{ 0 };
-  std::atomic<int> m_sum_payloads{ 0 };
-  std::atomic<int> m_num_requests{ 0 };
-  std::atomic<int> m_sum_requests{ 0 };
-  std::atomic<int> m_rawq_timeout_count{ 0 };
-  std::atomic<int> m_stats_packet_count{ 0 };
-  std::atomic<int> m_num_payloads_overwritten{ 0 };
+  ShardedCounter m_payloads;
+  ShardedCounter m_requests;
+  ShardedCounter m_rawq_timeout_count;
+  ShardedCounter m_num_payloads_overwritten;
 
   // CONSUMER
   ReusableThread m_consumer_thread;
+  size_t m_consumer_batch_size{ 1 };
+  std::vector<ReadoutType> m_consumer_batch;
+  std::vector<const ReadoutType*> m_consumer_batch_written;
+  std::vector<std::unique_ptr<PreprocessSlot>> m_preprocess_slots;
 
   // RAW SOURCE
   std::chrono::milliseconds m_source_queue_timeout_ms;
@@ -400,6 +577,8 @@ private:
   std::chrono::milliseconds m_request_queue_timeout_ms;
   using request_source_qt = appfwk::DAQSource<dfmessages::DataRequest>;
   std::vector<std::unique_ptr<request_source_qt>> m_data_request_queues;
+  std::mutex m_request_wakeup_mutex;
+  std::condition_variable m_request_wakeup;
 
   // FRAGMENT SINK
   std::chrono::milliseconds m_fragment_queue_timeout_ms;
@@ -423,8 +602,6 @@ private:
   std::string m_timesync_connection_name;
   std::string m_timesync_topic_name;
   uint32_t m_pid_of_current_process;
-
-  std::chrono::time_point<std::chrono::high_resolution_clock> m_t0;
 };
 
 } // namespace readoutlibs
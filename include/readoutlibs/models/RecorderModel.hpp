@@ -18,12 +18,18 @@
 #include "readoutlibs/recorderinfo/InfoStructs.hpp"
 #include "readoutlibs/utils/BufferedFileWriter.hpp"
 #include "readoutlibs/utils/ReusableThread.hpp"
+#include "readoutlibs/utils/ShardedCounter.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
 
 namespace dunedaq {
 namespace readoutlibs {
@@ -49,16 +55,12 @@ public:
   void get_info(opmonlib::InfoCollector& ci, int /* level */) override
   {
     recorderinfo::Info info;
-    info.packets_processed = m_packets_processed_total;
-    double time_diff = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() -
-                                                                                 m_time_point_last_info)
-                         .count();
-    info.throughput_processed_packets = m_packets_processed_since_last_info / time_diff;
+    info.packets_processed = m_packets_processed.total();
+    info.throughput_processed_packets = m_packets_processed.collect().rate;
+    info.throughput_written = m_bytes_written.collect().rate / 1000000.;
+    info.write_stall_time = m_write_stall_ns.collect().delta / 1000;
 
     ci.add(info);
-
-    m_packets_processed_since_last_info = 0;
-    m_time_point_last_info = std::chrono::steady_clock::now();
   }
 
   void do_conf(const nlohmann::json& args) override
@@ -69,8 +71,23 @@ public:
       TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run" << std::endl;
     }
 
-    m_buffered_writer.open(
-      m_conf.output_file, m_conf.stream_buffer_size, m_conf.compression_algorithm, m_conf.use_o_direct);
+    m_buffered_writer.open(m_conf.output_file,
+                           m_conf.stream_buffer_size,
+                           m_conf.compression_algorithm,
+                           m_conf.use_o_direct,
+                           m_conf.io_backend);
+    m_staging_capacity = m_conf.staging_block_size / sizeof(ReadoutType);
+    m_staging_block.reset();
+    if (m_conf.staging_block_size > 0) {
+      m_staging_capacity = std::max<size_t>(m_staging_capacity, 1);
+      size_t block_size = (m_staging_capacity * sizeof(ReadoutType) + staging_alignment - 1) / staging_alignment *
+                          staging_alignment;
+      void* block = std::aligned_alloc(staging_alignment, block_size);
+      if (block == nullptr) {
+        throw std::bad_alloc();
+      }
+      m_staging_block.reset(static_cast<ReadoutType*>(block));
+    }
     m_work_thread.set_name(m_name, 0);
   }
 
@@ -78,9 +95,15 @@ public:
 
   void do_start(const nlohmann::json& /* args */) override
   {
-    m_packets_processed_total = 0;
+    m_packets_processed.reset();
+    m_bytes_written.reset();
+    m_write_stall_ns.reset();
     m_run_marker.store(true);
-    m_work_thread.set_work(&RecorderImpl::do_work, this);
+    if (m_staging_block) {
+      m_work_thread.set_work(&RecorderImpl::do_work_staged, this);
+    } else {
+      m_work_thread.set_work(&RecorderImpl::do_work, this);
+    }
   }
 
   void do_stop(const nlohmann::json& /* args */) override
@@ -94,25 +117,90 @@ public:
 private:
   void do_work()
   {
-    m_time_point_last_info = std::chrono::steady_clock::now();
-
     ReadoutType element;
     while (m_run_marker) {
       try {
         m_input_queue->pop(element, std::chrono::milliseconds(100));
-        m_packets_processed_total++;
-        m_packets_processed_since_last_info++;
-        if (!m_buffered_writer.write(reinterpret_cast<char*>(&element), sizeof(element))) { // NOLINT
-          ers::warning(CannotWriteToFile(ERS_HERE, m_conf.output_file));
+        ++m_packets_processed;
+        if (!write(reinterpret_cast<char*>(&element), sizeof(element))) { // NOLINT
           break;
         }
       } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
         continue;
       }
     }
-    m_buffered_writer.flush();
+    if (!m_buffered_writer.flush()) {
+      ers::warning(CannotWriteToFile(ERS_HERE, m_conf.output_file));
+    }
+  }
+
+  // Drains the input queue straight into the staging block and writes it as a whole once it is full, or once the
+  // queue ran dry. An empty queue is polled with a growing backoff instead of waiting for pop timeouts.
+  void do_work_staged()
+  {
+    static_assert(std::is_trivially_copyable<ReadoutType>::value, "The staging block is written out bytewise");
+    ReadoutType* staging = m_staging_block.get();
+    size_t staged = 0;
+    std::chrono::microseconds backoff(0);
+    while (m_run_marker) {
+      size_t popped = 0;
+      try {
+        while (staged < m_staging_capacity && m_input_queue->can_pop()) {
+          m_input_queue->pop(staging[staged], std::chrono::milliseconds(0));
+          ++staged;
+          ++popped;
+        }
+      } catch (const dunedaq::appfwk::QueueTimeoutExpired& excpt) {
+        // Only the recorder pops, can_pop() doesn't lie
+      }
+      m_packets_processed += popped;
+      if (staged == m_staging_capacity || (popped == 0 && staged > 0)) {
+        bool written = write(reinterpret_cast<char*>(staging), staged * sizeof(ReadoutType)); // NOLINT
+        staged = 0;
+        if (!written) {
+          break;
+        }
+      }
+      if (popped > 0) {
+        backoff = std::chrono::microseconds(0);
+      } else if (backoff.count() == 0) {
+        std::this_thread::yield();
+        backoff = std::chrono::microseconds(1);
+      } else {
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, max_idle_backoff);
+      }
+    }
+    if (staged > 0) {
+      write(reinterpret_cast<char*>(staging), staged * sizeof(ReadoutType)); // NOLINT
+    }
+    if (!m_buffered_writer.flush()) {
+      ers::warning(CannotWriteToFile(ERS_HERE, m_conf.output_file));
+    }
   }
 
+  bool write(const char* memory, size_t size)
+  {
+    auto t_write_begin = std::chrono::steady_clock::now();
+    bool written = m_buffered_writer.write(memory, size);
+    m_write_stall_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_write_begin).count();
+    if (!written) {
+      ers::warning(CannotWriteToFile(ERS_HERE, m_conf.output_file));
+      return false;
+    }
+    m_bytes_written += size;
+    return true;
+  }
+
+  struct FreeDeleter
+  {
+    void operator()(void* memory) const { std::free(memory); }
+  };
+
+  static constexpr size_t staging_alignment = 4096;
+  static constexpr std::chrono::microseconds max_idle_backoff{ 1000 };
+
   // Queue
   using source_t = dunedaq::appfwk::DAQSource<ReadoutType>;
   std::unique_ptr<source_t> m_input_queue;
@@ -120,15 +208,17 @@ private:
   // Internal
   recorderconfig::Conf m_conf;
   BufferedFileWriter<> m_buffered_writer;
+  std::unique_ptr<ReadoutType, FreeDeleter> m_staging_block;
+  size_t m_staging_capacity = 0; // in elements
 
   // Threading
   ReusableThread m_work_thread;
   std::atomic<bool> m_run_marker;
 
   // Stats
-  std::atomic<int> m_packets_processed_total{ 0 };
-  std::atomic<int> m_packets_processed_since_last_info{ 0 };
-  std::chrono::steady_clock::time_point m_time_point_last_info;
+  ShardedCounter m_packets_processed;
+  ShardedCounter m_bytes_written;
+  ShardedCounter m_write_stall_ns;
 
   std::string m_name;
 };
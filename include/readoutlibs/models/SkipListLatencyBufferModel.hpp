@@ -16,14 +16,26 @@
 
 #include "folly/ConcurrentSkipList.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <utility>
+#include <vector>
 
 using dunedaq::readoutlibs::logging::TLVL_WORK_STEPS;
 
 namespace dunedaq {
 namespace readoutlibs {
 
+/** NOTES:
+    The skip list only reclaims removed nodes once no accessor is left, but the request handler keeps pointers to the
+    elements of a window after its iterators, and with them their accessors, went out of scope. Pins therefore keep
+    pop() away from the pinned element and all newer ones, like in the TimeBucketLatencyBufferModel, so these nodes are
+    never removed while pinned. Pins hold timestamps and are serialized with the pops on a mutex.
+ */
 template<class T>
 class SkipListLatencyBufferModel : public LatencyBufferConcept<T>
 {
@@ -76,22 +88,17 @@ public:
   {
     // Reset datastructure
     m_skip_list = folly::ConcurrentSkipList<T>::createInstance(unconfigured_head_height);
+    m_occupancy.store(0);
   }
 
   void scrap(const nlohmann::json& /*args*/) override
   {
     m_skip_list = folly::ConcurrentSkipList<T>::createInstance(unconfigured_head_height);
+    m_occupancy.store(0);
   }
 
-  size_t occupancy() const override
-  {
-    auto occupancy = 0;
-    {
-      SkipListTAcc acc(m_skip_list);
-      occupancy = acc.size();
-    }
-    return occupancy;
-  }
+  // Tracked separately, so that opmon and the cleanup checks do not need an accessor
+  size_t occupancy() const override { return m_occupancy.load(std::memory_order_relaxed); }
 
   void flush() override { pop(occupancy()); }
 
@@ -106,6 +113,9 @@ public:
       auto ret = acc.insert(std::move(new_element)); // ret T = std::pair<iterator, bool>
       success = ret.second;
     }
+    if (success) {
+      m_occupancy.fetch_add(1, std::memory_order_relaxed);
+    }
     return success;
   }
 
@@ -117,6 +127,9 @@ public:
       auto ret = acc.insert(new_element); // ret T = std::pair<iterator, bool>
       success = ret.second;
     }
+    if (success) {
+      m_occupancy.fetch_add(1, std::memory_order_relaxed);
+    }
     return success;
   }
 
@@ -167,19 +180,75 @@ public:
     return acc.last();
   }
 
+  // Evicts the oldest elements, never passing the oldest pinned element
   void pop(size_t num = 1) override // NOLINT(build/unsigned)
   {
-    {
-      SkipListTAcc acc(m_skip_list);
-      for (unsigned i = 0; i < num; ++i) {
-        acc.pop_back();
+    evict(num, std::numeric_limits<timestamp_t>::max());
+  }
+
+  std::size_t pop_older_than(const T& element, std::size_t amount) override
+  {
+    return evict(amount, element.get_first_timestamp());
+  }
+
+  //! Pins the oldest element, and with it every element stored later, whatever its timestamp
+  int pin() override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    for (std::size_t i = 0; i < m_pins.size(); ++i) {
+      if (m_pins[i] == no_pin) {
+        m_pins[i] = 0;
+        return static_cast<int>(i);
       }
     }
+    m_pins.push_back(0);
+    return static_cast<int>(m_pins.size() - 1);
+  }
+
+  void advance_pin(int pin, const T* element) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    m_pins[pin] = element->get_first_timestamp();
+  }
+
+  void unpin(int pin) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    m_pins[pin] = no_pin;
   }
 
 private:
+  using timestamp_t = std::uint64_t; // NOLINT(build/unsigned)
+
+  static constexpr timestamp_t no_pin = std::numeric_limits<timestamp_t>::max();
+
+  //! Pop the oldest elements, at most amount and only those older than before and than every pinned element
+  std::size_t evict(std::size_t amount, timestamp_t before)
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    for (auto pinned : m_pins) {
+      before = std::min(before, pinned);
+    }
+    std::size_t popped = 0;
+    SkipListTAcc acc(m_skip_list);
+    while (popped < amount) {
+      const T* oldest = acc.first();
+      if (oldest == nullptr || oldest->get_first_timestamp() >= before || !acc.remove(*oldest)) {
+        break;
+      }
+      m_occupancy.fetch_sub(1, std::memory_order_relaxed);
+      ++popped;
+    }
+    return popped;
+  }
+
   // Concurrent SkipList
   std::shared_ptr<SkipListT> m_skip_list;
+  std::atomic<size_t> m_occupancy{ 0 };
+
+  // Serializes pops and pins
+  std::mutex m_evict_mutex;
+  std::vector<timestamp_t> m_pins;
 
   // Conf
   static constexpr uint32_t unconfigured_head_height = 2; // NOLINT(build/unsigned)
@@ -20,10 +20,12 @@
 
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/concepts/SourceEmulatorConcept.hpp"
+#include "readoutlibs/utils/EmulatorEngine.hpp"
 #include "readoutlibs/utils/ErrorBitGenerator.hpp"
 #include "readoutlibs/utils/FileSourceBuffer.hpp"
 #include "readoutlibs/utils/RateLimiter.hpp"
 #include "readoutlibs/utils/ReusableThread.hpp"
+#include "readoutlibs/utils/ShardedCounter.hpp"
 
 #include "unistd.h"
 #include <chrono>
@@ -56,7 +58,6 @@ public:
     , m_time_tick_diff(time_tick_diff)
     , m_dropout_rate(dropout_rate)
     , m_frame_error_rate(frame_error_rate)
-    , m_packet_count{ 0 }
     , m_sink_queue_timeout_ms(0)
     , m_raw_data_sink(nullptr)
     , m_producer_thread(0)
@@ -94,7 +95,7 @@ public:
 
       m_file_source = std::make_unique<FileSourceBuffer>(m_link_conf.input_limit, sizeof(ReadoutType));
       try {
-        m_file_source->read(m_link_conf.data_filename);
+        m_file_source->read(m_link_conf.data_filename, m_link_conf.populate_data_file);
       } catch (const ers::Issue& ex) {
         ers::fatal(ex);
         throw ConfigurationError(ERS_HERE, m_geoid, "", ex);
@@ -128,17 +129,39 @@ public:
 
   bool is_configured() override { return m_is_configured; }
 
+  size_t batch_size() const { return m_conf.batch_size > 0 ? m_conf.batch_size : 1; }
+
   void start(const nlohmann::json& /*args*/)
   {
-    m_packet_count_tot = 0;
+    m_packet_count.reset();
+    m_dropped_packet_count.reset();
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Starting threads...";
-    m_rate_limiter = std::make_unique<RateLimiter>(m_rate_khz / m_link_conf.slowdown);
-    // m_stats_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_stats, this);
-    m_producer_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_produce, this);
+    if (m_conf.num_engine_threads > 0) {
+      // The engine schedules whole batches
+      double batch_rate_khz = m_rate_khz / m_link_conf.slowdown / batch_size();
+      init_production();
+      m_engine = EmulatorEngine::get(m_conf.num_engine_threads);
+      m_engine_link_id = m_engine->add_link(std::chrono::nanoseconds(static_cast<int64_t>(1e6 / batch_rate_khz)),
+                                            [this]() {
+                                              if (m_run_marker.load()) {
+                                                produce_batch();
+                                              }
+                                            });
+    } else {
+      // Every batch is released as one burst
+      m_rate_limiter = std::make_unique<RateLimiter>(m_rate_khz / m_link_conf.slowdown, batch_size());
+      // m_stats_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_stats, this);
+      m_producer_thread.set_work(&SourceEmulatorModel<ReadoutType>::run_produce, this);
+    }
   }
 
   void stop(const nlohmann::json& /*args*/)
   {
+    if (m_engine) {
+      m_engine->remove_link(m_engine_link_id);
+      m_engine.reset();
+      return;
+    }
     while (!m_producer_thread.get_readiness()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
@@ -147,8 +170,16 @@ public:
   void get_info(opmonlib::InfoCollector& ci, int /*level*/)
   {
     sourceemulatorinfo::Info info;
-    info.packets = m_packet_count_tot.load();
-    info.new_packets = m_packet_count.exchange(0);
+    info.packets = m_packet_count.total();
+    info.new_packets = m_packet_count.collect().delta;
+    info.dropped_packets = m_dropped_packet_count.total();
+    if (m_rate_limiter) {
+      auto stats = m_rate_limiter->collect_stats();
+      info.rate_target_khz = stats.target_kilohertz;
+      info.rate_achieved_khz = stats.achieved_kilohertz;
+      info.pacing_jitter_mean = stats.mean_jitter;
+      info.pacing_jitter_max = stats.max_jitter;
+    }
 
     ci.add(info);
   }
@@ -160,68 +191,92 @@ protected:
 
     // pthread_setname_np(pthread_self(), get_name().c_str());
 
-    uint offset = 0; // NOLINT(build/unsigned)
-    auto& source = m_file_source->get();
+    init_production();
+    while (m_run_marker.load()) {
+      produce_batch();
+      m_rate_limiter->limit(m_batch.size());
+    }
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Data generation thread " << m_this_link_number << " finished";
+  }
+
+  void init_production()
+  {
+    m_offset = 0;
+    m_source = m_file_source->data();
+    m_source_size = m_file_source->size();
 
-    int num_elem = m_file_source->num_elements();
-    if (num_elem == 0) {
+    m_num_elem = m_file_source->num_elements();
+    if (m_num_elem == 0) {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "No elements to read from buffer! Sleeping...";
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      num_elem = m_file_source->num_elements();
+      m_num_elem = m_file_source->num_elements();
     }
 
-    auto rptr = reinterpret_cast<ReadoutType*>(source.data()); // NOLINT
+    // The mapping is read-only, the element is only used with getters
+    auto rptr = reinterpret_cast<ReadoutType*>(const_cast<std::uint8_t*>(m_source)); // NOLINT
 
     // set the initial timestamp to a configured value, otherwise just use the timestamp from the header
     uint64_t ts_0 = (m_conf.set_t0_to >= 0) ? m_conf.set_t0_to : rptr->get_first_timestamp(); // NOLINT(build/unsigned)
     TLOG_DEBUG(TLVL_BOOKKEEPING) << "First timestamp in the source file: " << ts_0;
-    uint64_t timestamp = ts_0; // NOLINT(build/unsigned)
-    int dropout_index = 0;
+    m_timestamp = ts_0;
+    m_dropout_index = 0;
 
-    while (m_run_marker.load()) {
+    // Preallocated once, payloads are generated into the batch and patched in place
+    m_batch.resize(batch_size());
+    m_frame_errs.resize(rptr->get_num_frames());
+  }
+
+  void produce_batch()
+  {
+    size_t produced = 0;
+    for (size_t slot = 0; slot < m_batch.size(); ++slot) {
       // Which element to push to the buffer
-      if (offset == num_elem * sizeof(ReadoutType) || (offset + 1) * sizeof(ReadoutType) > source.size()) {
-        offset = 0;
+      if (m_offset >= static_cast<uint>(m_num_elem) || (m_offset + 1) * sizeof(ReadoutType) > m_source_size) { // NOLINT
+        m_offset = 0;
       }
 
-      bool create_frame = m_dropouts[dropout_index]; // NOLINT(runtime/threadsafe_fn)
-      dropout_index = (dropout_index + 1) % m_dropouts.size();
+      bool create_frame = m_dropouts[m_dropout_index]; // NOLINT(runtime/threadsafe_fn)
+      m_dropout_index = (m_dropout_index + 1) % m_dropouts.size();
       if (create_frame) {
-        ReadoutType payload;
-        // Memcpy from file buffer to flat char array
-        ::memcpy(static_cast<void*>(&payload),
-                 static_cast<void*>(source.data() + offset * sizeof(ReadoutType)),
+        // Memcpy from the file mapping to flat char array
+        ::memcpy(static_cast<void*>(&m_batch[produced]),
+                 static_cast<const void*>(m_source + m_offset * sizeof(ReadoutType)),
                  sizeof(ReadoutType));
 
         // Fake timestamp
-        payload.fake_timestamps(timestamp, m_time_tick_diff);
-
-        // Introducing frame errors
-        std::vector<uint16_t> frame_errs; // NOLINT(build/unsigned)
-        for (size_t i = 0; i < rptr->get_num_frames(); ++i) {
-          frame_errs.push_back(m_error_bit_generator.next());
-        }
-        payload.fake_frame_errors(&frame_errs);
-
-        // queue in to actual DAQSink
-        try {
-          m_raw_data_sink->push(std::move(payload), m_sink_queue_timeout_ms);
-        } catch (ers::Issue& excpt) {
-          ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "raw data input queue", excpt));
-          // std::runtime_error("Queue timed out...");
-        }
-
-        // Count packet and limit rate if needed.
-        ++offset;
-        ++m_packet_count;
-        ++m_packet_count_tot;
+        m_batch[produced].fake_timestamps(m_timestamp, m_time_tick_diff);
+        ++m_offset;
+        ++produced;
       }
 
-      timestamp += m_time_tick_diff * 12;
+      m_timestamp += m_time_tick_diff * 12;
+    }
 
-      m_rate_limiter->limit();
+    // Introducing frame errors
+    for (size_t i = 0; i < produced; ++i) {
+      m_error_bit_generator.fill(m_frame_errs.data(), m_frame_errs.size());
+      m_batch[i].fake_frame_errors(&m_frame_errs);
     }
-    TLOG_DEBUG(TLVL_WORK_STEPS) << "Data generation thread " << m_this_link_number << " finished";
+
+    // queue in to actual DAQSink. Links on the engine share its threads, a full queue drops the rest of the batch
+    // instead of blocking the other links.
+    bool on_engine = m_engine != nullptr;
+    auto push_timeout = on_engine ? std::chrono::milliseconds(0) : m_sink_queue_timeout_ms;
+    for (size_t i = 0; i < produced; ++i) {
+      try {
+        m_raw_data_sink->push(std::move(m_batch[i]), push_timeout);
+      } catch (ers::Issue& excpt) {
+        if (on_engine) {
+          m_dropped_packet_count += produced - i;
+          break;
+        }
+        ers::warning(CannotWriteToQueue(ERS_HERE, m_geoid, "raw data input queue", excpt));
+        // std::runtime_error("Queue timed out...");
+      }
+    }
+
+    // Count packets
+    m_packet_count += produced;
   }
 
 private:
@@ -237,8 +292,8 @@ private:
   double m_frame_error_rate;
 
   // STATS
-  std::atomic<int> m_packet_count{ 0 };
-  std::atomic<int> m_packet_count_tot{ 0 };
+  ShardedCounter m_packet_count;
+  ShardedCounter m_dropped_packet_count;
 
   sourceemulatorconfig::Conf m_cfg;
 
@@ -254,6 +309,8 @@ private:
   link_conf_t m_link_conf;
 
   std::unique_ptr<RateLimiter> m_rate_limiter;
+  std::shared_ptr<EmulatorEngine> m_engine;
+  EmulatorEngine::link_id_t m_engine_link_id = 0;
   std::unique_ptr<FileSourceBuffer> m_file_source;
   ErrorBitGenerator m_error_bit_generator;
 
@@ -266,6 +323,16 @@ private:
   std::vector<bool> m_dropouts; // Random population
   std::vector<bool> m_frame_errors;
 
+  // Production state
+  uint m_offset = 0;                      // NOLINT(build/unsigned)
+  const std::uint8_t* m_source = nullptr; // NOLINT(build/unsigned)
+  std::size_t m_source_size = 0;
+  int m_num_elem = 0;
+  uint64_t m_timestamp = 0; // NOLINT(build/unsigned)
+  int m_dropout_index = 0;
+  std::vector<ReadoutType> m_batch;
+  std::vector<uint16_t> m_frame_errs; // NOLINT(build/unsigned)
+
   uint m_dropouts_length = 10000; // NOLINT(build/unsigned) Random population size
   uint m_frame_errors_length = 10000;
   daqdataformats::GeoID m_geoid;
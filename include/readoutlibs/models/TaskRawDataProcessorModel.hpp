@@ -16,10 +16,13 @@
 #include "readoutlibs/ReadoutLogging.hpp"
 #include "readoutlibs/concepts/RawDataProcessorConcept.hpp"
 #include "readoutlibs/readoutconfig/Nljs.hpp"
-#include "readoutlibs/utils/ReusableThread.hpp"
+#include "readoutlibs/utils/PostprocessExecutor.hpp"
 
-#include <folly/ProducerConsumerQueue.h>
+#include <folly/MPMCQueue.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <future>
@@ -37,6 +40,19 @@ template<class ReadoutType>
 class TaskRawDataProcessorModel : public RawDataProcessorConcept<ReadoutType>
 {
 public:
+  //! Maximum number of elements handed to the postprocess threads with a single queue entry
+  static constexpr std::size_t max_postprocess_batch_size = 16;
+
+  //! Queue entry of the postprocess queues: a handle to up to max_postprocess_batch_size elements
+  struct PostprocessBatch
+  {
+    std::array<const ReadoutType*, max_postprocess_batch_size> items;
+    std::size_t size{ 0 };
+  };
+
+  //! Maximum number of batches a postprocess task handles before it is requeued behind other work
+  static constexpr std::size_t postprocess_run_budget = 64;
+
   explicit TaskRawDataProcessorModel(std::unique_ptr<FrameErrorRegistry>& error_registry)
     : RawDataProcessorConcept<ReadoutType>()
     , m_error_registry(error_registry)
@@ -51,23 +67,42 @@ public:
     m_postprocess_queue_sizes = config.postprocess_queue_sizes;
     m_this_link_number = config.element_id;
 
+    m_executor = PostprocessExecutor::get(config.postprocess_threads,
+                                          std::vector<int>(config.postprocess_cpus.begin(), config.postprocess_cpus.end()),
+                                          std::chrono::microseconds(config.postprocess_spin_time_us));
+    m_preprocess_window = config.preprocess_window > 0 ? static_cast<std::size_t>(config.preprocess_window) : 0;
+    if (m_preprocess_window > 0 && !m_parallel_preprocess_functions.empty()) {
+      // A batch is split into at most one job per executor thread, so the pool covers the whole window
+      std::size_t num_jobs = m_preprocess_window * m_executor->num_threads();
+      m_free_preprocess_jobs = std::make_unique<folly::MPMCQueue<PreprocessJob*>>(num_jobs);
+      for (std::size_t i = 0; i < num_jobs; ++i) {
+        m_preprocess_jobs.push_back(std::make_unique<PreprocessJob>(*this));
+        m_free_preprocess_jobs->write(m_preprocess_jobs.back().get());
+      }
+    }
     for (size_t i = 0; i < m_post_process_functions.size(); ++i) {
-      m_items_to_postprocess_queues.push_back(
-        std::make_unique<folly::ProducerConsumerQueue<const ReadoutType*>>(m_postprocess_queue_sizes));
-      m_post_process_threads.back()->set_name("postprocess-" + std::to_string(i), m_this_link_number);
+      m_post_process_tasks.push_back(std::make_unique<PostprocessTask>(
+        m_post_process_functions[i], m_postprocess_queue_sizes, m_post_process_in_order[i] ? 1 : m_executor->num_threads()));
     }
 
     m_geoid.element_id = config.element_id;
     m_geoid.region_id = config.region_id;
     m_geoid.system_type = ReadoutType::system_type;
+    if (!m_executor->pinned()) {
+      ers::warning(ConfigurationError(ERS_HERE, m_geoid, "Could not set the CPU affinity of the postprocess threads"));
+    }
   }
 
   void scrap(const nlohmann::json& /*cfg*/) override
   {
-    m_items_to_postprocess_queues.clear();
-    m_post_process_threads.clear();
+    m_post_process_tasks.clear();
+    m_free_preprocess_jobs.reset();
+    m_preprocess_jobs.clear();
+    m_executor.reset();
     m_post_process_functions.clear();
+    m_post_process_in_order.clear();
     m_preprocess_functions.clear();
+    m_parallel_preprocess_functions.clear();
   }
 
   void start(const nlohmann::json& /*args*/) override
@@ -75,20 +110,15 @@ public:
     // m_last_processed_daq_ts =
     // std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
     m_run_marker.store(true);
-    for (size_t i = 0; i < m_post_process_threads.size(); ++i) {
-      m_post_process_threads[i]->set_work(&TaskRawDataProcessorModel<ReadoutType>::run_post_processing_thread,
-                                          this,
-                                          std::ref(m_post_process_functions[i]),
-                                          std::ref(*m_items_to_postprocess_queues[i]));
-    }
   }
 
   void stop(const nlohmann::json& /*args*/) override
   {
     m_run_marker.store(false);
-    for (auto& thread : m_post_process_threads) {
-      while (!thread->get_readiness()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // Let the executor drain what was already handed over
+    for (auto& task : m_post_process_tasks) {
+      while (!task->idle()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
       }
     }
   }
@@ -104,26 +134,96 @@ public:
 
   void preprocess_item(ReadoutType* item) override { invoke_all_preprocess_functions(item); }
 
-  void postprocess_item(const ReadoutType* item) override
+  std::size_t preprocess_window() const override
+  {
+    return m_parallel_preprocess_functions.empty() ? 0 : m_preprocess_window;
+  }
+
+  /**
+   * Run the in-order preprocess tasks on the calling thread and hand the parallel ones to the executor, split into at
+   * most one job per executor thread. Jobs that find the pool empty run on the calling thread.
+   */
+  void preprocess_items_async(ReadoutType* items, std::size_t amount, std::atomic<std::size_t>& pending) override
   {
-    for (size_t i = 0; i < m_items_to_postprocess_queues.size(); ++i) {
-      if (!m_items_to_postprocess_queues[i]->write(item)) {
-        ers::warning(PostprocessingNotKeepingUp(ERS_HERE, m_geoid, i));
+    for (std::size_t i = 0; i < amount; ++i) {
+      for (auto&& task : m_preprocess_functions) {
+        task(&items[i]);
       }
     }
+    if (!m_free_preprocess_jobs || amount == 0) {
+      for (std::size_t i = 0; i < amount; ++i) {
+        invoke_parallel_preprocess_functions(&items[i]);
+      }
+      pending.store(0);
+      return;
+    }
+
+    std::size_t chunk = (amount + m_executor->num_threads() - 1) / m_executor->num_threads();
+    std::size_t num_chunks = (amount + chunk - 1) / chunk;
+    // One extra count until all jobs are submitted
+    pending.store(num_chunks + 1);
+    for (std::size_t offset = 0; offset < amount; offset += chunk) {
+      PreprocessJob* job = nullptr;
+      std::size_t size = std::min(chunk, amount - offset);
+      if (m_free_preprocess_jobs->read(job)) {
+        job->items = items + offset;
+        job->amount = size;
+        job->pending = &pending;
+        m_executor->submit(job);
+      } else {
+        for (std::size_t i = offset; i < offset + size; ++i) {
+          invoke_parallel_preprocess_functions(&items[i]);
+        }
+        pending.fetch_sub(1);
+      }
+    }
+    pending.fetch_sub(1);
+  }
+
+  void postprocess_item(const ReadoutType* item) override
+  {
+    PostprocessBatch batch;
+    batch.items[0] = item;
+    batch.size = 1;
+    dispatch_postprocess_batch(batch);
   }
 
+  void postprocess_items(const ReadoutType* const* items, std::size_t amount) override
+  {
+    PostprocessBatch batch;
+    for (std::size_t offset = 0; offset < amount; offset += max_postprocess_batch_size) {
+      batch.size = std::min(amount - offset, max_postprocess_batch_size);
+      std::copy(items + offset, items + offset + batch.size, batch.items.begin());
+      dispatch_postprocess_batch(batch);
+    }
+  }
+
+  /**
+   * Add a task run for every element before it is written into the latency buffer.
+   * @param parallel If true, the task only depends on the element itself. With a preprocess window it then runs on the
+   * executor threads, concurrently with the ingest and with other elements. In-order tasks always run on the consumer
+   * thread, before the parallel ones.
+   */
   template<typename Task>
-  void add_preprocess_task(Task&& task)
+  void add_preprocess_task(Task&& task, bool parallel = false)
   {
-    m_preprocess_functions.push_back(std::forward<Task>(task));
+    if (parallel) {
+      m_parallel_preprocess_functions.push_back(std::forward<Task>(task));
+    } else {
+      m_preprocess_functions.push_back(std::forward<Task>(task));
+    }
   }
 
+  /**
+   * Add a task run for every element after it was written into the latency buffer.
+   * @param in_order If true, the task sees the elements one at a time and in the order they were received. Otherwise
+   * several executor threads may run it concurrently on different elements.
+   */
   template<typename Task>
-  void add_postprocess_task(Task&& task)
+  void add_postprocess_task(Task&& task, bool in_order = true)
   {
-    m_post_process_threads.emplace_back(std::make_unique<ReusableThread>(0));
     m_post_process_functions.push_back(std::forward<Task>(task));
+    m_post_process_in_order.push_back(in_order);
   }
 
   void invoke_all_preprocess_functions(ReadoutType* item)
@@ -131,25 +231,139 @@ public:
     for (auto&& task : m_preprocess_functions) {
       task(item);
     }
+    invoke_parallel_preprocess_functions(item);
+  }
+
+  void invoke_parallel_preprocess_functions(ReadoutType* item)
+  {
+    for (auto&& task : m_parallel_preprocess_functions) {
+      task(item);
+    }
   }
 
+  //! Run the preprocess tasks of an element concurrently and wait for all of them
   void launch_all_preprocess_functions(ReadoutType* item)
   {
+    std::vector<std::future<void>> futures;
     for (auto&& task : m_preprocess_functions) {
-      auto fut = std::async(std::launch::async, task, item);
+      futures.push_back(std::async(std::launch::async, task, item));
+    }
+    for (auto&& task : m_parallel_preprocess_functions) {
+      futures.push_back(std::async(std::launch::async, task, item));
+    }
+    for (auto& future : futures) {
+      future.wait();
     }
   }
 
 protected:
-  void run_post_processing_thread(std::function<void(const ReadoutType*)>& function,
-                                  folly::ProducerConsumerQueue<const ReadoutType*>& queue)
+  /**
+   * A postprocess task scheduled on the shared executor. Its queue is drained by at most max_runners executor threads
+   * at a time, with a single runner the batches are processed in order.
+   */
+  class PostprocessTask : public PostprocessExecutor::Runnable
   {
-    while (m_run_marker.load() || queue.sizeGuess() > 0) {
-      const ReadoutType* element;
-      if (queue.read(element)) {
-        function(element);
-      } else {
-        std::this_thread::sleep_for(std::chrono::microseconds(50));
+  public:
+    PostprocessTask(std::function<void(const ReadoutType*)>& function, std::size_t queue_size, std::size_t max_runners)
+      : m_function(function)
+      , m_queue(std::max<std::size_t>(queue_size, 1))
+      , m_max_runners(max_runners)
+    {}
+
+    //! Queue a batch and schedule the task if it has less than max_runners runners
+    bool push(PostprocessExecutor& executor, const PostprocessBatch& batch)
+    {
+      if (!m_queue.write(batch)) {
+        return false;
+      }
+      schedule(executor);
+      return true;
+    }
+
+    void run(PostprocessExecutor& executor) override
+    {
+      PostprocessBatch batch;
+      for (std::size_t n = 0; n < postprocess_run_budget && m_queue.read(batch); ++n) {
+        for (std::size_t i = 0; i < batch.size; ++i) {
+          m_function(batch.items[i]);
+        }
+      }
+      if (!m_queue.isEmpty()) {
+        // Requeue with the same runner slot, so that other tasks get their turn
+        executor.submit(this);
+        return;
+      }
+      m_runners.fetch_sub(1);
+      // A push that saw all runner slots taken relies on this recheck
+      if (!m_queue.isEmpty()) {
+        schedule(executor);
+      }
+      // Last access to this task from the executor
+      m_references.fetch_sub(1);
+    }
+
+    bool idle() const { return m_references.load() == 0 && m_queue.isEmpty(); }
+
+    //! Only used by the thread pushing the batches
+    std::chrono::steady_clock::time_point last_backlog_warning;
+
+  private:
+    void schedule(PostprocessExecutor& executor)
+    {
+      auto runners = m_runners.load();
+      while (runners < m_max_runners) {
+        if (m_runners.compare_exchange_weak(runners, runners + 1)) {
+          m_references.fetch_add(1);
+          executor.submit(this);
+          return;
+        }
+      }
+    }
+
+    std::function<void(const ReadoutType*)>& m_function;
+    folly::MPMCQueue<PostprocessBatch> m_queue;
+    std::size_t m_max_runners;
+    std::atomic<std::size_t> m_runners{ 0 };
+    // Runner slots that are queued or running, including the one currently being given up
+    std::atomic<std::size_t> m_references{ 0 };
+  };
+
+  //! A chunk of a batch to run the parallel preprocess tasks on, returned to the pool before it is marked as done
+  struct PreprocessJob : public PostprocessExecutor::Runnable
+  {
+    explicit PreprocessJob(TaskRawDataProcessorModel& model)
+      : m_model(model)
+    {}
+
+    void run(PostprocessExecutor& /*executor*/) override
+    {
+      for (std::size_t i = 0; i < amount; ++i) {
+        m_model.invoke_parallel_preprocess_functions(&items[i]);
+      }
+      auto* done = pending;
+      m_model.m_free_preprocess_jobs->write(this);
+      done->fetch_sub(1);
+    }
+
+    ReadoutType* items = nullptr;
+    std::size_t amount = 0;
+    std::atomic<std::size_t>* pending = nullptr;
+
+  private:
+    TaskRawDataProcessorModel& m_model;
+  };
+
+  void dispatch_postprocess_batch(const PostprocessBatch& batch)
+  {
+    for (size_t i = 0; i < m_post_process_tasks.size(); ++i) {
+      auto& task = *m_post_process_tasks[i];
+      if (!task.push(*m_executor, batch)) {
+        // At most one warning per task and second, not one per element
+        auto now = std::chrono::steady_clock::now();
+        if (now - task.last_backlog_warning > std::chrono::seconds(1)) {
+          task.last_backlog_warning = now;
+          ers::warning(PostprocessingNotKeepingUp(ERS_HERE, m_geoid, i));
+        }
       }
     }
   }
@@ -157,11 +371,16 @@ protected:
   std::atomic<bool> m_run_marker{ false };
   // Async tasks and
   std::vector<std::function<void(ReadoutType*)>> m_preprocess_functions;
+  std::vector<std::function<void(ReadoutType*)>> m_parallel_preprocess_functions;
+  std::size_t m_preprocess_window{ 0 };
+  std::vector<std::unique_ptr<PreprocessJob>> m_preprocess_jobs;
+  std::unique_ptr<folly::MPMCQueue<PreprocessJob*>> m_free_preprocess_jobs;
   std::unique_ptr<FrameErrorRegistry>& m_error_registry;
 
   std::vector<std::function<void(const ReadoutType*)>> m_post_process_functions;
-  std::vector<std::unique_ptr<folly::ProducerConsumerQueue<const ReadoutType*>>> m_items_to_postprocess_queues;
-  std::vector<std::unique_ptr<ReusableThread>> m_post_process_threads;
+  std::vector<bool> m_post_process_in_order;
+  std::shared_ptr<PostprocessExecutor> m_executor;
+  std::vector<std::unique_ptr<PostprocessTask>> m_post_process_tasks;
 
   size_t m_postprocess_queue_sizes;
   uint32_t m_this_link_number; // NOLINT(build/unsigned)
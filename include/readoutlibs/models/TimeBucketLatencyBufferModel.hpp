@@ -0,0 +1,370 @@
+/**
+ * @file TimeBucketLatencyBufferModel.hpp Timestamp sorted, multi producer latency buffer sharded by time buckets
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_TIMEBUCKETLATENCYBUFFERMODEL_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_TIMEBUCKETLATENCYBUFFERMODEL_HPP_
+
+#include "readoutlibs/ReadoutIssues.hpp"
+#include "readoutlibs/ReadoutLogging.hpp"
+#include "readoutlibs/concepts/LatencyBufferConcept.hpp"
+#include "readoutlibs/readoutconfig/Nljs.hpp"
+#include "readoutlibs/readoutconfig/Structs.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** NOTES:
+    Elements are sorted by their first timestamp into buckets that each cover a fixed range of timestamps. Producers
+    writing to different buckets only share a reader lock on the bucket index, producers writing to the same bucket
+    serialize on its mutex. Elements do not move once inserted, so pointers to them stay valid until they are popped;
+    pins keep pop() away from the elements newer than the pinned one. Pops evict from the oldest bucket on and drop
+    buckets as a whole once they are empty. Iterators hold a reference to their bucket and take its lock per step.
+ */
+template<class T>
+class TimeBucketLatencyBufferModel : public LatencyBufferConcept<T>
+{
+  using timestamp_t = std::uint64_t; // NOLINT(build/unsigned)
+
+  struct Bucket
+  {
+    std::mutex mutex;
+    std::multimap<timestamp_t, T> elements;
+    // Set once the bucket was taken out of the index, writers then have to look it up again
+    bool retired = false;
+  };
+  using BucketMap = std::map<timestamp_t, std::shared_ptr<Bucket>>;
+
+public:
+  static constexpr timestamp_t default_bucket_width = 65536;
+
+  TimeBucketLatencyBufferModel() = default;
+
+  explicit TimeBucketLatencyBufferModel(std::size_t capacity, timestamp_t bucket_width = default_bucket_width)
+    : m_capacity(capacity)
+    , m_bucket_width(std::max<timestamp_t>(bucket_width, 1))
+  {}
+
+  struct Iterator
+  {
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = T*;
+    using reference = T&;
+
+    Iterator() = default;
+
+    Iterator(TimeBucketLatencyBufferModel* model,
+             timestamp_t key,
+             std::shared_ptr<Bucket> bucket,
+             typename std::multimap<timestamp_t, T>::iterator iter)
+      : m_model(model)
+      , m_key(key)
+      , m_bucket(std::move(bucket))
+      , m_iter(iter)
+    {}
+
+    // The end iterator refers to a default constructed element instead of invalid memory
+    reference operator*() const { return m_bucket ? m_iter->second : end_element(); }
+    pointer operator->() { return &(**this); }
+    Iterator& operator++() // NOLINT(runtime/increment_decrement) :)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_bucket->mutex);
+        ++m_iter;
+        if (m_iter != m_bucket->elements.end()) {
+          return *this;
+        }
+      }
+      *this = m_model->first_after_bucket(m_key);
+      return *this;
+    }
+
+    friend bool operator==(const Iterator& a, const Iterator& b)
+    {
+      return a.m_bucket == b.m_bucket && (!a.m_bucket || a.m_iter == b.m_iter);
+    }
+    friend bool operator!=(const Iterator& a, const Iterator& b) { return !(a == b); }
+
+    bool good() { return m_bucket != nullptr; }
+
+  private:
+    TimeBucketLatencyBufferModel* m_model = nullptr;
+    timestamp_t m_key = 0;
+    std::shared_ptr<Bucket> m_bucket;
+    typename std::multimap<timestamp_t, T>::iterator m_iter;
+  };
+
+  void conf(const nlohmann::json& cfg) override
+  {
+    auto conf = cfg["latencybufferconf"].get<readoutconfig::LatencyBufferConf>();
+    scrap(cfg);
+    m_capacity = conf.latency_buffer_size;
+    m_bucket_width = std::max<timestamp_t>(conf.latency_buffer_time_bucket_width, 1);
+  }
+
+  void scrap(const nlohmann::json& /*cfg*/) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    std::unique_lock<std::shared_mutex> lock(m_buckets_mutex);
+    m_buckets.clear();
+    m_occupancy.store(0);
+  }
+
+  std::size_t occupancy() const override { return m_occupancy.load(std::memory_order_relaxed); }
+
+  bool write(T&& element) override { return insert(std::move(element)) != nullptr; }
+
+  //! Written elements are not necessarily the newest ones, so the stored elements are reported directly
+  std::size_t write_bulk(T* elements, std::size_t amount, const T** written) override
+  {
+    std::size_t num_written = 0;
+    for (; num_written < amount; ++num_written) {
+      const T* stored = insert(std::move(elements[num_written]));
+      if (stored == nullptr) {
+        break;
+      }
+      if (written != nullptr) {
+        written[num_written] = stored;
+      }
+    }
+    return num_written;
+  }
+
+  bool read(T& element) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+    for (auto& [key, bucket] : m_buckets) {
+      std::lock_guard<std::mutex> bucket_lock(bucket->mutex);
+      if (!bucket->elements.empty()) {
+        element = std::move(bucket->elements.begin()->second);
+        bucket->elements.erase(bucket->elements.begin());
+        m_occupancy.fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const T* front() override
+  {
+    std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+    for (auto& [key, bucket] : m_buckets) {
+      std::lock_guard<std::mutex> bucket_lock(bucket->mutex);
+      if (!bucket->elements.empty()) {
+        return &bucket->elements.begin()->second;
+      }
+    }
+    return nullptr;
+  }
+
+  const T* back() override
+  {
+    std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+    for (auto it = m_buckets.rbegin(); it != m_buckets.rend(); ++it) {
+      std::lock_guard<std::mutex> bucket_lock(it->second->mutex);
+      if (!it->second->elements.empty()) {
+        return &std::prev(it->second->elements.end())->second;
+      }
+    }
+    return nullptr;
+  }
+
+  Iterator begin() { return first_after_bucket(0, true); }
+
+  Iterator end() { return Iterator(); }
+
+  // Returns the last element that is not greater than the searched one (or end() if all elements are greater).
+  // Only the bucket of the searched timestamp and, if it holds no smaller element, its predecessors are looked at.
+  Iterator lower_bound(T& element, bool /*with_errors=false*/)
+  {
+    timestamp_t timestamp = element.get_first_timestamp();
+    std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+    auto it = m_buckets.upper_bound(timestamp / m_bucket_width);
+    while (it != m_buckets.begin()) {
+      --it;
+      std::lock_guard<std::mutex> bucket_lock(it->second->mutex);
+      auto& elements = it->second->elements;
+      auto found = elements.upper_bound(timestamp);
+      if (found != elements.begin()) {
+        return Iterator(this, it->first, it->second, std::prev(found));
+      }
+    }
+    return end();
+  }
+
+  void pop(std::size_t amount) override { evict(amount, std::numeric_limits<timestamp_t>::max()); }
+
+  std::size_t pop_older_than(const T& element, std::size_t amount) override
+  {
+    return evict(amount, element.get_first_timestamp());
+  }
+
+  //! Like a pin of the oldest element, but also covers elements that arrive out of order with older timestamps
+  int pin() override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    timestamp_t pinned = 0;
+    for (std::size_t i = 0; i < m_pins.size(); ++i) {
+      if (m_pins[i] == no_pin) {
+        m_pins[i] = pinned;
+        return static_cast<int>(i);
+      }
+    }
+    m_pins.push_back(pinned);
+    return static_cast<int>(m_pins.size() - 1);
+  }
+
+  void advance_pin(int pin, const T* element) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    m_pins[pin] = element->get_first_timestamp();
+  }
+
+  void unpin(int pin) override
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    m_pins[pin] = no_pin;
+  }
+
+  void flush() override { pop(occupancy()); }
+
+protected:
+  static T& end_element()
+  {
+    static T element{};
+    return element;
+  }
+
+  //! Store an element, returns nullptr if the buffer is full
+  const T* insert(T&& element)
+  {
+    if (m_occupancy.fetch_add(1) >= m_capacity) {
+      m_occupancy.fetch_sub(1);
+      return nullptr;
+    }
+    timestamp_t timestamp = element.get_first_timestamp();
+    timestamp_t key = timestamp / m_bucket_width;
+    while (true) {
+      std::shared_ptr<Bucket> bucket;
+      {
+        std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+        auto it = m_buckets.find(key);
+        if (it != m_buckets.end()) {
+          bucket = it->second;
+        }
+      }
+      if (!bucket) {
+        std::unique_lock<std::shared_mutex> lock(m_buckets_mutex);
+        auto& slot = m_buckets[key];
+        if (!slot) {
+          slot = std::make_shared<Bucket>();
+        }
+        bucket = slot;
+      }
+      std::lock_guard<std::mutex> bucket_lock(bucket->mutex);
+      if (!bucket->retired) {
+        return &bucket->elements.emplace_hint(bucket->elements.end(), timestamp, std::move(element))->second;
+      }
+    }
+  }
+
+  //! First element of the first non empty bucket after the given one, or from the given one on if inclusive
+  Iterator first_after_bucket(timestamp_t key, bool inclusive = false)
+  {
+    std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+    auto it = inclusive ? m_buckets.lower_bound(key) : m_buckets.upper_bound(key);
+    for (; it != m_buckets.end(); ++it) {
+      std::lock_guard<std::mutex> bucket_lock(it->second->mutex);
+      if (!it->second->elements.empty()) {
+        return Iterator(this, it->first, it->second, it->second->elements.begin());
+      }
+    }
+    return end();
+  }
+
+  //! Pop the oldest elements, at most amount and only those older than before and than every pinned element
+  std::size_t evict(std::size_t amount, timestamp_t before)
+  {
+    std::lock_guard<std::mutex> evict_lock(m_evict_mutex);
+    for (auto pinned : m_pins) {
+      before = std::min(before, pinned);
+    }
+    std::size_t popped = 0;
+    std::vector<timestamp_t> empty_buckets;
+    {
+      std::shared_lock<std::shared_mutex> lock(m_buckets_mutex);
+      for (auto it = m_buckets.begin(); it != m_buckets.end() && popped < amount; ++it) {
+        std::lock_guard<std::mutex> bucket_lock(it->second->mutex);
+        auto& elements = it->second->elements;
+        auto last = elements.begin();
+        while (last != elements.end() && popped < amount && last->first < before) {
+          ++last;
+          ++popped;
+        }
+        elements.erase(elements.begin(), last);
+        if (!elements.empty()) {
+          break;
+        }
+        empty_buckets.push_back(it->first);
+      }
+    }
+    m_occupancy.fetch_sub(popped);
+    if (!empty_buckets.empty()) {
+      std::unique_lock<std::shared_mutex> lock(m_buckets_mutex);
+      for (auto key : empty_buckets) {
+        auto it = m_buckets.find(key);
+        // A producer may have refilled the bucket in the meantime
+        if (it != m_buckets.end()) {
+          // Keeps the bucket alive until its lock is released
+          auto bucket = it->second;
+          std::lock_guard<std::mutex> bucket_lock(bucket->mutex);
+          if (bucket->elements.empty()) {
+            bucket->retired = true;
+            m_buckets.erase(it);
+          }
+        }
+      }
+    }
+    return popped;
+  }
+
+private:
+  static constexpr timestamp_t no_pin = std::numeric_limits<timestamp_t>::max();
+
+  std::size_t m_capacity = std::numeric_limits<std::size_t>::max();
+  timestamp_t m_bucket_width = default_bucket_width;
+
+  BucketMap m_buckets;
+  std::shared_mutex m_buckets_mutex;
+  std::atomic<std::size_t> m_occupancy{ 0 };
+
+  // Serializes evictions and pins
+  std::mutex m_evict_mutex;
+  std::vector<timestamp_t> m_pins;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_TIMEBUCKETLATENCYBUFFERMODEL_HPP_
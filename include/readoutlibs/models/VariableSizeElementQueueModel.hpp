@@ -0,0 +1,213 @@
+/**
+ * @file VariableSizeElementQueueModel.hpp Latency buffer of variable size elements, stored in a byte arena
+ *
+ * This is part of the DUNE DAQ , copyright 2021.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_VARIABLESIZEELEMENTQUEUEMODEL_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_VARIABLESIZEELEMENTQUEUEMODEL_HPP_
+
+#include "readoutlibs/ReadoutIssues.hpp"
+#include "readoutlibs/ReadoutLogging.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "BinarySearchQueueModel.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** NOTES:
+    The payloads live in a single byte arena ring, every record starts with an inline header holding the payload size
+    and the timestamp. The elements of the underlying BinarySearchQueueModel only form the side index: a compact, fixed
+    size entry per payload with its timestamp and the location of the payload in the arena. Searches, pins and pops
+    work on the index, a pop implicitly frees the arena up to the record of the new oldest element.
+
+    T is the index entry and has to provide, in addition to what BinarySearchQueueModel needs:
+      begin()              pointer to the payload, it points into the arena once the element is stored
+      get_payload_size()   size of the payload in bytes
+      set_payload(void*)   relocates the entry to the copy of the payload in the arena
+    Written payloads are copied into the arena, so requests are answered with fragment pieces pointing into it.
+    There is one writer, like in the IterableQueueModel. A record that does not fit before the end of the arena is
+    placed at its start, the gap is marked with a padding header.
+ */
+template<class T>
+class VariableSizeElementQueueModel : public BinarySearchQueueModel<T>
+{
+public:
+  struct RecordHeader
+  {
+    uint32_t size;      // NOLINT(build/unsigned)
+    uint32_t flags;     // NOLINT(build/unsigned)
+    uint64_t timestamp; // NOLINT(build/unsigned)
+  };
+
+  static constexpr uint32_t padding_flag = 1; // NOLINT(build/unsigned)
+  static constexpr std::size_t record_alignment = sizeof(RecordHeader);
+
+  VariableSizeElementQueueModel()
+    : BinarySearchQueueModel<T>()
+  {}
+
+  VariableSizeElementQueueModel(uint32_t size, std::size_t arena_size) // NOLINT(build/unsigned)
+    : BinarySearchQueueModel<T>(size)
+  {
+    allocate_arena(arena_size);
+  }
+
+  ~VariableSizeElementQueueModel() { std::free(m_arena); }
+
+  bool write(T&& element) override
+  {
+    if (IterableQueueModel<T>::isFull()) {
+      ++IterableQueueModel<T>::overflow_ctr;
+      return false;
+    }
+    std::size_t size = element.get_payload_size();
+    std::size_t offset = 0;
+    if (!reserve(size, offset)) {
+      ++IterableQueueModel<T>::overflow_ctr;
+      return false;
+    }
+    auto* header = reinterpret_cast<RecordHeader*>(m_arena + offset);
+    header->size = static_cast<uint32_t>(size); // NOLINT(build/unsigned)
+    header->flags = 0;
+    header->timestamp = element.get_first_timestamp();
+    char* payload = m_arena + offset + sizeof(RecordHeader);
+    std::memcpy(payload, element.begin(), size);
+    element.set_payload(payload);
+    // The index publishes the record, the arena head only moves once the entry is stored
+    if (!BinarySearchQueueModel<T>::write(std::move(element))) {
+      return false;
+    }
+    m_head = offset + record_size(size);
+    return true;
+  }
+
+  std::size_t write_bulk(T* elements, std::size_t amount, const T** written) override
+  {
+    std::size_t count = 0;
+    for (; count < amount; ++count) {
+      if (!write(std::move(elements[count]))) {
+        break;
+      }
+      if (written != nullptr) {
+        written[count] = IterableQueueModel<T>::back();
+      }
+    }
+    return count;
+  }
+
+  void conf(const nlohmann::json& cfg) override
+  {
+    BinarySearchQueueModel<T>::conf(cfg);
+    auto conf = cfg["latencybufferconf"].get<readoutconfig::LatencyBufferConf>();
+    allocate_arena(conf.latency_buffer_arena_size);
+    if (conf.latency_buffer_preallocation) {
+      std::memset(m_arena, 0, m_arena_size);
+    }
+  }
+
+  void scrap(const nlohmann::json& cfg) override
+  {
+    BinarySearchQueueModel<T>::scrap(cfg);
+    std::free(m_arena);
+    m_arena = nullptr;
+    m_arena_size = 0;
+    m_head = 0;
+  }
+
+  //! Bytes of the arena used by the stored records, including headers and padding
+  std::size_t arena_occupancy()
+  {
+    std::size_t tail = 0;
+    if (!oldest_record(tail)) {
+      return 0;
+    }
+    return m_head > tail ? m_head - tail : m_arena_size - tail + m_head;
+  }
+
+  std::size_t arena_size() const { return m_arena_size; }
+
+protected:
+  static std::size_t record_size(std::size_t payload_size)
+  {
+    return (sizeof(RecordHeader) + payload_size + record_alignment - 1) / record_alignment * record_alignment;
+  }
+
+  void allocate_arena(std::size_t arena_size)
+  {
+    std::free(m_arena);
+    m_arena_size = (arena_size + record_alignment - 1) / record_alignment * record_alignment;
+    m_arena = static_cast<char*>(std::aligned_alloc(record_alignment, m_arena_size));
+    m_head = 0;
+    if (m_arena_size > 0 && !m_arena) {
+      throw std::bad_alloc();
+    }
+  }
+
+  //! Offset of the record of the oldest element, false if the buffer is empty
+  bool oldest_record(std::size_t& offset)
+  {
+    auto const currentRead = IterableQueueModel<T>::readIndex_.load(std::memory_order_acquire);
+    if (currentRead == IterableQueueModel<T>::writeIndex_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    auto* payload = reinterpret_cast<char*>(IterableQueueModel<T>::records_[currentRead].begin());
+    offset = payload - sizeof(RecordHeader) - m_arena;
+    return true;
+  }
+
+  //! Find room for a record with the given payload size, the space ends strictly before the oldest record
+  bool reserve(std::size_t payload_size, std::size_t& offset)
+  {
+    std::size_t needed = record_size(payload_size);
+    if (needed > m_arena_size) {
+      return false;
+    }
+    std::size_t tail = 0;
+    if (!oldest_record(tail)) {
+      m_head = 0;
+      offset = 0;
+      return true;
+    }
+    if (m_head > tail) {
+      if (m_head + needed <= m_arena_size) {
+        offset = m_head;
+        return true;
+      }
+      if (needed >= tail) {
+        return false;
+      }
+      if (m_arena_size - m_head >= sizeof(RecordHeader)) {
+        auto* padding = reinterpret_cast<RecordHeader*>(m_arena + m_head);
+        padding->size = static_cast<uint32_t>(m_arena_size - m_head - sizeof(RecordHeader)); // NOLINT
+        padding->flags = padding_flag;
+        padding->timestamp = 0;
+      }
+      offset = 0;
+      return true;
+    }
+    if (m_head + needed >= tail) {
+      return false;
+    }
+    offset = m_head;
+    return true;
+  }
+
+  char* m_arena = nullptr;
+  std::size_t m_arena_size = 0;
+  std::size_t m_head = 0;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_VARIABLESIZEELEMENTQUEUEMODEL_HPP_
@@ -1,6 +1,5 @@
 /**
- * @file DefaultRequestHandlerModel.hpp Default mode of operandy for
- * request handling:
+ * @file ZeroCopyRecordingRequestHandlerModel.hpp Request handling that records the latency buffer memory directly
  *
  * This is part of the DUNE DAQ , copyright 2020.
  * Licensing/copyright details are in the COPYING file that you should have
@@ -10,7 +9,19 @@
 #define READOUTLIBS_INCLUDE_READOUTLIBS_MODELS_ZEROCOPYRECORDINGREQUESTHANDLERMODEL_HPP_
 
 #include "readoutlibs/models/DefaultRequestHandlerModel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
 #include <memory>
+#include <numeric>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace dunedaq {
 namespace readoutlibs {
@@ -28,6 +39,8 @@ public:
 
   using inherited = DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>;
 
+  ~ZeroCopyRecordingRequestHandlerModel() { std::free(m_bounce_buffer); }
+
   void conf(const nlohmann::json& args) override
   {
 
@@ -38,20 +51,34 @@ public:
       inherited::m_geoid.system_type = ReadoutType::system_type;
 
       // Check for alignment restrictions
-      if (inherited::m_latency_buffer->get_alignment_size() == 0 ||
-          sizeof(ReadoutType) * inherited::m_latency_buffer->get_size() % 4096) {
+      m_alignment_size = inherited::m_latency_buffer->get_alignment_size();
+      if (m_alignment_size == 0 || sizeof(ReadoutType) * inherited::m_latency_buffer->get_size() % 4096) {
         ers::error(ConfigurationError(ERS_HERE, inherited::m_geoid, "Latency buffer is not 4k aligned"));
       }
+      if (m_alignment_size == 0) {
+        m_alignment_size = 4096;
+      }
+      // Direct writes are whole multiples of the alignment
+      m_chunk_size = std::max(conf.stream_buffer_size / m_alignment_size, size_t(1)) * m_alignment_size;
+      std::free(m_bounce_buffer);
+      m_bounce_buffer = static_cast<char*>(std::aligned_alloc(m_alignment_size, m_chunk_size));
+      if (m_bounce_buffer == nullptr) {
+        throw std::bad_alloc();
+      }
 
       if (remove(conf.output_file.c_str()) == 0) {
         TLOG(TLVL_WORK_STEPS) << "Removed existing output file from previous run: " << conf.output_file;
       }
+      remove(index_file_name(conf.output_file).c_str());
 
-      m_oflag = O_CREAT | O_WRONLY;
+      m_oflag = O_CREAT | O_WRONLY | O_TRUNC;
       if (conf.use_o_direct) {
         m_oflag |= O_DIRECT;
       }
-      m_fd = ::open(conf.output_file.c_str(), m_oflag, 0644);
+      m_output_base = conf.output_file;
+      m_file_max_bytes = conf.recording_file_max_bytes;
+      m_file_max_time = std::chrono::seconds(conf.recording_file_max_seconds);
+      m_file_index = 0;
       inherited::m_recording_configured = true;
     }
     inherited::conf(args);
@@ -66,149 +93,248 @@ public:
     }
     inherited::m_recording_thread.set_work(
       [&](int duration) {
-        size_t chunk_size = inherited::m_stream_buffer_size;
-        size_t alignment_size = inherited::m_latency_buffer->get_alignment_size();
         TLOG() << "Start recording for " << duration << " second(s)" << std::endl;
         inherited::m_recording.exchange(true);
         auto start_of_recording = std::chrono::high_resolution_clock::now();
         auto current_time = start_of_recording;
         inherited::m_next_timestamp_to_record = 0;
 
-        const char* current_write_pointer = nullptr;
         const char* start_of_buffer_pointer =
           reinterpret_cast<const char*>(inherited::m_latency_buffer->start_of_buffer()); // NOLINT
-        const char* current_end_pointer;
         const char* end_of_buffer_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->end_of_buffer()); // NOLINT
+        const char* current_write_pointer = nullptr;
+        // Files start at elements that are aligned in the buffer, so their content can be written directly
+        const size_t file_boundary = std::lcm(sizeof(ReadoutType), m_alignment_size);
+        size_t total_bytes = 0;
 
-        size_t bytes_written = 0;
+        // Keep the not yet recorded elements in the buffer, the pin follows the write pointer
+        auto recording_pin = inherited::m_latency_buffer->pin();
+        // A failed write or a file that can't be opened after a rotation ends the recording
+        bool recording_failed = false;
+        auto recording_time = [&]() {
+          return std::chrono::duration_cast<std::chrono::seconds>(current_time - start_of_recording).count();
+        };
+        while (!recording_failed && recording_time() < duration) {
+          current_time = std::chrono::high_resolution_clock::now();
+          if (current_write_pointer == nullptr) {
+            current_write_pointer = first_aligned_element();
+            if (current_write_pointer == nullptr ||
+                !open_next_file(element_at(current_write_pointer)->get_first_timestamp())) {
+              current_write_pointer = nullptr;
+              wait_for_data();
+              continue;
+            }
+          }
 
-        while (std::chrono::duration_cast<std::chrono::seconds>(current_time - start_of_recording).count() < duration) {
-          if (!inherited::m_cleanup_requested || (inherited::m_next_timestamp_to_record == 0)) {
-            size_t considered_chunks_in_loop = 0;
+          // End of the newest element, which is where the next element will be written
+          auto newest = inherited::m_latency_buffer->back();
+          const char* current_end_pointer =
+            newest == nullptr ? current_write_pointer
+                              : reinterpret_cast<const char*>(newest) + sizeof(ReadoutType); // NOLINT
+          if (current_end_pointer == end_of_buffer_pointer) {
+            current_end_pointer = start_of_buffer_pointer;
+          }
+          if (current_end_pointer == current_write_pointer) {
+            wait_for_data();
+            continue;
+          }
 
-            // Wait for potential running cleanup to finish first
-            {
-              std::unique_lock<std::mutex> lock(inherited::m_cv_mutex);
-              inherited::m_cv.wait(lock, [&] { return !inherited::m_cleanup_requested; });
-            }
-            inherited::m_cv.notify_all();
-
-            // Some frames have to be skipped to start copying from an aligned piece of memory
-            // These frames cannot be written without O_DIRECT as this would mess up the alignment of the write pointer
-            // into the target file
-            if (inherited::m_next_timestamp_to_record == 0) {
-              auto begin = inherited::m_latency_buffer->begin();
-              if (begin == inherited::m_latency_buffer->end()) {
-                // There are no elements in the buffer, update time and try again
-                current_time = std::chrono::high_resolution_clock::now();
-                continue;
-              }
-              inherited::m_next_timestamp_to_record = begin->get_first_timestamp();
-              size_t skipped_frames = 0;
-              while (reinterpret_cast<std::uintptr_t>(&(*begin)) % alignment_size) { // NOLINT
-                ++begin;
-                skipped_frames++;
-                if (!begin.good()) {
-                  // We reached the end of the buffer without finding an aligned element
-                  // Reset the next timestamp to record and try again
-                  current_time = std::chrono::high_resolution_clock::now();
-                  inherited::m_next_timestamp_to_record = 0;
-                  continue;
-                }
-              }
-              TLOG() << "Skipped " << skipped_frames << " frames";
-              current_write_pointer = reinterpret_cast<const char*>(&(*begin)); // NOLINT
-            }
+          // A rotation is due, stop at the next file boundary and continue in the next file from there
+          bool rotate = (m_file_max_bytes > 0 && m_file_bytes >= m_file_max_bytes) ||
+                        (m_file_max_time.count() > 0 && current_time - m_file_opened >= m_file_max_time);
+          const char* limit = current_end_pointer < current_write_pointer ? end_of_buffer_pointer : current_end_pointer;
+          if (rotate) {
+            size_t offset = current_write_pointer - start_of_buffer_pointer;
+            size_t boundary = (offset + file_boundary - 1) / file_boundary * file_boundary;
+            limit = std::min(limit, start_of_buffer_pointer + boundary);
+          }
+          size_t amount =
+            std::min(static_cast<size_t>(limit - current_write_pointer), max_chunks_per_pass * m_chunk_size);
+          if (!emit(current_write_pointer, amount)) {
+            ers::error(CannotWriteToFile(ERS_HERE, m_file_name));
+            recording_failed = true;
+            break;
+          }
+          total_bytes += amount;
+          inherited::m_recorded_bytes += amount;
+          current_write_pointer += amount;
+          if (current_write_pointer == end_of_buffer_pointer) {
+            current_write_pointer = start_of_buffer_pointer;
+          }
 
-            current_end_pointer = reinterpret_cast<const char*>(inherited::m_latency_buffer->back()); // NOLINT
-
-            // Break the loop from time to time to update the timestamp and check if we should stop recording
-            while (considered_chunks_in_loop < 100) {
-              auto iptr = reinterpret_cast<std::uintptr_t>(current_write_pointer); // NOLINT
-              if (iptr % alignment_size) {
-                // This should never happen
-                TLOG() << "Error: Write pointer is not aligned";
-              }
-              bool failed_write = false;
-              if (current_write_pointer + chunk_size < current_end_pointer) {
-                // We can write a whole chunk to file
-                failed_write |= !::write(m_fd, current_write_pointer, chunk_size);
-                if (!failed_write) {
-                  bytes_written += chunk_size;
-                }
-                current_write_pointer += chunk_size;
-              } else if (current_end_pointer < current_write_pointer) {
-                if (current_write_pointer + chunk_size < end_of_buffer_pointer) {
-                  // Write whole chunk to file
-                  failed_write |= !::write(m_fd, current_write_pointer, chunk_size);
-                  if (!failed_write) {
-                    bytes_written += chunk_size;
-                  }
-                  current_write_pointer += chunk_size;
-                } else {
-                  // Write the last bit of the buffer without using O_DIRECT as it possibly doesn't fulfill the
-                  // alignment requirement
-                  fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
-                  failed_write |= !::write(m_fd, current_write_pointer, end_of_buffer_pointer - current_write_pointer);
-                  fcntl(m_fd, F_SETFL, m_oflag);
-                  if (!failed_write) {
-                    bytes_written += end_of_buffer_pointer - current_write_pointer;
-                  }
-                  current_write_pointer = start_of_buffer_pointer;
-                }
-              }
-
-              if (current_write_pointer == end_of_buffer_pointer) {
-                current_write_pointer = start_of_buffer_pointer;
-              }
-
-              if (failed_write) {
-                TLOG() << "Failed write!";
-                ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
-              }
-              considered_chunks_in_loop++;
-              // This expression is "a bit" complicated as it finds the last frame that was written to file completely
-              inherited::m_next_timestamp_to_record =
-                reinterpret_cast<const ReadoutType*>( // NOLINT
-                  start_of_buffer_pointer +
-                  (((current_write_pointer - start_of_buffer_pointer) / ReadoutType::fixed_payload_size) *
-                   ReadoutType::fixed_payload_size))
-                  ->get_first_timestamp();
+          uint64_t next_timestamp; // NOLINT(build/unsigned)
+          if (current_write_pointer == current_end_pointer) {
+            // Caught up, the slot under the write pointer is not written yet, the next element follows the newest
+            next_timestamp =
+              newest->get_first_timestamp() + ReadoutType::expected_tick_difference * newest->get_num_frames();
+            inherited::m_latency_buffer->advance_pin(recording_pin, newest);
+          } else {
+            // The element under the write pointer is the first one that is not completely in the file
+            const ReadoutType* next_element = element_at(current_write_pointer);
+            next_timestamp = next_element->get_first_timestamp();
+            inherited::m_latency_buffer->advance_pin(recording_pin, next_element);
+          }
+          inherited::m_next_timestamp_to_record = next_timestamp;
+
+          if (rotate && (current_write_pointer - start_of_buffer_pointer) % file_boundary == 0) {
+            close_file();
+            if (!open_next_file(next_timestamp)) {
+              recording_failed = true;
             }
           }
-          current_time = std::chrono::high_resolution_clock::now();
         }
 
-        // Complete writing the last frame to file
+        // Complete writing the last element to file
         if (current_write_pointer != nullptr) {
-          const char* last_started_frame =
-            start_of_buffer_pointer +
-            (((current_write_pointer - start_of_buffer_pointer) / ReadoutType::fixed_payload_size) *
-             ReadoutType::fixed_payload_size);
-          if (last_started_frame != current_write_pointer) {
-            fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
-            if (!::write(m_fd,
-                         current_write_pointer,
-                         (last_started_frame + ReadoutType::fixed_payload_size) - current_write_pointer)) {
-              ers::warning(CannotWriteToFile(ERS_HERE, inherited::m_output_file));
+          size_t offset = (current_write_pointer - start_of_buffer_pointer) % sizeof(ReadoutType);
+          if (offset != 0 && !recording_failed) {
+            size_t remaining = sizeof(ReadoutType) - offset;
+            if (emit(current_write_pointer, remaining)) {
+              total_bytes += remaining;
+              inherited::m_recorded_bytes += remaining;
             } else {
-              bytes_written += (last_started_frame + ReadoutType::fixed_payload_size) - current_write_pointer;
+              ers::warning(CannotWriteToFile(ERS_HERE, m_file_name));
             }
           }
+          close_file();
         }
-        ::close(m_fd);
+        inherited::m_latency_buffer->unpin(recording_pin);
 
         inherited::m_next_timestamp_to_record = std::numeric_limits<uint64_t>::max(); // NOLINT (build/unsigned)
 
-        TLOG() << "Stopped recording, wrote " << bytes_written << " bytes";
+        TLOG() << "Stopped recording" << (recording_failed ? " after a failed write" : "") << ", wrote " << total_bytes
+               << " bytes";
         inherited::m_recording.exchange(false);
       },
       args.get<readoutconfig::RecordingParams>().duration);
   }
 
 private:
-  int m_fd;
-  int m_oflag;
+  // Bound of the bytes written between two checks of the recording duration and of the file rotation
+  static constexpr size_t max_chunks_per_pass = 16;
+
+  static std::string index_file_name(const std::string& output_file) { return output_file + ".index"; }
+
+  const ReadoutType* element_at(const char* pointer)
+  {
+    const char* start = reinterpret_cast<const char*>(inherited::m_latency_buffer->start_of_buffer()); // NOLINT
+    return reinterpret_cast<const ReadoutType*>(                                                        // NOLINT
+      start + (pointer - start) / sizeof(ReadoutType) * sizeof(ReadoutType));
+  }
+
+  // Some elements have to be skipped to start copying from an aligned piece of memory
+  const char* first_aligned_element()
+  {
+    size_t skipped_frames = 0;
+    for (auto it = inherited::m_latency_buffer->begin(); it.good(); ++it) {
+      if (reinterpret_cast<std::uintptr_t>(&(*it)) % m_alignment_size == 0) { // NOLINT
+        inherited::m_next_timestamp_to_record = it->get_first_timestamp();
+        TLOG() << "Skipped " << skipped_frames << " frames";
+        return reinterpret_cast<const char*>(&(*it)); // NOLINT
+      }
+      ++skipped_frames;
+    }
+    return nullptr;
+  }
+
+  void wait_for_data()
+  {
+    auto t_wait_begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(inherited::recording_idle_sleep);
+    inherited::m_recording_wait_ns += inherited::ns_since(t_wait_begin);
+  }
+
+  // Files after the first one get the index as suffix, the index file lists every file with its first timestamp
+  bool open_next_file(uint64_t first_timestamp) // NOLINT(build/unsigned)
+  {
+    m_file_name = m_file_index == 0 ? m_output_base : m_output_base + "." + std::to_string(m_file_index);
+    m_fd = ::open(m_file_name.c_str(), m_oflag, 0644);
+    if (m_fd < 0) {
+      ers::warning(CannotWriteToFile(ERS_HERE, m_file_name));
+      return false;
+    }
+    ++m_file_index;
+    m_file_bytes = 0;
+    m_bounce_fill = 0;
+    m_file_opened = std::chrono::high_resolution_clock::now();
+    std::ofstream index(index_file_name(m_output_base), std::ios::app);
+    index << m_file_name << " " << first_timestamp << "\n";
+    return true;
+  }
+
+  // Writes the rest of the bounce buffer padded to the alignment, then cuts the padding off again
+  void close_file()
+  {
+    if (m_fd < 0) {
+      return;
+    }
+    if (m_bounce_fill > 0) {
+      size_t padded = (m_bounce_fill + m_alignment_size - 1) / m_alignment_size * m_alignment_size;
+      std::memset(m_bounce_buffer + m_bounce_fill, 0, padded - m_bounce_fill);
+      if (!write_fully(m_bounce_buffer, padded) || ::ftruncate(m_fd, m_file_bytes) != 0) {
+        ers::warning(CannotWriteToFile(ERS_HERE, m_file_name));
+      }
+      m_bounce_fill = 0;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+  }
+
+  // Appends to the current file. Aligned memory goes out directly, anything else, e.g. the end of the buffer when it
+  // is not a multiple of the alignment, is gathered in the aligned bounce buffer first.
+  bool emit(const char* data, size_t size)
+  {
+    bool success = true;
+    m_file_bytes += size;
+    while (size > 0) {
+      if (m_bounce_fill == 0 && reinterpret_cast<std::uintptr_t>(data) % m_alignment_size == 0 && // NOLINT
+          size >= m_alignment_size) {
+        size_t direct = std::min(size, m_chunk_size) / m_alignment_size * m_alignment_size;
+        success &= write_fully(data, direct);
+        data += direct;
+        size -= direct;
+        continue;
+      }
+      size_t copied = std::min(size, m_chunk_size - m_bounce_fill);
+      std::memcpy(m_bounce_buffer + m_bounce_fill, data, copied);
+      m_bounce_fill += copied;
+      data += copied;
+      size -= copied;
+      if (m_bounce_fill == m_chunk_size) {
+        success &= write_fully(m_bounce_buffer, m_chunk_size);
+        m_bounce_fill = 0;
+      }
+    }
+    return success;
+  }
+
+  bool write_fully(const char* data, size_t size)
+  {
+    while (size > 0) {
+      ssize_t written = ::write(m_fd, data, size);
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  int m_fd = -1;
+  int m_oflag = 0;
+  size_t m_alignment_size = 4096;
+  size_t m_chunk_size = 0;
+  char* m_bounce_buffer = nullptr;
+  size_t m_bounce_fill = 0;
+
+  std::string m_output_base;
+  std::string m_file_name;
+  size_t m_file_index = 0;
+  size_t m_file_bytes = 0;
+  size_t m_file_max_bytes = 0;
+  std::chrono::seconds m_file_max_time{ 0 };
+  std::chrono::high_resolution_clock::time_point m_file_opened;
 };
 
 } // namespace readoutlibs
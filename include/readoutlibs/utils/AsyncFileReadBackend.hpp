@@ -0,0 +1,221 @@
+/**
+ * @file AsyncFileReadBackend.hpp Read-ahead, multi-buffered pread backend for the BufferedFileReader. A pool of I/O
+ * threads keeps reading the next parts of the file into aligned buffers, so that the reading thread only blocks when
+ * it caught up with the reads in flight.
+ *
+ * This is part of the DUNE DAQ , copyright 2021.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEREADBACKEND_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEREADBACKEND_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/**
+ * Reads from a file descriptor through a ring of Alignment-aligned buffers of the same size. Every buffer is filled
+ * with a single pread at an aligned file offset, which keeps the reads valid for O_DIRECT, also for the short read at
+ * the end of the file. The buffers are consumed in file order.
+ * @tparam Alignment The alignment of the buffers, buffer sizes and file offsets.
+ */
+template<size_t Alignment = 4096>
+class AsyncFileReadBackend
+{
+public:
+  /**
+   * @param fd The file descriptor to read from, it is not closed by the backend.
+   * @param buffer_size The size of each buffer, it has to be a multiple of Alignment.
+   * @param num_buffers The number of buffers, all but the one being consumed are read ahead.
+   * @param num_threads The number of I/O threads issuing the reads.
+   */
+  AsyncFileReadBackend(int fd, size_t buffer_size, size_t num_buffers = 8, size_t num_threads = 4)
+    : m_fd(fd)
+    , m_buffer_size(buffer_size)
+  {
+    for (size_t i = 0; i < std::max<size_t>(num_buffers, 2); ++i) {
+      char* buffer = static_cast<char*>(std::aligned_alloc(Alignment, m_buffer_size));
+      if (buffer == nullptr) {
+        throw std::bad_alloc();
+      }
+      m_buffers.push_back(buffer);
+      m_free_buffers.push_back(buffer);
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+      m_io_threads.emplace_back(&AsyncFileReadBackend::run_io, this);
+    }
+    submit_free_buffers();
+  }
+
+  ~AsyncFileReadBackend()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_submit_cv.notify_all();
+    for (auto& thread : m_io_threads) {
+      thread.join();
+    }
+    for (auto* buffer : m_buffers) {
+      std::free(buffer);
+    }
+  }
+
+  AsyncFileReadBackend(const AsyncFileReadBackend&) = delete;
+  AsyncFileReadBackend& operator=(const AsyncFileReadBackend&) = delete;
+
+  /**
+   * Copy up to size bytes of the file into memory.
+   * @return The number of bytes read, less than size at the end of the file or after a failure.
+   */
+  size_t read(char* memory, size_t size)
+  {
+    size_t total = 0;
+    while (total < size) {
+      if (m_current_offset == m_current_size) {
+        if (!next_buffer()) {
+          break;
+        }
+      }
+      size_t amount = std::min(size - total, m_current_size - m_current_offset);
+      std::memcpy(memory + total, m_current + m_current_offset, amount);
+      m_current_offset += amount;
+      total += amount;
+    }
+    return total;
+  }
+
+  bool failed() const { return m_read_failed; }
+
+private:
+  struct Read
+  {
+    char* buffer;
+    off_t offset;
+    size_t size = 0;
+    bool done = false;
+    bool failed = false;
+  };
+
+  // Queue reads of the following parts of the file into all free buffers
+  void submit_free_buffers()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      while (!m_free_buffers.empty() && !m_end_submitted) {
+        m_reads.push_back({ m_free_buffers.back(), m_next_offset });
+        m_free_buffers.pop_back();
+        m_pending_reads.push_back(&m_reads.back());
+        m_next_offset += m_buffer_size;
+      }
+    }
+    m_submit_cv.notify_all();
+  }
+
+  // Hand the current buffer back and wait for the next one in file order, false at the end of the file
+  bool next_buffer()
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_current != nullptr) {
+        m_free_buffers.push_back(m_current);
+        m_current = nullptr;
+      }
+      if (m_reads.empty()) {
+        return false;
+      }
+      m_done_cv.wait(lock, [&]() { return m_reads.front().done; });
+      Read read = m_reads.front();
+      m_reads.pop_front();
+      if (read.failed || read.size < m_buffer_size) {
+        // Nothing after a short read is part of the file, the reads queued behind it find no data
+        m_end_submitted = true;
+        m_read_failed = m_read_failed || read.failed;
+        if (read.failed) {
+          m_free_buffers.push_back(read.buffer);
+          return false;
+        }
+      }
+      m_current = read.buffer;
+      m_current_size = read.size;
+      m_current_offset = 0;
+    }
+    submit_free_buffers();
+    return m_current_size > 0;
+  }
+
+  void run_io()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_submit_cv.wait(lock, [&]() { return m_stop || !m_pending_reads.empty(); });
+      if (m_stop) {
+        return;
+      }
+      Read* pending = m_pending_reads.front();
+      m_pending_reads.pop_front();
+      lock.unlock();
+
+      size_t size = 0;
+      bool failed = false;
+      while (size < m_buffer_size) {
+        ssize_t result = ::pread(m_fd, pending->buffer + size, m_buffer_size - size, pending->offset + size);
+        if (result < 0) {
+          failed = true;
+          break;
+        }
+        if (result == 0 || (result % Alignment) != 0) {
+          size += result;
+          break;
+        }
+        size += result;
+      }
+
+      lock.lock();
+      pending->size = size;
+      pending->failed = failed;
+      pending->done = true;
+      m_done_cv.notify_all();
+    }
+  }
+
+  int m_fd;
+  size_t m_buffer_size;
+  std::vector<char*> m_buffers;
+
+  // Only used by the reading thread
+  char* m_current = nullptr;
+  size_t m_current_size = 0;
+  size_t m_current_offset = 0;
+  off_t m_next_offset = 0;
+  bool m_end_submitted = false;
+  bool m_read_failed = false;
+
+  std::mutex m_mutex;
+  std::condition_variable m_submit_cv;
+  std::condition_variable m_done_cv;
+  std::vector<char*> m_free_buffers;
+  std::deque<Read> m_reads; // In file order, the addresses of the elements are stable for the I/O threads
+  std::deque<Read*> m_pending_reads;
+  bool m_stop = false;
+  std::vector<std::thread> m_io_threads;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEREADBACKEND_HPP_
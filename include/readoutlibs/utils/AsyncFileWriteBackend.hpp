@@ -0,0 +1,259 @@
+/**
+ * @file AsyncFileWriteBackend.hpp Asynchronous, multi-buffered pwrite backend for the BufferedFileWriter. Full buffers
+ * are handed to a pool of I/O threads, so that the writing thread only blocks when all buffers are in flight.
+ *
+ * This is part of the DUNE DAQ , copyright 2021.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEWRITEBACKEND_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEWRITEBACKEND_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/**
+ * Writes to a file descriptor through a ring of Alignment-aligned buffers of the same size. Every buffer is written
+ * with a single pwrite at an aligned file offset, which keeps the writes valid for O_DIRECT. The unaligned tail of
+ * the data is written padded to the alignment and the file is truncated to its logical size afterwards, so O_DIRECT
+ * only has to be switched off if a short write leaves an unaligned remainder.
+ * @tparam Alignment The alignment of the buffers, buffer sizes and file offsets.
+ */
+template<size_t Alignment = 4096>
+class AsyncFileWriteBackend
+{
+public:
+  /**
+   * @param fd The file descriptor to write to, it is not closed by the backend.
+   * @param buffer_size The size of each buffer, it has to be a multiple of Alignment.
+   * @param num_buffers The number of buffers, at most num_buffers - 1 writes are in flight.
+   * @param num_threads The number of I/O threads issuing the writes.
+   * @throw std::invalid_argument If the buffer size is zero or not aligned, or there are less than two buffers.
+   */
+  AsyncFileWriteBackend(int fd, size_t buffer_size, size_t num_buffers = 8, size_t num_threads = 4)
+    : m_fd(fd)
+    , m_buffer_size(buffer_size)
+  {
+    if (m_buffer_size == 0 || m_buffer_size % Alignment != 0) {
+      throw std::invalid_argument("The buffer size has to be a non-zero multiple of the alignment");
+    }
+    if (num_buffers < 2) {
+      throw std::invalid_argument("At least two buffers are needed, one is filled while the others are written");
+    }
+    if (num_threads == 0) {
+      throw std::invalid_argument("At least one I/O thread is needed");
+    }
+    for (size_t i = 0; i < num_buffers; ++i) {
+      char* buffer = static_cast<char*>(std::aligned_alloc(Alignment, m_buffer_size));
+      if (buffer == nullptr) {
+        throw std::bad_alloc();
+      }
+      m_buffers.push_back(buffer);
+      m_free_buffers.push_back(buffer);
+    }
+    m_current = acquire_free_buffer();
+    for (size_t i = 0; i < num_threads; ++i) {
+      m_io_threads.emplace_back(&AsyncFileWriteBackend::run_io, this);
+    }
+  }
+
+  ~AsyncFileWriteBackend()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_submit_cv.notify_all();
+    for (auto& thread : m_io_threads) {
+      thread.join();
+    }
+    for (auto* buffer : m_buffers) {
+      std::free(buffer);
+    }
+  }
+
+  AsyncFileWriteBackend(const AsyncFileWriteBackend&) = delete;
+  AsyncFileWriteBackend& operator=(const AsyncFileWriteBackend&) = delete;
+
+  /**
+   * Copy data into the current buffer and submit every buffer that becomes full.
+   * @return false if any previous write to the file failed.
+   */
+  bool write(const char* memory, size_t size)
+  {
+    while (size > 0) {
+      size_t amount = std::min(size, m_buffer_size - m_current_fill);
+      std::memcpy(m_current + m_current_fill, memory, amount);
+      m_current_fill += amount;
+      memory += amount;
+      size -= amount;
+      if (m_current_fill == m_buffer_size) {
+        submit(m_current, m_buffer_size);
+        m_file_offset += m_buffer_size;
+        m_current = acquire_free_buffer();
+        m_current_fill = 0;
+      }
+    }
+    return !m_write_failed.load();
+  }
+
+  /**
+   * Write all buffered data to the file and wait for the writes to complete. The aligned part of the current buffer
+   * is submitted, the unaligned tail is written padded and stays buffered, so that later data is appended to it.
+   * @return false if any write to the file failed.
+   */
+  bool flush()
+  {
+    size_t aligned_fill = m_current_fill / Alignment * Alignment;
+    if (aligned_fill > 0) {
+      char* next = acquire_free_buffer();
+      std::memcpy(next, m_current + aligned_fill, m_current_fill - aligned_fill);
+      submit(m_current, aligned_fill);
+      m_file_offset += aligned_fill;
+      m_current = next;
+      m_current_fill -= aligned_fill;
+    }
+    wait_for_writes();
+    if (m_current_fill > 0) {
+      std::memset(m_current + m_current_fill, 0, Alignment - m_current_fill);
+      if (!write_all(m_current, Alignment, m_file_offset)) {
+        m_write_failed.store(true);
+      }
+    }
+    if (::ftruncate(m_fd, m_file_offset + m_current_fill) != 0) {
+      m_write_failed.store(true);
+    }
+    return !m_write_failed.load();
+  }
+
+  bool failed() const { return m_write_failed.load(); }
+
+private:
+  struct PendingWrite
+  {
+    char* buffer;
+    size_t size;
+    off_t offset;
+  };
+
+  void submit(char* buffer, size_t size)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_pending_writes.push_back({ buffer, size, m_file_offset });
+      ++m_writes_in_flight;
+    }
+    m_submit_cv.notify_one();
+  }
+
+  char* acquire_free_buffer()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [&]() { return !m_free_buffers.empty(); });
+    char* buffer = m_free_buffers.back();
+    m_free_buffers.pop_back();
+    return buffer;
+  }
+
+  void wait_for_writes()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [&]() { return m_writes_in_flight == 0; });
+  }
+
+  void run_io()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_submit_cv.wait(lock, [&]() { return m_stop || !m_pending_writes.empty(); });
+      if (m_pending_writes.empty()) {
+        return;
+      }
+      PendingWrite pending = m_pending_writes.front();
+      m_pending_writes.pop_front();
+      lock.unlock();
+
+      if (!write_all(pending.buffer, pending.size, pending.offset)) {
+        m_write_failed.store(true);
+      }
+
+      lock.lock();
+      m_free_buffers.push_back(pending.buffer);
+      --m_writes_in_flight;
+      m_done_cv.notify_all();
+    }
+  }
+
+  // Writes size bytes at offset, retrying interrupted and short writes. The remainder of a short write is only valid
+  // for O_DIRECT if it is still aligned, otherwise the descriptor falls back to buffered I/O for good.
+  bool write_all(const char* buffer, size_t size, off_t offset)
+  {
+    size_t written = 0;
+    while (written < size) {
+      ssize_t result = ::pwrite(m_fd, buffer + written, size - written, offset + written);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        return false;
+      }
+      written += result;
+      if (written < size && written % Alignment != 0 && !drop_direct_io()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool drop_direct_io()
+  {
+    std::lock_guard<std::mutex> lock(m_fd_flags_mutex);
+    int flags = ::fcntl(m_fd, F_GETFL);
+    if (flags == -1) {
+      return false;
+    }
+    return (flags & O_DIRECT) == 0 || ::fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) == 0;
+  }
+
+  int m_fd;
+  std::mutex m_fd_flags_mutex;
+  size_t m_buffer_size;
+  std::vector<char*> m_buffers;
+
+  // Only used by the writing thread
+  char* m_current = nullptr;
+  size_t m_current_fill = 0;
+  off_t m_file_offset = 0;
+
+  std::mutex m_mutex;
+  std::condition_variable m_submit_cv;
+  std::condition_variable m_done_cv;
+  std::vector<char*> m_free_buffers;
+  std::deque<PendingWrite> m_pending_writes;
+  size_t m_writes_in_flight = 0;
+  bool m_stop = false;
+  std::vector<std::thread> m_io_threads;
+  std::atomic<bool> m_write_failed{ false };
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ASYNCFILEWRITEBACKEND_HPP_
@@ -11,6 +11,8 @@
 
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/ReadoutLogging.hpp"
+#include "readoutlibs/utils/AsyncFileReadBackend.hpp"
+#include "readoutlibs/utils/ChunkedCompression.hpp"
 
 #include "logging/Logging.hpp"
 
@@ -27,6 +29,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <string>
 #include <unistd.h>
 
@@ -52,13 +55,21 @@ public:
    * Constructor to construct and initalize an instance. The file will be open after initialization.
    * @param filename The file to be used.
    * @param buffer_size The size of the buffer to be used.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma, zlib or
+   * zstd_chunked (decompressed in parallel)
+   * @param use_o_direct Whether to open the file with O_DIRECT, only used by the async io backend without compression
+   * @param io_backend How data is read from the file. Can be one of: stream (boost iostreams, synchronous reads) or
+   * async (multiple aligned buffers read ahead by a pool of I/O threads, only None or zstd_chunked compression)
    * @throw CannotOpenFile If the file can not be opened.
-   * @throw ConfigurationError If the compression algorithm parameter is not recognized.
+   * @throw ConfigurationError If the compression algorithm or io backend parameter is not recognized.
    */
-  BufferedFileReader(std::string filename, size_t buffer_size, std::string compression_algorithm = "None")
+  BufferedFileReader(std::string filename,
+                     size_t buffer_size,
+                     std::string compression_algorithm = "None",
+                     bool use_o_direct = false,
+                     std::string io_backend = "stream")
   {
-    open(filename, buffer_size, compression_algorithm);
+    open(filename, buffer_size, compression_algorithm, use_o_direct, io_backend);
   }
 
   /**
@@ -75,21 +86,66 @@ public:
    * Open a file.
    * @param filename The file to be used.
    * @param buffer_size The size of the buffer to be used.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma, zlib or
+   * zstd_chunked (decompressed in parallel)
+   * @param use_o_direct Whether to open the file with O_DIRECT, only used by the async io backend without compression
+   * @param io_backend How data is read from the file. Can be one of: stream (boost iostreams, synchronous reads) or
+   * async (multiple aligned buffers read ahead by a pool of I/O threads, only None or zstd_chunked compression)
    * @throw CannotOpenFile If the file can not be opened.
-   * @throw ConfigurationError If the compression algorithm parameter is not recognized.
+   * @throw ConfigurationError If the compression algorithm or io backend parameter is not recognized.
    */
-  void open(std::string filename, size_t buffer_size, std::string compression_algorithm = "None")
+  void open(std::string filename,
+            size_t buffer_size,
+            std::string compression_algorithm = "None",
+            bool use_o_direct = false,
+            std::string io_backend = "stream")
   {
     m_filename = filename;
     m_buffer_size = buffer_size;
     m_compression_algorithm = compression_algorithm;
+    if (io_backend != "stream" && io_backend != "async") {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "Non-recognized io backend: " + io_backend);
+    }
+    bool read_ahead = io_backend == "async" && m_compression_algorithm == "None";
+    if (io_backend == "async" && !read_ahead && m_compression_algorithm != "zstd_chunked") {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE,
+                                                   "The async io backend only supports zstd_chunked compression");
+    }
+    if (read_ahead && m_buffer_size % Alignment != 0) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "The async io backend needs aligned buffer sizes");
+    }
 
-    int fd = ::open(m_filename.c_str(), O_RDONLY);
+    // The chunked decompressor reads whole compressed frames at unaligned offsets, so O_DIRECT is left to read_ahead
+    auto oflag = O_RDONLY;
+    if (read_ahead && use_o_direct) {
+      oflag = oflag | O_DIRECT;
+    }
+    int fd = ::open(m_filename.c_str(), oflag);
     if (fd == -1) {
       throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
     }
 
+    if (read_ahead) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using the async io backend" << std::endl;
+      m_async_backend = std::make_unique<AsyncFileReadBackend<Alignment>>(fd, m_buffer_size);
+      m_fd = fd;
+      m_is_open = true;
+      return;
+    }
+
+    if (m_compression_algorithm == "zstd_chunked") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using chunked zstd compression" << std::endl;
+      try {
+        m_chunked_decompressor = std::make_unique<ChunkedDecompressor>(fd);
+      } catch (const BufferedReaderWriterConfigurationError&) {
+        ::close(fd);
+        throw;
+      }
+      m_fd = fd;
+      m_is_open = true;
+      return;
+    }
+
     io_source_t io_source(fd, boost::iostreams::file_descriptor_flags::close_handle);
     if (m_compression_algorithm == "zstd") {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zstd compression" << std::endl;
@@ -125,11 +181,33 @@ public:
    * @return true if the read was successful, false if the reader is not open or the read was not successful.
    */
   bool read(ReadoutType& element)
+  {
+    return read_batch(&element, 1) == 1;
+  }
+
+  /**
+   * Read consecutive elements from the file.
+   * @param elements The memory the elements are read into, it has room for amount elements.
+   * @param amount The maximum number of elements to read.
+   * @return The number of complete elements read, less than amount at the end of the file, if the reader is not open
+   * or the read was not successful.
+   */
+  size_t read_batch(ReadoutType* elements, size_t amount)
   {
     if (!m_is_open)
-      return false;
-    m_input_stream.read(reinterpret_cast<char*>(&element), sizeof(element)); // NOLINT
-    return (m_input_stream.gcount() == sizeof(element));
+      return 0;
+    auto* memory = reinterpret_cast<char*>(elements); // NOLINT
+    size_t size = amount * sizeof(ReadoutType);
+    size_t bytes_read = 0;
+    if (m_async_backend) {
+      bytes_read = m_async_backend->read(memory, size);
+    } else if (m_chunked_decompressor) {
+      bytes_read = m_chunked_decompressor->read(memory, size);
+    } else {
+      m_input_stream.read(memory, size);
+      bytes_read = m_input_stream.gcount();
+    }
+    return bytes_read / sizeof(ReadoutType);
   }
 
   /**
@@ -137,6 +215,12 @@ public:
    */
   void close()
   {
+    if (m_chunked_decompressor || m_async_backend) {
+      m_chunked_decompressor.reset();
+      m_async_backend.reset();
+      ::close(m_fd);
+      m_fd = -1;
+    }
     m_input_stream.reset();
     m_is_open = false;
   }
@@ -149,6 +233,9 @@ private:
 
   // Internals
   filtering_istream_t m_input_stream;
+  std::unique_ptr<ChunkedDecompressor> m_chunked_decompressor;
+  std::unique_ptr<AsyncFileReadBackend<Alignment>> m_async_backend;
+  int m_fd = -1;
   bool m_is_open = false;
 };
 
@@ -13,6 +13,8 @@
 
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/ReadoutLogging.hpp"
+#include "readoutlibs/utils/AsyncFileWriteBackend.hpp"
+#include "readoutlibs/utils/ChunkedCompression.hpp"
 
 #include "logging/Logging.hpp"
 
@@ -29,6 +31,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <string>
 #include <unistd.h>
 
@@ -58,7 +61,8 @@ public:
    * created.
    * @param buffer_size The size of the buffer that is used before data is written to the file. Make sure that this
    * size fulfils size requirements of O_DIRECT, otherwise writes will fail.
-   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma, zlib or
+   * zstd_chunked (zstd compressed chunks of buffer_size bytes, compressed in parallel)
    * @throw CannotOpenFile If the file can not be opened.
    * @throw ConfigurationError If the compression algorithm parameter is not recognized.
    */
@@ -93,13 +97,17 @@ public:
    * @param buffer_size The size of the buffer that is used before data is written to the file. Make sure that this
    * size fulfils size requirements of O_DIRECT, otherwise writes will fail.
    * @param compression_algorithm The compression algorithm to use. Can be one of: None, zstd, lzma or zlib
+   * @param use_o_direct Whether to open the file with O_DIRECT
+   * @param io_backend How data is written to the file. Can be one of: stream (boost iostreams, synchronous writes)
+   * or async (multiple aligned buffers written by a pool of I/O threads, only zstd_chunked compression)
    * @throw CannotOpenFile If the file can not be opened.
-   * @throw ConfigurationError If the compression algorithm parameter is not recognized.
+   * @throw ConfigurationError If the compression algorithm or io backend parameter is not recognized.
    */
   void open(std::string filename,
             size_t buffer_size,
             std::string compression_algorithm = "None",
-            bool use_o_direct = true)
+            bool use_o_direct = true,
+            std::string io_backend = "stream")
   {
     m_use_o_direct = use_o_direct;
     if (m_is_open) {
@@ -109,6 +117,17 @@ public:
     m_filename = filename;
     m_buffer_size = buffer_size;
     m_compression_algorithm = compression_algorithm;
+    if (io_backend != "stream" && io_backend != "async") {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "Non-recognized io backend: " + io_backend);
+    }
+    if (io_backend == "async" && m_compression_algorithm != "None" && m_compression_algorithm != "zstd_chunked") {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE,
+                                                   "The async io backend only supports zstd_chunked compression");
+    }
+    if (io_backend == "async" && (m_buffer_size == 0 || m_buffer_size % Alignment != 0)) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE,
+                                                   "The async io backend needs non-zero, aligned buffer sizes");
+    }
     auto oflag = O_CREAT | O_WRONLY;
     if (m_use_o_direct) {
       oflag = oflag | O_DIRECT;
@@ -119,6 +138,18 @@ public:
       throw BufferedReaderWriterCannotOpenFile(ERS_HERE, m_filename);
     }
 
+    if (io_backend == "async") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using the async io backend" << std::endl;
+      m_async_backend = std::make_unique<AsyncFileWriteBackend<Alignment>>(m_fd, m_buffer_size);
+      if (m_compression_algorithm == "zstd_chunked") {
+        TLOG_DEBUG(TLVL_WORK_STEPS) << "Using chunked zstd compression" << std::endl;
+        m_chunked_compressor = std::make_unique<ChunkedCompressor>(
+          m_buffer_size, [this](const char* memory, size_t size) { return m_async_backend->write(memory, size); });
+      }
+      m_is_open = true;
+      return;
+    }
+
     m_sink = io_sink_t(m_fd, boost::iostreams::file_descriptor_flags::close_handle);
     if (m_compression_algorithm == "zstd") {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zstd compression" << std::endl;
@@ -129,6 +160,13 @@ public:
     } else if (m_compression_algorithm == "zlib") {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "Using zlib compression" << std::endl;
       m_output_stream.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib::best_speed));
+    } else if (m_compression_algorithm == "zstd_chunked") {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Using chunked zstd compression" << std::endl;
+      m_chunked_compressor =
+        std::make_unique<ChunkedCompressor>(m_buffer_size, [this](const char* memory, size_t size) {
+          m_output_stream.write(memory, size); // NOLINT
+          return !m_output_stream.bad();
+        });
     } else if (m_compression_algorithm == "None") {
       TLOG_DEBUG(TLVL_WORK_STEPS) << "Running without compression" << std::endl;
     } else {
@@ -155,6 +193,12 @@ public:
   {
     if (!m_is_open)
       return false;
+    if (m_chunked_compressor) {
+      return m_chunked_compressor->write(memory, size);
+    }
+    if (m_async_backend) {
+      return m_async_backend->write(memory, size);
+    }
     m_output_stream.write(memory, size); // NOLINT
     return !m_output_stream.bad();
   }
@@ -164,6 +208,21 @@ public:
    */
   void close()
   {
+    if (m_chunked_compressor) {
+      if (!m_chunked_compressor->finish()) {
+        ers::error(CannotWriteToFile(ERS_HERE, m_filename));
+      }
+      m_chunked_compressor.reset();
+    }
+    if (m_async_backend) {
+      if (!m_async_backend->flush()) {
+        ers::error(CannotWriteToFile(ERS_HERE, m_filename));
+      }
+      m_async_backend.reset();
+      ::close(m_fd);
+      m_is_open = false;
+      return;
+    }
     // Set the file descriptor to not use O_DIRECT. This is necessary because the write size has to be aligned for
     // O_DIRECT to succeed. This is not guaranteed for the data that remains in the buffer.
     fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
@@ -172,11 +231,21 @@ public:
   }
 
   /**
-   * If no compression is used, this writes all data from buffers to the file. In case that compression is used,
-   * this is not guaranteed.
+   * If no compression or zstd_chunked compression is used, this writes all data from buffers to the file. In case
+   * that another compression is used, this is not guaranteed.
+   * @return true if the flush was successful, false if the writer is not open or any write to the file failed.
    */
-  void flush()
+  bool flush()
   {
+    if (!m_is_open)
+      return false;
+    bool flushed = true;
+    if (m_chunked_compressor) {
+      flushed = m_chunked_compressor->flush();
+    }
+    if (m_async_backend) {
+      return m_async_backend->flush() && flushed;
+    }
     // Set the file descriptor to not use O_DIRECT. This is necessary because the write size has to be aligned for
     // O_DIRECT to succeed. This is not guaranteed for the data that remains in the buffer.
     fcntl(m_fd, F_SETFL, O_CREAT | O_WRONLY);
@@ -188,6 +257,7 @@ public:
       oflag = oflag | O_DIRECT;
     }
     fcntl(m_fd, F_SETFL, oflag);
+    return flushed && !m_output_stream.bad();
   }
 
 private:
@@ -200,6 +270,8 @@ private:
   int m_fd;
   io_sink_t m_sink;
   filtering_ostream_t m_output_stream;
+  std::unique_ptr<AsyncFileWriteBackend<Alignment>> m_async_backend;
+  std::unique_ptr<ChunkedCompressor> m_chunked_compressor;
   bool m_is_open = false;
   bool m_use_o_direct = true;
 };
@@ -0,0 +1,406 @@
+/**
+ * @file ChunkedCompression.hpp Parallel zstd compression and decompression of files cut into independently compressed
+ * chunks. The files follow the zstd seekable format: a sequence of regular zstd frames, one per chunk, followed by a
+ * seek table in a skippable frame. They can therefore also be read by any zstd decompressor.
+ *
+ * This is part of the DUNE DAQ , copyright 2021.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_CHUNKEDCOMPRESSION_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_CHUNKEDCOMPRESSION_HPP_
+
+#include "readoutlibs/ReadoutIssues.hpp"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+namespace chunked_compression {
+
+constexpr uint32_t skippable_magic = 0x184D2A5E; // NOLINT(build/unsigned)
+constexpr uint32_t seekable_magic = 0x8F92EAB1;  // NOLINT(build/unsigned)
+constexpr size_t seek_entry_size = 8;
+constexpr size_t seek_footer_size = 9;
+
+//! Runs tasks on a fixed set of threads, the futures of submit() keep the results in submission order
+class WorkerPool
+{
+public:
+  explicit WorkerPool(size_t num_threads)
+  {
+    for (size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i) {
+      m_threads.emplace_back(&WorkerPool::run, this);
+    }
+  }
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  std::future<void> submit(std::function<void()> function)
+  {
+    auto task = std::make_shared<std::packaged_task<void()>>(std::move(function));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.emplace_back([task]() { (*task)(); });
+    }
+    m_cv.notify_one();
+    return future;
+  }
+
+  size_t size() const { return m_threads.size(); }
+
+private:
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv.wait(lock, [&]() { return m_stop || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return;
+      }
+      auto task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::function<void()>> m_tasks;
+  bool m_stop = false;
+  std::vector<std::thread> m_threads;
+};
+
+} // namespace chunked_compression
+
+/**
+ * Cuts the written data into chunks of chunk_size bytes, compresses them on a worker pool and passes the compressed
+ * frames in order to the sink. finish() appends the seek table.
+ */
+class ChunkedCompressor
+{
+public:
+  using sink_t = std::function<bool(const char*, size_t)>;
+
+  ChunkedCompressor(size_t chunk_size, sink_t sink, size_t num_threads = 4, int level = 1)
+    : m_chunk_size(chunk_size)
+    , m_level(level)
+    , m_sink(std::move(sink))
+    , m_pool(num_threads)
+    , m_max_in_flight(2 * m_pool.size())
+  {
+    m_current.reserve(m_chunk_size);
+  }
+
+  ChunkedCompressor(const ChunkedCompressor&) = delete;
+  ChunkedCompressor& operator=(const ChunkedCompressor&) = delete;
+
+  bool write(const char* memory, size_t size)
+  {
+    while (size > 0) {
+      size_t amount = std::min(size, m_chunk_size - m_current.size());
+      m_current.insert(m_current.end(), memory, memory + amount);
+      memory += amount;
+      size -= amount;
+      if (m_current.size() == m_chunk_size) {
+        submit_current();
+        emit_completed(false);
+      }
+    }
+    return !m_failed;
+  }
+
+  //! Compress the partially filled chunk as a frame of its own and pass all frames to the sink
+  bool flush()
+  {
+    submit_current();
+    emit_completed(true);
+    return !m_failed;
+  }
+
+  //! Flush and append the seek table, no data can be written afterwards
+  bool finish()
+  {
+    flush();
+    std::vector<char> table;
+    append_u32(table, chunked_compression::skippable_magic);
+    append_u32(table,
+               m_seek_entries.size() * chunked_compression::seek_entry_size + chunked_compression::seek_footer_size);
+    for (auto& entry : m_seek_entries) {
+      append_u32(table, entry.first);
+      append_u32(table, entry.second);
+    }
+    append_u32(table, m_seek_entries.size());
+    table.push_back(0); // Seek table descriptor: no checksums
+    append_u32(table, chunked_compression::seekable_magic);
+    if (!m_sink(table.data(), table.size())) {
+      m_failed = true;
+    }
+    m_seek_entries.clear();
+    return !m_failed;
+  }
+
+private:
+  struct Job
+  {
+    std::vector<char> input;
+    std::vector<char> output;
+    bool failed = false;
+    std::future<void> future;
+  };
+
+  static void append_u32(std::vector<char>& buffer, uint32_t value) // NOLINT(build/unsigned)
+  {
+    char bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(value));
+  }
+
+  void submit_current()
+  {
+    if (m_current.empty()) {
+      return;
+    }
+    auto job = std::make_shared<Job>();
+    job->input.swap(m_current);
+    if (!m_spare_buffers.empty()) {
+      m_current.swap(m_spare_buffers.back());
+      m_spare_buffers.pop_back();
+    }
+    m_current.reserve(m_chunk_size);
+
+    int level = m_level;
+    job->future = m_pool.submit([job, level]() {
+      job->output.resize(ZSTD_compressBound(job->input.size()));
+      size_t result =
+        ZSTD_compress(job->output.data(), job->output.size(), job->input.data(), job->input.size(), level);
+      if (ZSTD_isError(result)) {
+        job->failed = true;
+      } else {
+        job->output.resize(result);
+      }
+    });
+    m_jobs.push_back(std::move(job));
+    while (m_jobs.size() > m_max_in_flight) {
+      emit_front();
+    }
+  }
+
+  void emit_completed(bool wait)
+  {
+    while (!m_jobs.empty() &&
+           (wait || m_jobs.front()->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+      emit_front();
+    }
+  }
+
+  void emit_front()
+  {
+    auto job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    job->future.get();
+    // A failed job has no frame to write, only chunks that reached the sink go into the seek table
+    if (job->failed || !m_sink(job->output.data(), job->output.size())) {
+      m_failed = true;
+    } else {
+      m_seek_entries.emplace_back(job->output.size(), job->input.size());
+    }
+    job->input.clear();
+    m_spare_buffers.push_back(std::move(job->input));
+  }
+
+  size_t m_chunk_size;
+  int m_level;
+  sink_t m_sink;
+  chunked_compression::WorkerPool m_pool;
+  size_t m_max_in_flight;
+
+  std::vector<char> m_current;
+  std::vector<std::vector<char>> m_spare_buffers;
+  std::deque<std::shared_ptr<Job>> m_jobs;
+  std::vector<std::pair<uint32_t, uint32_t>> m_seek_entries; // NOLINT(build/unsigned)
+  bool m_failed = false;
+};
+
+/**
+ * Reads a file written by the ChunkedCompressor. The seek table is used to decompress the chunks ahead of the reader
+ * on a worker pool.
+ */
+class ChunkedDecompressor
+{
+public:
+  /**
+   * @param fd The file descriptor to read from, it is not closed by the decompressor.
+   * @throw ConfigurationError If the file has no seek table.
+   */
+  explicit ChunkedDecompressor(int fd, size_t num_threads = 4)
+    : m_fd(fd)
+    , m_pool(num_threads)
+    , m_max_in_flight(2 * m_pool.size())
+  {
+    read_seek_table();
+  }
+
+  ChunkedDecompressor(const ChunkedDecompressor&) = delete;
+  ChunkedDecompressor& operator=(const ChunkedDecompressor&) = delete;
+
+  /**
+   * Read up to size bytes of decompressed data.
+   * @return The number of bytes read, less than size at the end of the file or after a failure.
+   */
+  size_t read(char* memory, size_t size)
+  {
+    size_t total = 0;
+    while (total < size) {
+      if (m_current_offset == m_current.size()) {
+        if (!next_chunk()) {
+          break;
+        }
+      }
+      size_t amount = std::min(size - total, m_current.size() - m_current_offset);
+      std::memcpy(memory + total, m_current.data() + m_current_offset, amount);
+      m_current_offset += amount;
+      total += amount;
+    }
+    return total;
+  }
+
+private:
+  struct Chunk
+  {
+    off_t offset;
+    size_t compressed_size;
+    size_t decompressed_size;
+  };
+
+  struct Job
+  {
+    std::vector<char> output;
+    bool failed = false;
+    std::future<void> future;
+  };
+
+  void read_seek_table()
+  {
+    struct stat file_stat;
+    if (fstat(m_fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(chunked_compression::seek_footer_size)) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "File too short for a chunked compression seek table");
+    }
+    char footer[chunked_compression::seek_footer_size];
+    uint32_t num_chunks = 0; // NOLINT(build/unsigned)
+    uint32_t magic = 0;      // NOLINT(build/unsigned)
+    off_t footer_offset = file_stat.st_size - chunked_compression::seek_footer_size;
+    if (::pread(m_fd, footer, sizeof(footer), footer_offset) != static_cast<ssize_t>(sizeof(footer))) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "Could not read the chunked compression seek table");
+    }
+    std::memcpy(&num_chunks, footer, sizeof(num_chunks));
+    std::memcpy(&magic, footer + 5, sizeof(magic));
+    off_t table_offset = footer_offset - static_cast<off_t>(num_chunks * chunked_compression::seek_entry_size);
+    if (magic != chunked_compression::seekable_magic || table_offset < 0) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "File has no chunked compression seek table");
+    }
+
+    std::vector<char> table(num_chunks * chunked_compression::seek_entry_size);
+    if (::pread(m_fd, table.data(), table.size(), table_offset) != static_cast<ssize_t>(table.size())) {
+      throw BufferedReaderWriterConfigurationError(ERS_HERE, "Could not read the chunked compression seek table");
+    }
+    off_t offset = 0;
+    for (uint32_t i = 0; i < num_chunks; ++i) { // NOLINT(build/unsigned)
+      uint32_t compressed_size = 0;            // NOLINT(build/unsigned)
+      uint32_t decompressed_size = 0;          // NOLINT(build/unsigned)
+      std::memcpy(&compressed_size, table.data() + i * chunked_compression::seek_entry_size, 4);
+      std::memcpy(&decompressed_size, table.data() + i * chunked_compression::seek_entry_size + 4, 4);
+      m_chunks.push_back({ offset, compressed_size, decompressed_size });
+      offset += compressed_size;
+    }
+  }
+
+  void schedule()
+  {
+    while (m_next_to_schedule < m_chunks.size() && m_jobs.size() < m_max_in_flight) {
+      auto job = std::make_shared<Job>();
+      Chunk chunk = m_chunks[m_next_to_schedule++];
+      int fd = m_fd;
+      job->future = m_pool.submit([job, chunk, fd]() {
+        std::vector<char> input(chunk.compressed_size);
+        job->output.resize(chunk.decompressed_size);
+        if (::pread(fd, input.data(), input.size(), chunk.offset) != static_cast<ssize_t>(input.size())) {
+          job->failed = true;
+          return;
+        }
+        size_t result = ZSTD_decompress(job->output.data(), job->output.size(), input.data(), input.size());
+        job->failed = ZSTD_isError(result) || result != chunk.decompressed_size;
+      });
+      m_jobs.push_back(std::move(job));
+    }
+  }
+
+  bool next_chunk()
+  {
+    schedule();
+    if (m_jobs.empty()) {
+      return false;
+    }
+    auto job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    job->future.get();
+    schedule();
+    if (job->failed) {
+      m_next_to_schedule = m_chunks.size();
+      m_jobs.clear();
+      return false;
+    }
+    m_current.swap(job->output);
+    m_current_offset = 0;
+    return true;
+  }
+
+  int m_fd;
+  chunked_compression::WorkerPool m_pool;
+  size_t m_max_in_flight;
+
+  std::vector<Chunk> m_chunks;
+  size_t m_next_to_schedule = 0;
+  std::deque<std::shared_ptr<Job>> m_jobs;
+  std::vector<char> m_current;
+  size_t m_current_offset = 0;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_CHUNKEDCOMPRESSION_HPP_
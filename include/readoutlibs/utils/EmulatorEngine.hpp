@@ -0,0 +1,189 @@
+/**
+ * @file EmulatorEngine.hpp Small pool of threads driving the payload generation of many emulated links
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_EMULATORENGINE_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_EMULATORENGINE_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** EmulatorEngine usage:
+ *
+ *  auto engine = EmulatorEngine::get(2);
+ *  auto id = engine->add_link(std::chrono::microseconds(100), [&]() { produce(); });
+ *  ...
+ *  engine->remove_link(id);
+ */
+/** NOTES:
+    Every link has a period and a step function. The steps of all links run in deadline order on the threads of the
+    engine, which sleep on a condition variable until the earliest deadline instead of spinning. Deadlines are aligned
+    to multiples of the period since the engine epoch, so links with the same rate stay aligned with each other. A link
+    that falls more than max_overshoot behind skips the missed periods rather than producing a burst.
+ */
+class EmulatorEngine
+{
+public:
+  using clock_t = std::chrono::steady_clock;
+  using link_id_t = std::size_t;
+
+  static constexpr std::chrono::milliseconds max_overshoot{ 10 };
+
+  explicit EmulatorEngine(std::size_t num_threads)
+    : m_epoch(clock_t::now())
+  {
+    for (std::size_t i = 0; i < std::max<std::size_t>(num_threads, 1); ++i) {
+      m_threads.emplace_back(&EmulatorEngine::run, this);
+      std::string name = "emu-engine-" + std::to_string(i);
+      pthread_setname_np(m_threads.back().native_handle(), name.c_str());
+    }
+  }
+
+  ~EmulatorEngine()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  EmulatorEngine(const EmulatorEngine&) = delete;
+  EmulatorEngine& operator=(const EmulatorEngine&) = delete;
+
+  //! The engine shared by all emulators of the process, created with num_threads threads by its first user
+  static std::shared_ptr<EmulatorEngine> get(std::size_t num_threads)
+  {
+    static std::mutex instance_mutex;
+    static std::weak_ptr<EmulatorEngine> instance;
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    auto engine = instance.lock();
+    if (!engine) {
+      engine = std::make_shared<EmulatorEngine>(num_threads);
+      instance = engine;
+    }
+    return engine;
+  }
+
+  link_id_t add_link(std::chrono::nanoseconds period, std::function<void()> step)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto link = std::make_shared<Link>();
+    link->period = std::max(period, std::chrono::nanoseconds(1));
+    link->step = std::move(step);
+    link_id_t id = m_next_id++;
+    m_links[id] = link;
+    m_deadlines.push({ next_aligned_deadline(clock_t::now(), link->period), id });
+    m_cv.notify_all();
+    return id;
+  }
+
+  //! Remove a link, waiting for a running step of it to finish
+  void remove_link(link_id_t id)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_links.find(id);
+    if (it == m_links.end()) {
+      return;
+    }
+    auto link = it->second;
+    m_links.erase(it);
+    m_cv.wait(lock, [&]() { return !link->running; });
+  }
+
+private:
+  struct Link
+  {
+    std::chrono::nanoseconds period;
+    std::function<void()> step;
+    bool running = false;
+  };
+
+  struct Deadline
+  {
+    clock_t::time_point time;
+    link_id_t id;
+
+    bool operator>(const Deadline& other) const { return time > other.time; }
+  };
+
+  clock_t::time_point next_aligned_deadline(clock_t::time_point now, std::chrono::nanoseconds period) const
+  {
+    auto periods = (now - m_epoch) / period + 1;
+    return m_epoch + periods * period;
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+      if (m_deadlines.empty()) {
+        m_cv.wait(lock);
+        continue;
+      }
+      Deadline next = m_deadlines.top();
+      auto it = m_links.find(next.id);
+      if (it == m_links.end()) {
+        m_deadlines.pop();
+        continue;
+      }
+      if (clock_t::now() < next.time) {
+        m_cv.wait_until(lock, next.time);
+        continue;
+      }
+      m_deadlines.pop();
+      auto link = it->second;
+      link->running = true;
+      lock.unlock();
+      link->step();
+      lock.lock();
+      link->running = false;
+
+      if (m_links.count(next.id)) {
+        auto deadline = next.time + link->period;
+        auto now = clock_t::now();
+        if (deadline + max_overshoot < now) {
+          deadline = next_aligned_deadline(now, link->period);
+        }
+        m_deadlines.push({ deadline, next.id });
+      }
+      // Wakes up remove_link and threads that wait for a later deadline than the new one
+      m_cv.notify_all();
+    }
+  }
+
+  const clock_t::time_point m_epoch;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::map<link_id_t, std::shared_ptr<Link>> m_links;
+  std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> m_deadlines;
+  link_id_t m_next_id = 0;
+  bool m_stop = false;
+  std::vector<std::thread> m_threads;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_EMULATORENGINE_HPP_
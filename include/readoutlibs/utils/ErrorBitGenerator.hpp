@@ -8,6 +8,8 @@
 #ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ERRORBITGENERATOR_HPP_
 #define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_ERRORBITGENERATOR_HPP_
 
+#include <algorithm>
+#include <cstddef>
 #include <random>
 #include <unistd.h>
 
@@ -19,6 +21,7 @@ namespace readoutlibs {
  * auto ebg = ErrorBitGenerator(1.0)
  * ebg.generate();
  * uint16_t errs = ebg.next();
+ * ebg.fill(errs_array, num_frames); // same sequence as num_frames calls of next()
  *
  */
 
@@ -36,24 +39,27 @@ public:
   {}
   uint16_t next() // NOLINT(build/unsigned)
   {
-    if (m_occurrence_count >= m_current_occurrence) {
-      if (m_set_error_bits) {
-        m_error_bits_index = (m_error_bits_index + 1) % m_size;
-        m_error_occurrences_index = (m_error_occurrences_index + 1) % m_size;
-        m_set_error_bits = false;
-        m_current_occurrence = m_no_error_occurrences[m_no_error_occurrences_index];
-        m_occurrence_count = 0;
-      } else {
-        m_no_error_occurrences_index = (m_no_error_occurrences_index + 1) % m_size;
-        m_set_error_bits = true;
-        m_current_occurrence = m_error_occurrences[m_error_occurrences_index];
-        m_occurrence_count = 0;
-      }
-    }
+    advance_occurrence();
     m_occurrence_count++;
     return (m_set_error_bits && m_current_occurrence) ? m_error_bits[m_error_bits_index] : 0;
   }
 
+  // Writes whole runs of equal error words at once instead of stepping through them one by one
+  void fill(uint16_t* errs, std::size_t amount) // NOLINT(build/unsigned)
+  {
+    while (amount > 0) {
+      advance_occurrence();
+      // An empty occurrence still produces one word
+      std::size_t run =
+        m_current_occurrence > m_occurrence_count ? static_cast<std::size_t>(m_current_occurrence - m_occurrence_count) : 1;
+      run = std::min(run, amount);
+      std::fill_n(errs, run, (m_set_error_bits && m_current_occurrence) ? m_error_bits[m_error_bits_index] : 0);
+      m_occurrence_count += run;
+      errs += run;
+      amount -= run;
+    }
+  }
+
   void generate()
   {
     std::random_device rd;
@@ -71,6 +77,25 @@ public:
   }
 
 private:
+  // Switch between error and no error occurrences once the current one is used up
+  void advance_occurrence()
+  {
+    if (m_occurrence_count >= m_current_occurrence) {
+      if (m_set_error_bits) {
+        m_error_bits_index = (m_error_bits_index + 1) % m_size;
+        m_error_occurrences_index = (m_error_occurrences_index + 1) % m_size;
+        m_set_error_bits = false;
+        m_current_occurrence = m_no_error_occurrences[m_no_error_occurrences_index];
+        m_occurrence_count = 0;
+      } else {
+        m_no_error_occurrences_index = (m_no_error_occurrences_index + 1) % m_size;
+        m_set_error_bits = true;
+        m_current_occurrence = m_error_occurrences[m_error_occurrences_index];
+        m_occurrence_count = 0;
+      }
+    }
+  }
+
   int m_size = 1000;
   double m_error_rate;
   uint16_t m_error_bits[1000]; // NOLINT(build/unsigned)
@@ -13,16 +13,89 @@
 
 #include "logging/Logging.hpp"
 
-#include <fstream>
-#include <limits>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using dunedaq::readoutlibs::logging::TLVL_BOOKKEEPING;
 
 namespace dunedaq {
 namespace readoutlibs {
 
+/**
+ * Read-only mapping of a whole file. Mappings are shared between all users of the same file, so that emulated links
+ * replaying the same file use a single copy in the page cache.
+ */
+class MappedFile
+{
+public:
+  MappedFile(const std::string& filename, bool populate)
+  {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+      throw CannotOpenFile(ERS_HERE, filename);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      ::close(fd);
+      throw CannotOpenFile(ERS_HERE, filename);
+    }
+    m_size = file_stat.st_size;
+    if (m_size > 0) {
+      void* memory = mmap(nullptr, m_size, PROT_READ, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+      if (memory == MAP_FAILED) {
+        ::close(fd);
+        throw CannotOpenFile(ERS_HERE, filename);
+      }
+      m_data = static_cast<const std::uint8_t*>(memory); // NOLINT(build/unsigned)
+      madvise(memory, m_size, MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after closing the descriptor
+    ::close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if (m_data != nullptr) {
+      munmap(const_cast<std::uint8_t*>(m_data), m_size); // NOLINT(build/unsigned)
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  //! Mapping of the file, shared with the other users of the same file. A populated mapping is requested if any of
+  //! the users asks for one.
+  static std::shared_ptr<const MappedFile> get(const std::string& filename, bool populate)
+  {
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::weak_ptr<MappedFile>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto mapped = registry[filename].lock();
+    if (!mapped) {
+      mapped = std::make_shared<MappedFile>(filename, populate);
+      registry[filename] = mapped;
+    } else if (populate && mapped->m_data != nullptr) {
+      madvise(const_cast<std::uint8_t*>(mapped->m_data), mapped->m_size, MADV_WILLNEED); // NOLINT(build/unsigned)
+    }
+    return mapped;
+  }
+
+  const std::uint8_t* data() const { return m_data; } // NOLINT(build/unsigned)
+  std::size_t size() const { return m_size; }
+
+private:
+  const std::uint8_t* m_data = nullptr; // NOLINT(build/unsigned)
+  std::size_t m_size = 0;
+};
+
 class FileSourceBuffer
 {
 public:
@@ -38,21 +111,17 @@ public:
   FileSourceBuffer(FileSourceBuffer&&) = delete;                 ///< FileSourceBuffer is not move-constructible
   FileSourceBuffer& operator=(FileSourceBuffer&&) = delete;      ///< FileSourceBuffer is not move-assignable
 
-  void read(const std::string& sourcefile)
+  void read(const std::string& sourcefile, bool populate = false)
   {
     m_source_filename = sourcefile;
     try {
 
-      // Open file
-      m_rawdata_ifs.open(m_source_filename, std::ios::in | std::ios::binary);
-      if (!m_rawdata_ifs) {
-        throw CannotOpenFile(ERS_HERE, m_source_filename);
-      }
+      // Map file
+      m_mapped_file = MappedFile::get(m_source_filename, populate);
 
       // Check file size
-      m_rawdata_ifs.ignore(std::numeric_limits<std::streamsize>::max());
-      std::streamsize filesize = m_rawdata_ifs.gcount();
-      if (filesize > m_input_limit) { // bigger than configured limit
+      std::size_t filesize = m_mapped_file->size();
+      if (filesize > static_cast<std::size_t>(m_input_limit)) { // bigger than configured limit
         ers::warning(GenericConfigurationError(ERS_HERE, "File size limit exceeded."));
       }
 
@@ -66,13 +135,7 @@ public:
         m_element_count = filesize / m_chunk_size;
         TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available elements: " << std::to_string(m_element_count);
       }
-
-      // Read file into input buffer
-      m_rawdata_ifs.seekg(0, std::ios::beg);
-      m_input_buffer.reserve(filesize);
-      m_input_buffer.insert(
-        m_input_buffer.begin(), std::istreambuf_iterator<char>(m_rawdata_ifs), std::istreambuf_iterator<char>());
-      TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available bytes " << std::to_string(m_input_buffer.size());
+      TLOG_DEBUG(TLVL_BOOKKEEPING) << "Available bytes " << std::to_string(filesize);
 
     } catch (const std::exception& ex) {
       throw GenericConfigurationError(ERS_HERE, "Cannot read file: " + m_source_filename, ex.what());
@@ -81,11 +144,14 @@ public:
 
   const int& num_elements() { return std::ref(m_element_count); }
 
-  std::vector<std::uint8_t>& get() // NOLINT(build/unsigned)
+  //! Start of the file contents, valid as long as this buffer is alive
+  const std::uint8_t* data() const // NOLINT(build/unsigned)
   {
-    return std::ref(m_input_buffer);
+    return m_mapped_file ? m_mapped_file->data() : nullptr;
   }
 
+  std::size_t size() const { return m_mapped_file ? m_mapped_file->size() : 0; }
+
 private:
   // Configuration
   int m_input_limit;
@@ -94,8 +160,7 @@ private:
   std::string m_source_filename;
 
   // Internals
-  std::ifstream m_rawdata_ifs;
-  std::vector<std::uint8_t> m_input_buffer; // NOLINT(build/unsigned)
+  std::shared_ptr<const MappedFile> m_mapped_file;
 };
 
 } // namespace readoutlibs
@@ -0,0 +1,151 @@
+/**
+ * @file LatencyHistogram.hpp Lock-free log-linear histogram for latency percentiles
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_LATENCYHISTOGRAM_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_LATENCYHISTOGRAM_HPP_
+
+#include <folly/lang/Align.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** LatencyHistogram usage:
+ *
+ *  LatencyHistogram hist;
+ *  hist.record(took_ns);              // from any thread
+ *  auto summary = hist.collect();     // from the monitoring thread, resets the counts
+ *  summary.p99;
+ */
+/** NOTES:
+    Values are sorted into log-linear buckets like in HDR histograms: values below sub_buckets are exact, above
+    that every power of two is divided into sub_buckets buckets, which bounds the relative error of the reported
+    percentiles to 1/sub_buckets. Writers are spread over cache line aligned shards by thread, so record() is a
+    relaxed increment on a mostly thread private cache line.
+ */
+class LatencyHistogram
+{
+public:
+  using value_t = std::uint64_t; // NOLINT(build/unsigned)
+
+  static constexpr std::size_t sub_bucket_bits = 4;
+  static constexpr std::size_t sub_buckets = 1 << sub_bucket_bits;
+  static constexpr std::size_t max_exponent = 40;
+  static constexpr std::size_t num_buckets = (max_exponent - sub_bucket_bits + 2) * sub_buckets;
+  static constexpr std::size_t num_shards = 4;
+
+  struct Summary
+  {
+    value_t count = 0;
+    value_t p50 = 0;
+    value_t p99 = 0;
+    value_t p999 = 0;
+    value_t max = 0;
+  };
+
+  void record(value_t value)
+  {
+    auto& shard = m_shards[shard_index()];
+    shard.buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    auto current_max = shard.max.load(std::memory_order_relaxed);
+    while (value > current_max && !shard.max.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  //! Compute the percentiles of the values recorded since the last call and reset the histogram
+  Summary collect()
+  {
+    std::array<value_t, num_buckets> counts{};
+    Summary summary;
+    for (auto& shard : m_shards) {
+      for (std::size_t i = 0; i < num_buckets; ++i) {
+        auto count = shard.buckets[i].exchange(0, std::memory_order_relaxed);
+        counts[i] += count;
+        summary.count += count;
+      }
+      summary.max = std::max(summary.max, shard.max.exchange(0, std::memory_order_relaxed));
+    }
+    if (summary.count == 0) {
+      return summary;
+    }
+
+    // Ceiling of the rank, so that p999 of few values is the largest one
+    value_t rank_p50 = (summary.count * 500 + 999) / 1000;
+    value_t rank_p99 = (summary.count * 990 + 999) / 1000;
+    value_t rank_p999 = (summary.count * 999 + 999) / 1000;
+    value_t seen = 0;
+    for (std::size_t i = 0; i < num_buckets && seen < rank_p999; ++i) {
+      if (counts[i] == 0) {
+        continue;
+      }
+      auto value = std::min(bucket_upper_bound(i), summary.max);
+      if (seen < rank_p50 && seen + counts[i] >= rank_p50) {
+        summary.p50 = value;
+      }
+      if (seen < rank_p99 && seen + counts[i] >= rank_p99) {
+        summary.p99 = value;
+      }
+      seen += counts[i];
+      if (seen >= rank_p999) {
+        summary.p999 = value;
+      }
+    }
+    return summary;
+  }
+
+  static std::size_t bucket_index(value_t value)
+  {
+    if (value < sub_buckets) {
+      return value;
+    }
+    std::size_t exponent = 63 - __builtin_clzll(value);
+    if (exponent > max_exponent) {
+      return num_buckets - 1;
+    }
+    std::size_t mantissa = (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+    return (exponent - sub_bucket_bits + 1) * sub_buckets + mantissa;
+  }
+
+  //! Largest value that falls into the given bucket
+  static value_t bucket_upper_bound(std::size_t index)
+  {
+    if (index < sub_buckets) {
+      return index;
+    }
+    std::size_t exponent = index / sub_buckets + sub_bucket_bits - 1;
+    value_t mantissa = index % sub_buckets;
+    value_t lower = (value_t(1) << exponent) + (mantissa << (exponent - sub_bucket_bits));
+    return lower + (value_t(1) << (exponent - sub_bucket_bits)) - 1;
+  }
+
+private:
+  static std::size_t shard_index()
+  {
+    static thread_local const std::size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % num_shards;
+    return index;
+  }
+
+  struct alignas(folly::hardware_destructive_interference_size) Shard
+  {
+    std::array<std::atomic<value_t>, num_buckets> buckets{};
+    std::atomic<value_t> max{ 0 };
+  };
+
+  std::array<Shard, num_shards> m_shards;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_LATENCYHISTOGRAM_HPP_
@@ -0,0 +1,220 @@
+/**
+ * @file PostprocessExecutor.hpp Shared pool of core pinned, work stealing threads running postprocess tasks
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_POSTPROCESSEXECUTOR_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_POSTPROCESSEXECUTOR_HPP_
+
+#include "readoutlibs/utils/ThreadAffinity.hpp"
+
+#include <folly/lang/Align.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** PostprocessExecutor usage:
+ *
+ *  struct Drain : PostprocessExecutor::Runnable {
+ *    void run(PostprocessExecutor& executor) override { ... executor.submit(this) if there is work left ... }
+ *  };
+ *  auto executor = PostprocessExecutor::get(4, { 2, 3, 4, 5 });
+ *  executor->submit(&drain);
+ */
+/** NOTES:
+    Every worker has its own run queue. Runnables submitted from a worker go to its own queue, others are spread
+    round robin. A worker without work steals from the back of the other queues, spins for spin_time and then parks
+    on a futex until new work is submitted. The executor only schedules runnables, ordering and lifetime guarantees
+    are up to them: a runnable has to stay alive until it stopped resubmitting itself and its last run returned.
+ */
+class PostprocessExecutor
+{
+public:
+  struct Runnable
+  {
+    virtual ~Runnable() = default;
+    virtual void run(PostprocessExecutor& executor) = 0;
+  };
+
+  /**
+   * @param num_threads The number of worker threads.
+   * @param cpus The CPUs to pin the workers to, worker i runs on cpus[i % cpus.size()]. Unpinned if empty.
+   * @param spin_time How long an idle worker keeps looking for work before it parks.
+   */
+  PostprocessExecutor(std::size_t num_threads,
+                      const std::vector<int>& cpus,
+                      std::chrono::microseconds spin_time = std::chrono::microseconds(50))
+    : m_spin_time(spin_time)
+    , m_workers(std::max<std::size_t>(num_threads, 1))
+  {
+    for (std::size_t i = 0; i < m_workers.size(); ++i) {
+      m_threads.emplace_back(&PostprocessExecutor::run_worker, this, i);
+      std::string name = "postprocess-" + std::to_string(i);
+      pthread_setname_np(m_threads.back().native_handle(), name.c_str());
+      if (!cpus.empty() && !set_thread_affinity(m_threads.back().native_handle(), { cpus[i % cpus.size()] })) {
+        m_pinned = false;
+      }
+    }
+  }
+
+  ~PostprocessExecutor()
+  {
+    m_stop.store(true);
+    wake(m_threads.size());
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  PostprocessExecutor(const PostprocessExecutor&) = delete;
+  PostprocessExecutor& operator=(const PostprocessExecutor&) = delete;
+
+  //! The executor shared by all processors of the process, created by its first user
+  static std::shared_ptr<PostprocessExecutor> get(std::size_t num_threads,
+                                                  const std::vector<int>& cpus,
+                                                  std::chrono::microseconds spin_time = std::chrono::microseconds(50))
+  {
+    static std::mutex instance_mutex;
+    static std::weak_ptr<PostprocessExecutor> instance;
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    auto executor = instance.lock();
+    if (!executor) {
+      executor = std::make_shared<PostprocessExecutor>(num_threads, cpus, spin_time);
+      instance = executor;
+    }
+    return executor;
+  }
+
+  void submit(Runnable* runnable)
+  {
+    std::size_t index = (tl_executor == this) ? tl_worker_index : m_next_worker.fetch_add(1) % m_workers.size();
+    {
+      std::lock_guard<std::mutex> lock(m_workers[index].mutex);
+      m_workers[index].queue.push_back(runnable);
+    }
+    if (m_num_parked.load() > 0) {
+      wake(1);
+    }
+  }
+
+  std::size_t num_threads() const { return m_workers.size(); }
+
+  //! False if a worker could not be pinned to its CPU
+  bool pinned() const { return m_pinned; }
+
+  //! Number of runnables taken from the queue of another worker
+  std::uint64_t steals() const { return m_steals.load(std::memory_order_relaxed); } // NOLINT(build/unsigned)
+
+private:
+  struct alignas(folly::hardware_destructive_interference_size) Worker
+  {
+    std::mutex mutex;
+    std::deque<Runnable*> queue;
+  };
+
+  Runnable* take(std::size_t index)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_workers[index].mutex);
+      if (!m_workers[index].queue.empty()) {
+        Runnable* runnable = m_workers[index].queue.front();
+        m_workers[index].queue.pop_front();
+        return runnable;
+      }
+    }
+    for (std::size_t i = 1; i < m_workers.size(); ++i) {
+      auto& victim = m_workers[(index + i) % m_workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.queue.empty()) {
+        Runnable* runnable = victim.queue.back();
+        victim.queue.pop_back();
+        m_steals.fetch_add(1, std::memory_order_relaxed);
+        return runnable;
+      }
+    }
+    return nullptr;
+  }
+
+  void run_worker(std::size_t index)
+  {
+    tl_executor = this;
+    tl_worker_index = index;
+    auto idle_since = std::chrono::steady_clock::now();
+    while (!m_stop.load()) {
+      if (Runnable* runnable = take(index)) {
+        runnable->run(*this);
+        idle_since = std::chrono::steady_clock::now();
+        continue;
+      }
+      if (std::chrono::steady_clock::now() - idle_since < m_spin_time) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        continue;
+      }
+      park(index);
+      idle_since = std::chrono::steady_clock::now();
+    }
+  }
+
+  void park(std::size_t index)
+  {
+    std::uint32_t epoch = m_wake_epoch.load(); // NOLINT(build/unsigned)
+    m_num_parked.fetch_add(1);
+    // Recheck after announcing the park, a submit that did not see it has already queued its runnable
+    Runnable* runnable = take(index);
+    if (runnable == nullptr && !m_stop.load()) {
+      // The timeout only guards against lost wake ups, regular wake ups come from submit
+      timespec timeout{ 0, 10000000 };
+      syscall(SYS_futex, &m_wake_epoch, FUTEX_WAIT_PRIVATE, epoch, &timeout, nullptr, 0);
+    }
+    m_num_parked.fetch_sub(1);
+    if (runnable != nullptr) {
+      runnable->run(*this);
+    }
+  }
+
+  void wake(std::size_t count)
+  {
+    m_wake_epoch.fetch_add(1);
+    syscall(SYS_futex, &m_wake_epoch, FUTEX_WAKE_PRIVATE, static_cast<int>(count), nullptr, nullptr, 0);
+  }
+
+  static inline thread_local PostprocessExecutor* tl_executor = nullptr;
+  static inline thread_local std::size_t tl_worker_index = 0;
+
+  std::chrono::microseconds m_spin_time;
+  std::vector<Worker> m_workers;
+  std::vector<std::thread> m_threads;
+  std::atomic<std::size_t> m_next_worker{ 0 };
+  std::atomic<std::uint32_t> m_wake_epoch{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<int> m_num_parked{ 0 };
+  std::atomic<std::uint64_t> m_steals{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<bool> m_stop{ false };
+  bool m_pinned = true;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_POSTPROCESSEXECUTOR_HPP_
@@ -8,8 +8,11 @@
 #ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_RATELIMITER_HPP_
 #define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_RATELIMITER_HPP_
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <unistd.h>
 
@@ -24,12 +27,20 @@ namespace readoutlibs {
  *    // do work
  *    limiter.limit();
  *  }
+ *
+ *  auto burst_limiter = RateLimiter(10000, 64); // 10MHz, released in bursts of 64 items
+ *  burst_limiter.limit(num_items);              // account for several items at once
+ *  auto stats = burst_limiter.collect_stats();  // from any thread
  */
 /** NOTES:
     This rate limiter is a simple implementation that is intended to be
     used for fast tasks, i.e. tasks that take less or much less time than the
     time intervals (1 / rate) that the RateLimiter is operating with. It doesn't
     work correctly if the tasks take longer than 1 / rate.
+    With a burst size above 1, the clock is only read and the thread only waits once per burst, which allows rates
+    beyond what a per item wait can reach. Waits sleep until shortly before the deadline and spin for the rest; the
+    sleep slack is calibrated from the observed nanosleep overshoot. clock_gettime reads the TSC through the vDSO on
+    systems with an invariant TSC, so it is not read directly.
  */
 class RateLimiter
 {
@@ -40,8 +51,18 @@ public:
   static inline constexpr timestamp_t ms = 1000 * us;
   static inline constexpr timestamp_t s = 1000 * ms;
 
-  explicit RateLimiter(double kilohertz)
+  //! Achieved rate and wake up jitter since the last collection
+  struct Stats
+  {
+    double target_kilohertz = 0;
+    double achieved_kilohertz = 0;
+    timestamp_t mean_jitter = 0; // ns
+    timestamp_t max_jitter = 0;  // ns
+  };
+
+  explicit RateLimiter(double kilohertz, std::size_t burst = 1)
     : m_max_overshoot(10 * ms)
+    , m_burst(std::max<std::size_t>(burst, 1))
   {
     adjust(kilohertz);
     init();
@@ -50,7 +71,9 @@ public:
   void init()
   {
     m_now = gettime();
-    m_deadline = m_now + m_period.load();
+    m_deadline = m_now;
+    m_pending = 0;
+    m_stats_begin.store(m_now);
   }
 
   /** Optionally: adjust rate from another thread
@@ -70,28 +93,39 @@ public:
     m_period.store(static_cast<timestamp_t>((1000.f / m_kilohertz) * static_cast<double>(us)));
   }
 
-  void limit()
+  //! Account for items and wait once a burst of them has been released
+  void limit(std::size_t items = 1)
   {
+    m_items.fetch_add(items, std::memory_order_relaxed);
+    m_pending += items;
+    if (m_pending < m_burst) {
+      return;
+    }
+    m_deadline += m_pending * m_period.load();
+    m_pending = 0;
+
     m_now = gettime();
     if (m_now > m_deadline + m_max_overshoot) {
-      m_deadline = m_now + m_period.load();
-    } else {
-      if (m_now < m_deadline) {
-        if (m_deadline - m_now > 0) {
-          timespec tim;
-          tim.tv_sec = 0;
-          tim.tv_nsec = m_deadline - m_now;
-          // The second argument will be overwritten but we
-          // do not care about this temporary variable
-          nanosleep(&tim, &tim);
-          m_now = gettime();
-        }
-        while (m_now < m_deadline) {
-            m_now = gettime();
-        }
-      }
-      m_deadline += m_period.load();
+      m_deadline = m_now;
+    } else if (m_now < m_deadline) {
+      wait_until_deadline();
+    }
+  }
+
+  Stats collect_stats()
+  {
+    Stats stats;
+    timestamp_t now = gettime();
+    timestamp_t begin = m_stats_begin.exchange(now);
+    auto items = m_items.exchange(0);
+    auto waits = m_waits.exchange(0);
+    stats.target_kilohertz = m_kilohertz.load();
+    if (now > begin) {
+      stats.achieved_kilohertz = static_cast<double>(items) / static_cast<double>(now - begin) * ms;
     }
+    stats.mean_jitter = waits > 0 ? m_jitter_sum.exchange(0) / waits : 0;
+    stats.max_jitter = m_jitter_max.exchange(0);
+    return stats;
   }
 
 protected:
@@ -103,11 +137,55 @@ protected:
   }
 
 private:
+  void wait_until_deadline()
+  {
+    if (m_deadline - m_now > m_sleep_slack) {
+      timestamp_t sleep_for = m_deadline - m_now - m_sleep_slack;
+      timespec tim;
+      tim.tv_sec = sleep_for / s;
+      tim.tv_nsec = sleep_for % s;
+      // The second argument will be overwritten but we
+      // do not care about this temporary variable
+      nanosleep(&tim, &tim);
+      timestamp_t woken = gettime();
+      // Calibrate the slack to the overshoot of the sleep
+      timestamp_t overshoot = woken > m_now + sleep_for ? woken - m_now - sleep_for : 0;
+      m_sleep_slack = std::clamp((7 * m_sleep_slack + overshoot) / 8 + us, min_sleep_slack, max_sleep_slack);
+      m_now = woken;
+    }
+    while (m_now < m_deadline) {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+      m_now = gettime();
+    }
+
+    timestamp_t jitter = m_now - m_deadline;
+    m_waits.fetch_add(1, std::memory_order_relaxed);
+    m_jitter_sum.fetch_add(jitter, std::memory_order_relaxed);
+    timestamp_t current_max = m_jitter_max.load(std::memory_order_relaxed);
+    while (jitter > current_max && !m_jitter_max.compare_exchange_weak(current_max, jitter)) {
+    }
+  }
+
+  static inline constexpr timestamp_t min_sleep_slack = 1 * us;
+  static inline constexpr timestamp_t max_sleep_slack = 2 * ms;
+
   std::atomic<double> m_kilohertz;
   timestamp_t m_max_overshoot;
+  std::size_t m_burst;
   std::atomic<timestamp_t> m_period;
   timestamp_t m_now;
   timestamp_t m_deadline;
+  std::size_t m_pending = 0;
+  timestamp_t m_sleep_slack = 50 * us;
+
+  // Stats
+  std::atomic<timestamp_t> m_stats_begin{ 0 };
+  std::atomic<timestamp_t> m_items{ 0 };
+  std::atomic<timestamp_t> m_waits{ 0 };
+  std::atomic<timestamp_t> m_jitter_sum{ 0 };
+  std::atomic<timestamp_t> m_jitter_max{ 0 };
 };
 
 } // namespace readoutlibs
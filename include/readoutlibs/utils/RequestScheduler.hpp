@@ -0,0 +1,283 @@
+/**
+ * @file RequestScheduler.hpp Thread pool running data requests in the order of a scheduling policy
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_REQUESTSCHEDULER_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_REQUESTSCHEDULER_HPP_
+
+#include "readoutlibs/utils/LatencyHistogram.hpp"
+#include "readoutlibs/utils/ThreadAffinity.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** RequestScheduler usage:
+ *
+ *  RequestScheduler scheduler(4, RequestScheduler::Policy::earliest_deadline);
+ *  auto ticket = scheduler.submit({ trigger_timestamp, window_end - window_begin, destination }, [&]() { handle(); });
+ *  scheduler.rekey(ticket, { earlier_timestamp, wider_window, destination }); // while the job is still queued
+ *  ...
+ *  scheduler.join(); // runs the queued jobs, then stops the threads
+ */
+/** NOTES:
+    The queued jobs are dispatched to the threads in the order of the policy:
+      fifo                in submission order
+      earliest_deadline   lowest deadline (trigger timestamp) first
+      smallest_window     shortest readout window first, so long dumps do not hold back trigger windows
+      destination_fair    round robin over the destinations, in submission order per destination
+    Ties are broken by submission order. The time between submit and dispatch is kept in a histogram.
+    A queued job can be rekeyed when its request changes, e.g. grows by coalescing. The new key takes its position in
+    the order, the old one is dropped lazily when it comes up. Under destination_fair the order only depends on the
+    submission, so rekeying changes nothing.
+    All threads share the given CPUs, so that a burst of requests spreads over the whole set.
+ */
+class RequestScheduler
+{
+public:
+  enum class Policy
+  {
+    fifo,
+    earliest_deadline,
+    smallest_window,
+    destination_fair
+  };
+
+  struct Key
+  {
+    uint64_t deadline;    // NOLINT(build/unsigned)
+    uint64_t window_size; // NOLINT(build/unsigned)
+    std::string destination;
+  };
+
+  using ticket_t = uint64_t; // NOLINT(build/unsigned)
+
+  //! Policy of a configuration string, false if there is none with that name
+  static bool parse_policy(const std::string& name, Policy& policy)
+  {
+    static const std::map<std::string, Policy> policies{ { "fifo", Policy::fifo },
+                                                         { "earliest_deadline", Policy::earliest_deadline },
+                                                         { "smallest_window", Policy::smallest_window },
+                                                         { "destination_fair", Policy::destination_fair } };
+    auto it = policies.find(name);
+    if (it == policies.end()) {
+      return false;
+    }
+    policy = it->second;
+    return true;
+  }
+
+  RequestScheduler(std::size_t num_threads,
+                   Policy policy,
+                   const std::string& name = "request",
+                   const std::vector<int>& cpus = {})
+    : m_policy(policy)
+  {
+    for (std::size_t i = 0; i < std::max<std::size_t>(num_threads, 1); ++i) {
+      m_threads.emplace_back(&RequestScheduler::run, this);
+      std::string thread_name = name + "-" + std::to_string(i);
+      pthread_setname_np(m_threads.back().native_handle(), thread_name.substr(0, 15).c_str());
+      if (!set_thread_affinity(m_threads.back().native_handle(), cpus)) {
+        m_pinned = false;
+      }
+    }
+  }
+
+  ~RequestScheduler() { join(); }
+
+  RequestScheduler(const RequestScheduler&) = delete;
+  RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+  //! Queue a job, the ticket identifies it for rekey
+  ticket_t submit(const Key& key, std::function<void()> job)
+  {
+    ticket_t ticket = 0;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ticket = m_next_sequence++;
+      Entry entry{ priority_of(key), ticket, std::chrono::steady_clock::now(), std::move(job) };
+      if (m_policy == Policy::destination_fair) {
+        auto& queue = m_per_destination[key.destination];
+        if (queue.empty()) {
+          m_destinations.push_back(key.destination);
+        }
+        queue.push_back(std::move(entry));
+      } else {
+        m_ordered.push({ entry.priority, ticket });
+        m_queued.emplace(ticket, std::move(entry));
+      }
+      ++m_depth;
+    }
+    m_cv.notify_one();
+    return ticket;
+  }
+
+  //! Move a queued job to the position of a new key, returns false if it was already dispatched
+  bool rekey(ticket_t ticket, const Key& key)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_policy == Policy::destination_fair) {
+      return true;
+    }
+    auto it = m_queued.find(ticket);
+    if (it == m_queued.end()) {
+      return false;
+    }
+    auto priority = priority_of(key);
+    if (priority != it->second.priority) {
+      it->second.priority = priority;
+      m_ordered.push({ priority, ticket });
+    }
+    return true;
+  }
+
+  //! Wait until all submitted jobs ran, then stop the threads
+  void join()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto& thread : m_threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+
+  //! Number of submitted jobs that were not dispatched yet
+  std::size_t depth()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_depth;
+  }
+
+  //! False if a thread could not be pinned to the CPUs
+  bool pinned() const { return m_pinned; }
+
+  //! Time between submit and dispatch in ns, resets the histogram
+  LatencyHistogram::Summary collect_dispatch_wait() { return m_dispatch_wait.collect(); }
+
+private:
+  struct Entry
+  {
+    uint64_t priority; // NOLINT(build/unsigned)
+    uint64_t sequence; // NOLINT(build/unsigned)
+    std::chrono::steady_clock::time_point submitted;
+    std::function<void()> job;
+  };
+
+  // Position of a queued job in the order, outdated by a rekey if the priority doesn't match the job's anymore
+  struct Position
+  {
+    uint64_t priority; // NOLINT(build/unsigned)
+    uint64_t sequence; // NOLINT(build/unsigned)
+  };
+
+  struct LaterPosition
+  {
+    bool operator()(const Position& left, const Position& right) const
+    {
+      return left.priority != right.priority ? left.priority > right.priority : left.sequence > right.sequence;
+    }
+  };
+
+  uint64_t priority_of(const Key& key) const // NOLINT(build/unsigned)
+  {
+    if (m_policy == Policy::earliest_deadline) {
+      return key.deadline;
+    } else if (m_policy == Policy::smallest_window) {
+      return key.window_size;
+    }
+    return 0;
+  }
+
+  // The mutex has to be held and a job has to be queued
+  Entry take()
+  {
+    Entry entry;
+    if (m_policy == Policy::destination_fair) {
+      auto destination = std::move(m_destinations.front());
+      m_destinations.pop_front();
+      auto& queue = m_per_destination[destination];
+      entry = std::move(queue.front());
+      queue.pop_front();
+      if (queue.empty()) {
+        m_per_destination.erase(destination);
+      } else {
+        m_destinations.push_back(std::move(destination));
+      }
+    } else {
+      while (true) {
+        Position position = m_ordered.top();
+        m_ordered.pop();
+        auto it = m_queued.find(position.sequence);
+        if (it != m_queued.end() && it->second.priority == position.priority) {
+          entry = std::move(it->second);
+          m_queued.erase(it);
+          break;
+        }
+      }
+    }
+    --m_depth;
+    return entry;
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_cv.wait(lock, [&]() { return m_depth > 0 || m_stop; });
+      if (m_depth == 0) {
+        return;
+      }
+      Entry entry = take();
+      lock.unlock();
+      m_dispatch_wait.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - entry.submitted)
+          .count());
+      entry.job();
+      lock.lock();
+    }
+  }
+
+  const Policy m_policy;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::priority_queue<Position, std::vector<Position>, LaterPosition> m_ordered;
+  std::unordered_map<uint64_t, Entry> m_queued; // NOLINT(build/unsigned)
+  std::map<std::string, std::deque<Entry>> m_per_destination;
+  std::deque<std::string> m_destinations;
+  std::size_t m_depth = 0;
+  uint64_t m_next_sequence = 0; // NOLINT(build/unsigned)
+  bool m_stop = false;
+  bool m_pinned = true;
+  LatencyHistogram m_dispatch_wait;
+  std::vector<std::thread> m_threads;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_REQUESTSCHEDULER_HPP_
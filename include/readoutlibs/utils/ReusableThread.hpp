@@ -11,6 +11,8 @@
 #ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_REUSABLETHREAD_HPP_
 #define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_REUSABLETHREAD_HPP_
 
+#include "readoutlibs/utils/ThreadAffinity.hpp"
+
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -18,6 +20,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 namespace dunedaq {
 namespace readoutlibs {
@@ -68,6 +71,9 @@ public:
     pthread_setname_np(handle, tname);
   }
 
+  // Restrict the pthread handle to the given CPUs, unpinned if empty. Returns false if the affinity was not set.
+  bool set_cpus(const std::vector<int>& cpus) { return set_thread_affinity(m_thread.native_handle(), cpus); }
+
   // Check for completed task execution
   bool get_readiness() const { return m_task_executed; }
 
@@ -0,0 +1,130 @@
+/**
+ * @file ShardedCounter.hpp Per-thread, cache line padded 64 bit counters for the operational monitoring
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_SHARDEDCOUNTER_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_SHARDEDCOUNTER_HPP_
+
+#include <folly/lang/Align.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace readoutlibs {
+
+/** ShardedCounter usage:
+ *
+ *  ShardedCounter packets;
+ *  ++packets;                             // from any thread
+ *  packets += batch_size;
+ *  auto total = packets.total();          // from the monitoring thread
+ *  auto collected = packets.collect();    // increments since the last collect and their rate
+ *  collected.delta; collected.rate;
+ */
+/** NOTES:
+    Every thread increments its own cache line aligned shard with a relaxed add, so counters updated per payload
+    or per request by different threads don't false share with each other or with the fields read by get_info.
+    Threads get their shard round robin in the order they first touch any counter, threads beyond num_shards share
+    shards, which is still correct. collect() and total() only read the shards, 64 bits don't wrap around over a
+    run. Only one thread should collect, and reset() is meant for start(), before the incrementing threads run.
+ */
+class ShardedCounter
+{
+public:
+  using value_t = std::uint64_t; // NOLINT(build/unsigned)
+  using clock_t = std::chrono::steady_clock;
+
+  static constexpr std::size_t num_shards = 8;
+
+  struct Collected
+  {
+    value_t delta = 0;
+    double rate = 0.; // increments per second since the last collect
+  };
+
+  ShardedCounter()
+    : m_last_collect(clock_t::now().time_since_epoch().count())
+  {}
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  void add(value_t amount) { m_shards[shard_index()].value.fetch_add(amount, std::memory_order_relaxed); }
+
+  ShardedCounter& operator++()
+  {
+    add(1);
+    return *this;
+  }
+
+  ShardedCounter& operator+=(value_t amount)
+  {
+    add(amount);
+    return *this;
+  }
+
+  //! Sum of all increments since the last reset
+  value_t total() const
+  {
+    value_t sum = 0;
+    for (auto& shard : m_shards) {
+      sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  //! Increments since the last call and their rate, the counter keeps its total
+  Collected collect(clock_t::time_point now = clock_t::now())
+  {
+    Collected collected;
+    value_t sum = total();
+    value_t last = m_collected.exchange(sum, std::memory_order_relaxed);
+    // A reset in between restarts the count from zero
+    collected.delta = sum >= last ? sum - last : sum;
+    auto last_collect = clock_t::time_point(
+      clock_t::duration(m_last_collect.exchange(now.time_since_epoch().count(), std::memory_order_relaxed)));
+    double seconds = std::chrono::duration<double>(now - last_collect).count();
+    collected.rate = seconds > 0 ? collected.delta / seconds : 0.;
+    return collected;
+  }
+
+  void reset()
+  {
+    for (auto& shard : m_shards) {
+      shard.value.store(0, std::memory_order_relaxed);
+    }
+    m_collected.store(0, std::memory_order_relaxed);
+    m_last_collect.store(clock_t::now().time_since_epoch().count(), std::memory_order_relaxed);
+  }
+
+private:
+  static std::size_t shard_index()
+  {
+    static std::atomic<std::size_t> next_index{ 0 };
+    static thread_local const std::size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % num_shards;
+    return index;
+  }
+
+  struct alignas(folly::hardware_destructive_interference_size) Shard
+  {
+    std::atomic<value_t> value{ 0 };
+  };
+
+  std::array<Shard, num_shards> m_shards;
+
+  // Written by collect() and reset(), away from the shards
+  alignas(folly::hardware_destructive_interference_size) std::atomic<value_t> m_collected{ 0 };
+  std::atomic<clock_t::rep> m_last_collect;
+};
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_SHARDEDCOUNTER_HPP_
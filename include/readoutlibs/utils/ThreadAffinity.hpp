@@ -0,0 +1,61 @@
+/**
+ * @file ThreadAffinity.hpp Helpers to pin threads to CPUs and to find the NUMA node of a CPU
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_THREADAFFINITY_HPP_
+#define READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_THREADAFFINITY_HPP_
+
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef WITH_LIBNUMA_SUPPORT
+#include <numa.h>
+#endif
+
+namespace dunedaq {
+namespace readoutlibs {
+
+//! Restrict the thread to the given CPUs, it stays unpinned if the list is empty.
+//! Returns false if the list holds an invalid CPU or the affinity could not be set.
+inline bool
+set_thread_affinity(std::thread::native_handle_type handle, const std::vector<int>& cpus)
+{
+  if (cpus.empty()) {
+    return true;
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return false;
+    }
+    CPU_SET(cpu, &cpuset);
+  }
+  return pthread_setaffinity_np(handle, sizeof(cpu_set_t), &cpuset) == 0;
+}
+
+//! NUMA node of the CPU, -1 if it is not known or the program was built without libnuma
+inline int
+numa_node_of_cpu_id(int cpu)
+{
+#ifdef WITH_LIBNUMA_SUPPORT
+  if (numa_available() < 0) {
+    return -1;
+  }
+  return numa_node_of_cpu(cpu);
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+} // namespace readoutlibs
+} // namespace dunedaq
+
+#endif // READOUTLIBS_INCLUDE_READOUTLIBS_UTILS_THREADAFFINITY_HPP_
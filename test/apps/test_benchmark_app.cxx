@@ -0,0 +1,499 @@
+/**
+ * @file test_benchmark_app.cxx Benchmarks of the latency buffers and the request handling, with the results
+ * written as JSON in the layout of the google benchmark output
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "readoutlibs/FrameErrorRegistry.hpp"
+#include "readoutlibs/ReadoutTypes.hpp"
+#include "readoutlibs/models/BinarySearchQueueModel.hpp"
+#include "readoutlibs/models/DefaultRequestHandlerModel.hpp"
+#include "readoutlibs/models/FixedRateQueueModel.hpp"
+#include "readoutlibs/models/SkipListLatencyBufferModel.hpp"
+#include "readoutlibs/readoutconfig/Nljs.hpp"
+#include "readoutlibs/utils/LatencyHistogram.hpp"
+#include "readoutlibs/utils/RateLimiter.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace dunedaq::readoutlibs;
+
+namespace {
+
+constexpr uint64_t tick_difference = 25; // NOLINT(build/unsigned)
+// Each latency buffer holds about this many bytes of elements
+constexpr size_t buffer_bytes = 256 << 20;
+constexpr size_t num_search_keys = 4096;
+// Keeps the search results from being optimised away
+volatile uint64_t search_sink = 0; // NOLINT(build/unsigned)
+// Benchmarks that time only a part of each round stop after this multiple of the minimum time
+constexpr double max_wall_time_factor = 10.0;
+
+// Request windows cover this many frames and end this many frames before the newest one
+constexpr size_t request_window_frames = 1000;
+constexpr size_t request_delay_frames = 10000;
+// Ingest rate of the request benchmarks, in frames
+constexpr double ingest_rate_khz = 2000.0;
+
+/**
+ * Latency buffer element made of consecutive dummy frames, a single frame or a superchunk of several frames
+ */
+template<size_t NumFrames>
+struct BenchmarkElement
+{
+  using FrameType = types::DUMMY_FRAME_STRUCT;
+
+  FrameType frames[NumFrames];
+
+  bool operator<(const BenchmarkElement& other) const { return get_first_timestamp() < other.get_first_timestamp(); }
+
+  uint64_t get_first_timestamp() const { return frames[0].get_timestamp(); } // NOLINT(build/unsigned)
+
+  void set_first_timestamp(uint64_t ts) { frames[0].set_timestamp(ts); } // NOLINT(build/unsigned)
+
+  void fake_timestamps(uint64_t first_timestamp) // NOLINT(build/unsigned)
+  {
+    for (size_t i = 0; i < NumFrames; ++i) {
+      frames[i].set_timestamp(first_timestamp + i * tick_difference);
+    }
+  }
+
+  size_t get_payload_size() const { return sizeof(frames); }
+  size_t get_num_frames() const { return NumFrames; }
+  size_t get_frame_size() const { return sizeof(FrameType); }
+
+  FrameType* begin() { return &frames[0]; }
+  FrameType* end() { return &frames[NumFrames]; }
+
+  static const constexpr dunedaq::daqdataformats::GeoID::SystemType system_type =
+    dunedaq::daqdataformats::GeoID::SystemType::kTPC;
+  static const constexpr dunedaq::daqdataformats::FragmentType fragment_type =
+    dunedaq::daqdataformats::FragmentType::kUnknown;
+  static const constexpr uint64_t expected_tick_difference = tick_difference; // NOLINT(build/unsigned)
+  static const constexpr size_t frames_per_element = NumFrames;
+};
+
+using SingleFrame = BenchmarkElement<1>;
+using Superchunk = BenchmarkElement<12>;
+
+//! Request handler with the data request exposed, so that requests can be timed without queues
+template<class ReadoutType, class LatencyBufferType>
+class BenchmarkRequestHandler : public DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>
+{
+public:
+  using DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>::DefaultRequestHandlerModel;
+  using DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>::data_request;
+};
+
+/**
+ * Timestamps of consecutive elements. With a gap rate, the given fraction of the elements is missing.
+ */
+class TimestampSequence
+{
+public:
+  explicit TimestampSequence(double gap_rate)
+    : m_gap_rate(gap_rate)
+    , m_random(4242)
+  {}
+
+  uint64_t next(size_t num_frames) // NOLINT(build/unsigned)
+  {
+    uint64_t element_ticks = num_frames * tick_difference; // NOLINT(build/unsigned)
+    while (m_gap_rate > 0.0 && m_uniform(m_random) < m_gap_rate) {
+      m_timestamp += element_ticks;
+    }
+    uint64_t timestamp = m_timestamp; // NOLINT(build/unsigned)
+    m_timestamp += element_ticks;
+    return timestamp;
+  }
+
+private:
+  double m_gap_rate;
+  uint64_t m_timestamp = tick_difference; // NOLINT(build/unsigned)
+  std::mt19937_64 m_random;
+  std::uniform_real_distribution<double> m_uniform{ 0.0, 1.0 };
+};
+
+struct Measurement
+{
+  size_t iterations = 0;
+  double seconds = 0.0;
+  std::map<std::string, double> counters;
+};
+
+struct Options
+{
+  std::string output_file;
+  std::string filter;
+  int repetitions = 3;
+  double min_seconds = 0.5;
+};
+
+/**
+ * Runs the benchmarks matching the filter and collects one entry per repetition and the median of the repetitions
+ */
+class BenchmarkSuite
+{
+public:
+  explicit BenchmarkSuite(const Options& options)
+    : m_options(options)
+  {}
+
+  void run(const std::string& name, const std::function<Measurement(double)>& benchmark)
+  {
+    if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos) {
+      return;
+    }
+    std::vector<double> times;
+    for (int repetition = 0; repetition < m_options.repetitions; ++repetition) {
+      Measurement measurement = benchmark(m_options.min_seconds);
+      double ns_per_iteration = measurement.iterations == 0 ? 0.0 : measurement.seconds * 1e9 / measurement.iterations;
+      times.push_back(ns_per_iteration);
+      nlohmann::json entry = { { "name", name },
+                               { "run_name", name },
+                               { "run_type", "iteration" },
+                               { "repetitions", m_options.repetitions },
+                               { "repetition_index", repetition },
+                               { "iterations", measurement.iterations },
+                               { "real_time", ns_per_iteration },
+                               { "time_unit", "ns" } };
+      for (auto& counter : measurement.counters) {
+        entry[counter.first] = counter.second;
+      }
+      m_results.push_back(entry);
+    }
+    std::sort(times.begin(), times.end());
+    m_results.push_back({ { "name", name + "_median" },
+                          { "run_name", name },
+                          { "run_type", "aggregate" },
+                          { "aggregate_name", "median" },
+                          { "repetitions", m_options.repetitions },
+                          { "real_time", times[times.size() / 2] },
+                          { "time_unit", "ns" } });
+    TLOG() << name << ": " << times[times.size() / 2] << " ns per iteration (median of " << times.size() << ")";
+  }
+
+  nlohmann::json to_json() const
+  {
+    char host_name[256] = {};
+    gethostname(host_name, sizeof(host_name) - 1);
+    char date[64] = {};
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%FT%T%z", std::localtime(&now));
+    nlohmann::json context = { { "date", date },
+                               { "host_name", host_name },
+                               { "executable", "readoutlibs_test_benchmark" },
+                               { "num_cpus", std::thread::hardware_concurrency() },
+                               { "buffer_bytes", buffer_bytes } };
+    return { { "context", context }, { "benchmarks", m_results } };
+  }
+
+private:
+  Options m_options;
+  nlohmann::json m_results = nlohmann::json::array();
+};
+
+double
+seconds_since(std::chrono::steady_clock::time_point begin)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template<class LatencyBufferType>
+std::unique_ptr<LatencyBufferType>
+make_buffer(size_t capacity)
+{
+  if constexpr (std::is_constructible_v<LatencyBufferType, uint32_t>) { // NOLINT(build/unsigned)
+    return std::make_unique<LatencyBufferType>(capacity);
+  } else {
+    return std::make_unique<LatencyBufferType>();
+  }
+}
+
+template<class ReadoutType>
+size_t
+buffer_capacity()
+{
+  return buffer_bytes / sizeof(ReadoutType);
+}
+
+template<class ReadoutType, class LatencyBufferType>
+void
+fill(LatencyBufferType& buffer, size_t count, TimestampSequence& timestamps)
+{
+  auto element = std::make_unique<ReadoutType>();
+  for (size_t i = 0; i < count; ++i) {
+    element->fake_timestamps(timestamps.next(ReadoutType::frames_per_element));
+    buffer.write(ReadoutType(*element));
+  }
+}
+
+// Writes of single elements into an empty buffer, until it is full
+template<class ReadoutType, class LatencyBufferType>
+Measurement
+write_benchmark(double min_seconds)
+{
+  const size_t capacity = buffer_capacity<ReadoutType>();
+  auto buffer = make_buffer<LatencyBufferType>(capacity);
+  TimestampSequence timestamps(0.0);
+  auto element = std::make_unique<ReadoutType>();
+  Measurement measurement;
+  while (measurement.seconds < min_seconds) {
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i + 1 < capacity; ++i) {
+      element->fake_timestamps(timestamps.next(ReadoutType::frames_per_element));
+      buffer->write(ReadoutType(*element));
+    }
+    measurement.seconds += seconds_since(begin);
+    measurement.iterations += capacity - 1;
+    buffer->flush();
+  }
+  measurement.counters["bytes_per_second"] = measurement.iterations * sizeof(ReadoutType) / measurement.seconds;
+  return measurement;
+}
+
+// Searches of random timestamps in a buffer filled up to the given fraction of its capacity
+template<class ReadoutType, class LatencyBufferType>
+Measurement
+lower_bound_benchmark(double min_seconds, double occupancy, double gap_rate)
+{
+  const size_t capacity = buffer_capacity<ReadoutType>();
+  auto buffer = make_buffer<LatencyBufferType>(capacity);
+  TimestampSequence timestamps(gap_rate);
+  fill<ReadoutType>(*buffer, std::max<size_t>(occupancy * (capacity - 1), 1), timestamps);
+
+  uint64_t oldest = buffer->front()->get_first_timestamp(); // NOLINT(build/unsigned)
+  uint64_t newest = buffer->back()->get_first_timestamp();  // NOLINT(build/unsigned)
+  std::mt19937_64 random(4242);
+  std::uniform_int_distribution<uint64_t> distribution(oldest, newest); // NOLINT(build/unsigned)
+  std::vector<uint64_t> keys(num_search_keys);                         // NOLINT(build/unsigned)
+  for (auto& key : keys) {
+    key = distribution(random);
+  }
+
+  ReadoutType key;
+  uint64_t checksum = 0; // NOLINT(build/unsigned)
+  Measurement measurement;
+  while (measurement.seconds < min_seconds) {
+    auto begin = std::chrono::steady_clock::now();
+    for (auto timestamp : keys) {
+      key.set_first_timestamp(timestamp);
+      auto it = buffer->lower_bound(key, gap_rate > 0.0);
+      if (it.good()) {
+        checksum += it->get_first_timestamp();
+      }
+    }
+    measurement.seconds += seconds_since(begin);
+    measurement.iterations += keys.size();
+  }
+  search_sink = checksum;
+  measurement.counters["occupancy"] = buffer->occupancy();
+  return measurement;
+}
+
+// Pops of the oldest elements in batches of a tenth of the capacity, as done by the request handler cleanup
+template<class ReadoutType, class LatencyBufferType>
+Measurement
+cleanup_benchmark(double min_seconds)
+{
+  const size_t capacity = buffer_capacity<ReadoutType>();
+  const size_t batch = std::max<size_t>(capacity / 10, 1);
+  auto buffer = make_buffer<LatencyBufferType>(capacity);
+  TimestampSequence timestamps(0.0);
+  Measurement measurement;
+  auto wall_begin = std::chrono::steady_clock::now();
+  while (measurement.seconds < min_seconds && seconds_since(wall_begin) < max_wall_time_factor * min_seconds) {
+    fill<ReadoutType>(*buffer, capacity - 1 - buffer->occupancy(), timestamps);
+    auto begin = std::chrono::steady_clock::now();
+    buffer->pop(batch);
+    measurement.seconds += seconds_since(begin);
+    measurement.iterations += batch;
+  }
+  return measurement;
+}
+
+// Data requests answered by the request handler while a producer writes into the buffer and triggers its cleanups,
+// either occupancy driven or by evicting the data older than the retention time after every write
+// The requests read elements while the producer pops, which is only defined for buffers that implement the pins
+template<class ReadoutType, class LatencyBufferType>
+Measurement
+request_benchmark(double min_seconds, bool retention)
+{
+  const size_t capacity = buffer_capacity<ReadoutType>();
+  std::unique_ptr<LatencyBufferType> buffer = make_buffer<LatencyBufferType>(capacity);
+  std::unique_ptr<FrameErrorRegistry> error_registry = std::make_unique<FrameErrorRegistry>();
+  using Handler = BenchmarkRequestHandler<ReadoutType, LatencyBufferType>;
+  Handler handler(buffer, error_registry);
+
+  readoutconfig::RequestHandlerConf conf;
+  conf.latency_buffer_size = capacity;
+  conf.pop_limit_pct = 0.8;
+  conf.pop_size_pct = 0.1;
+  conf.num_request_handling_threads = 1;
+  conf.request_scheduling_policy = "fifo";
+  conf.enable_raw_recording = false;
+  conf.cleanup_mode = retention ? "retention" : "occupancy";
+  conf.retention_ticks = capacity * 3 / 4 * ReadoutType::frames_per_element * tick_difference;
+  conf.retention_eviction_step = 64;
+  nlohmann::json args;
+  args["requesthandlerconf"] = conf;
+  handler.conf(args);
+
+  std::atomic<bool> producing{ true };
+  std::atomic<size_t> written{ 0 };
+  TimestampSequence timestamps(0.0);
+  fill<ReadoutType>(*buffer, capacity / 2, timestamps);
+  std::thread producer([&]() {
+    RateLimiter limiter(ingest_rate_khz / ReadoutType::frames_per_element, 64);
+    auto element = std::make_unique<ReadoutType>();
+    while (producing.load()) {
+      element->fake_timestamps(timestamps.next(ReadoutType::frames_per_element));
+      buffer->write(ReadoutType(*element));
+      if (retention) {
+        handler.notify_new_data(element->get_first_timestamp());
+      } else {
+        handler.cleanup_check();
+      }
+      ++written;
+      limiter.limit();
+    }
+  });
+
+  LatencyHistogram latencies;
+  size_t found = 0;
+  size_t occupancy_sum = 0;
+  uint64_t trigger_number = 0; // NOLINT(build/unsigned)
+  Measurement measurement;
+  auto begin = std::chrono::steady_clock::now();
+  while (seconds_since(begin) < min_seconds) {
+    dunedaq::dfmessages::DataRequest request;
+    uint64_t newest = buffer->back()->get_first_timestamp(); // NOLINT(build/unsigned)
+    request.trigger_number = ++trigger_number;
+    request.request_information.window_end = newest - request_delay_frames * tick_difference;
+    request.request_information.window_begin =
+      request.request_information.window_end - request_window_frames * tick_difference;
+    request.trigger_timestamp = request.request_information.window_begin;
+    request.data_destination = "benchmark";
+
+    auto t_request_begin = std::chrono::steady_clock::now();
+    auto result = handler.data_request(request);
+    result.fragment.reset();
+    latencies.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_request_begin)
+        .count());
+    if (result.result_code == Handler::ResultCode::kFound) {
+      ++found;
+    }
+    occupancy_sum += buffer->occupancy();
+    ++measurement.iterations;
+  }
+  measurement.seconds = seconds_since(begin);
+  producing.store(false);
+  producer.join();
+
+  auto summary = latencies.collect();
+  measurement.counters["latency_p50_ns"] = summary.p50;
+  measurement.counters["latency_p99_ns"] = summary.p99;
+  measurement.counters["latency_p999_ns"] = summary.p999;
+  measurement.counters["latency_max_ns"] = summary.max;
+  measurement.counters["found_fraction"] = static_cast<double>(found) / std::max<size_t>(measurement.iterations, 1);
+  measurement.counters["ingest_elements_per_second"] = written.load() / measurement.seconds;
+  measurement.counters["mean_occupancy_fraction"] =
+    static_cast<double>(occupancy_sum) / std::max<size_t>(measurement.iterations, 1) / capacity;
+  return measurement;
+}
+
+template<class ReadoutType, class LatencyBufferType>
+void
+register_benchmarks(BenchmarkSuite& suite, const std::string& buffer_name, const std::string& type_name)
+{
+  const std::string suffix = "/" + buffer_name + "/" + type_name;
+  suite.run("write" + suffix, &write_benchmark<ReadoutType, LatencyBufferType>);
+  for (double occupancy : { 0.1, 0.5, 0.9 }) {
+    for (double gap_rate : { 0.0, 0.01 }) {
+      suite.run("lower_bound" + suffix + "/occupancy:" + std::to_string(static_cast<int>(occupancy * 100)) +
+                  "/gaps_per_mille:" + std::to_string(static_cast<int>(gap_rate * 1000)),
+                [=](double min_seconds) {
+                  return lower_bound_benchmark<ReadoutType, LatencyBufferType>(min_seconds, occupancy, gap_rate);
+                });
+    }
+  }
+  suite.run("cleanup" + suffix, &cleanup_benchmark<ReadoutType, LatencyBufferType>);
+  suite.run("request" + suffix,
+            [](double min_seconds) { return request_benchmark<ReadoutType, LatencyBufferType>(min_seconds, false); });
+  suite.run("request_retention" + suffix,
+            [](double min_seconds) { return request_benchmark<ReadoutType, LatencyBufferType>(min_seconds, true); });
+}
+
+template<class ReadoutType>
+void
+register_buffers(BenchmarkSuite& suite, const std::string& type_name)
+{
+  register_benchmarks<ReadoutType, BinarySearchQueueModel<ReadoutType>>(suite, "BinarySearchQueueModel", type_name);
+  register_benchmarks<ReadoutType, FixedRateQueueModel<ReadoutType>>(suite, "FixedRateQueueModel", type_name);
+  // Safe for the request benchmarks since the skip list keeps pinned elements from being popped
+  register_benchmarks<ReadoutType, SkipListLatencyBufferModel<ReadoutType>>(
+    suite, "SkipListLatencyBufferModel", type_name);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string argument(argv[i]);
+    if (argument == "--out" && i + 1 < argc) {
+      options.output_file = argv[++i];
+    } else if (argument == "--filter" && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (argument == "--repetitions" && i + 1 < argc) {
+      options.repetitions = std::max(std::stoi(argv[++i]), 1);
+    } else if (argument == "--min_seconds" && i + 1 < argc) {
+      options.min_seconds = std::stod(argv[++i]);
+    } else {
+      TLOG() << "usage: readoutlibs_test_benchmark [--out file.json] [--filter substring] [--repetitions n] "
+                "[--min_seconds seconds]"
+             << std::endl;
+      exit(1);
+    }
+  }
+
+  BenchmarkSuite suite(options);
+  register_buffers<SingleFrame>(suite, "DUMMY_FRAME_STRUCT");
+  register_buffers<Superchunk>(suite, "superchunk_12");
+
+  auto results = suite.to_json().dump(2);
+  if (options.output_file.empty()) {
+    std::cout << results << std::endl;
+  } else {
+    std::ofstream output(options.output_file);
+    output << results << std::endl;
+    TLOG() << "Results written to " << options.output_file << std::endl;
+  }
+  return 0;
+}
@@ -15,22 +15,24 @@
 #include <chrono>
 #include <memory>
 #include <string>
+#include <vector>
 
 using namespace dunedaq::readoutlibs;
 
 int
 main(int argc, char* argv[])
 {
-  if (argc != 2) {
-    TLOG() << "usage: readoutlibs_test_bufferedfilereader filename" << std::endl;
+  if (argc < 2 || argc > 4) {
+    TLOG() << "usage: readoutlibs_test_bufferedfilereader filename [compression_algorithm] [stream|async]"
+           << std::endl;
     exit(1);
   }
   std::string filename(argv[1]);
-  BufferedFileReader<types::DUMMY_FRAME_STRUCT> reader(filename, 8388608);
-  types::DUMMY_FRAME_STRUCT chunk;
-  for (uint i = 0; i < sizeof(chunk); ++i) {
-    (reinterpret_cast<char*>(&chunk))[i] = static_cast<char>(i); // NOLINT
-  }
+  std::string compression_algorithm = argc > 2 ? argv[2] : "None";
+  std::string io_backend = argc > 3 ? argv[3] : "stream";
+  BufferedFileReader<types::DUMMY_FRAME_STRUCT> reader(
+    filename, 8388608, compression_algorithm, io_backend == "async", io_backend);
+  std::vector<types::DUMMY_FRAME_STRUCT> chunks(1024);
 
   std::atomic<int64_t> bytes_read_total = 0;
   std::atomic<int64_t> bytes_read_since_last_statistics = 0;
@@ -51,11 +53,12 @@ main(int argc, char* argv[])
   });
 
   while (true) {
-    if (!reader.read(chunk)) {
+    size_t count = reader.read_batch(chunks.data(), chunks.size());
+    if (count == 0) {
       TLOG() << "Finished reading from file" << std::endl;
       exit(0);
     }
-    bytes_read_total += sizeof(chunk);
-    bytes_read_since_last_statistics += sizeof(chunk);
+    bytes_read_total += count * sizeof(types::DUMMY_FRAME_STRUCT);
+    bytes_read_since_last_statistics += count * sizeof(types::DUMMY_FRAME_STRUCT);
   }
 }
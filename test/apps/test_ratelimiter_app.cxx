@@ -12,22 +12,26 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <random>
+#include <thread>
 #include <vector>
 
 using namespace dunedaq::readoutlibs;
 
 int
-main(int /*argc*/, char** /*argv[]*/)
+main(int argc, char** argv)
 {
   int runsecs = 15;
+  // Optional burst size as first argument
+  std::size_t burst = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
 
   // Run marker
   std::atomic<bool> marker{ true };
 
   // RateLimiter
-  TLOG() << "Creating ratelimiter with 1MHz...";
-  RateLimiter rl(1000);
+  TLOG() << "Creating ratelimiter with 1MHz and burst size " << burst << "...";
+  RateLimiter rl(1000, burst);
 
   // Counter for ops/s
   std::atomic<int> newops = 0;
@@ -36,7 +40,10 @@ main(int /*argc*/, char** /*argv[]*/)
   auto stats = std::thread([&]() {
     TLOG() << "Spawned stats thread...";
     while (marker) {
-      TLOG() << "ops/s ->  " << newops.exchange(0);
+      auto rl_stats = rl.collect_stats();
+      TLOG() << "ops/s ->  " << newops.exchange(0) << " achieved: " << rl_stats.achieved_kilohertz
+             << "[kHz] of target: " << rl_stats.target_kilohertz << "[kHz] jitter mean: " << rl_stats.mean_jitter
+             << "[ns] max: " << rl_stats.max_jitter << "[ns]";
       std::this_thread::sleep_for(std::chrono::seconds(1));
     }
   });
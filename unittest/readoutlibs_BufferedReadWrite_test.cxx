@@ -122,6 +122,104 @@ BOOST_AUTO_TEST_CASE(BufferedReadWrite_zlib)
   test_read_write(writer, reader, numbers_to_write);
 }
 
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_zstd_chunked)
+{
+  TLOG() << "Testing chunked zstd compression" << std::endl;
+  for (std::string io_backend : { "stream", "async" }) {
+    remove("test.out");
+    BufferedFileWriter writer;
+    writer.open("test.out", 4096, "zstd_chunked", true, io_backend);
+    BufferedFileReader<int> reader;
+    uint numbers_to_write = 4096 * 4096;
+    std::vector<int> numbers(numbers_to_write / sizeof(int));
+    for (uint i = 0; i < numbers.size(); ++i) {
+      BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i)));
+    }
+    writer.close();
+
+    // The chunks are regular zstd frames
+    for (std::string compression_algorithm : { "zstd_chunked", "zstd" }) {
+      reader.open("test.out", 4096, compression_algorithm);
+      int value;
+      for (uint i = 0; i < numbers.size(); ++i) {
+        BOOST_REQUIRE(reader.read(value));
+        BOOST_REQUIRE_EQUAL(value, static_cast<int>(i));
+      }
+      BOOST_REQUIRE(!reader.read(value));
+      reader.close();
+    }
+  }
+  remove("test.out");
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_async)
+{
+  TLOG() << "Testing the async io backend" << std::endl;
+  remove("test.out");
+  BufferedFileWriter writer;
+  writer.open("test.out", 4096, "None", true, "async");
+  BufferedFileReader<int> reader;
+  reader.open("test.out", 4096);
+  uint numbers_to_write = 4096 * 4096 + 12;
+
+  test_read_write(writer, reader, numbers_to_write);
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_async_flush)
+{
+  TLOG() << "Testing flushes of unaligned data with the async io backend" << std::endl;
+  remove("test.out");
+  BufferedFileWriter writer;
+  writer.open("test.out", 8192, "None", true, "async");
+  for (int i = 0; i < 10000; ++i) {
+    BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i)));
+    if (i % 1001 == 0) {
+      BOOST_REQUIRE(writer.flush());
+    }
+  }
+  writer.close();
+
+  BufferedFileReader<int> reader("test.out", 4096);
+  int value;
+  for (int i = 0; i < 10000; ++i) {
+    BOOST_REQUIRE(reader.read(value));
+    BOOST_REQUIRE_EQUAL(value, i);
+  }
+  BOOST_REQUIRE(!reader.read(value));
+  reader.close();
+
+  remove("test.out");
+}
+
+BOOST_AUTO_TEST_CASE(BufferedReadWrite_read_ahead)
+{
+  TLOG() << "Testing batched reads with the async io backend" << std::endl;
+  for (std::string compression_algorithm : { "None", "zstd_chunked" }) {
+    remove("test.out");
+    BufferedFileWriter writer;
+    writer.open("test.out", 8192, compression_algorithm, true, "async");
+    const int numbers_to_write = 1000003;
+    for (int i = 0; i < numbers_to_write; ++i) {
+      BOOST_REQUIRE(writer.write(reinterpret_cast<char*>(&i), sizeof(i)));
+    }
+    writer.close();
+
+    BufferedFileReader<int> reader("test.out", 8192, compression_algorithm, true, "async");
+    std::vector<int> batch(997);
+    int expected = 0;
+    while (size_t count = reader.read_batch(batch.data(), batch.size())) {
+      for (size_t i = 0; i < count; ++i) {
+        BOOST_REQUIRE_EQUAL(batch[i], expected++);
+      }
+    }
+    BOOST_REQUIRE_EQUAL(expected, numbers_to_write);
+    int value;
+    BOOST_REQUIRE(!reader.read(value));
+    reader.close();
+  }
+  remove("test.out");
+}
+
 BOOST_AUTO_TEST_CASE(BufferedReadWrite_not_opened)
 {
   TLOG() << "Try to read and write on uninitialized instances" << std::endl;
@@ -0,0 +1,203 @@
+/**
+ * @file readoutlibs_IterableQueueModel_test.cxx Unit Tests for the IterableQueueModel
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_IterableQueueModel_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/models/IterableQueueModel.hpp"
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_IterableQueueModel_test)
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_write_bulk)
+{
+  IterableQueueModel<int> queue(10, false);
+  std::array<int, 6> batch{ 0, 1, 2, 3, 4, 5 };
+  std::array<const int*, 6> written{};
+
+  BOOST_REQUIRE_EQUAL(queue.write_bulk(batch.data(), batch.size(), written.data()), 6);
+  BOOST_REQUIRE_EQUAL(queue.occupancy(), 6);
+  for (size_t i = 0; i < batch.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(*written[i], static_cast<int>(i));
+  }
+  BOOST_REQUIRE_EQUAL(*queue.back(), 5);
+
+  // Wrap around the end of the buffer, only 3 slots are free
+  queue.pop(4);
+  BOOST_REQUIRE_EQUAL(queue.write_bulk(batch.data(), batch.size(), nullptr), 6);
+  BOOST_REQUIRE_EQUAL(queue.occupancy(), 8);
+  BOOST_REQUIRE_EQUAL(queue.write_bulk(batch.data(), batch.size(), written.data()), 1);
+  BOOST_REQUIRE_EQUAL(*written[0], 0);
+  BOOST_REQUIRE(queue.isFull());
+}
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_bulk_pop)
+{
+  IterableQueueModel<std::string> queue(10, false);
+  for (int round = 0; round < 5; ++round) {
+    for (int i = 0; i < 7; ++i) {
+      BOOST_REQUIRE(queue.write(std::string(100, static_cast<char>('a' + i))));
+    }
+    queue.pop(5);
+    BOOST_REQUIRE_EQUAL(queue.occupancy(), 2);
+    BOOST_REQUIRE_EQUAL(queue.front()->front(), 'f');
+    // More than the occupancy
+    queue.pop(5);
+    BOOST_REQUIRE_EQUAL(queue.occupancy(), 0);
+  }
+
+  // A pinned element is not passed
+  IterableQueueModel<int> ints(100, false);
+  for (int i = 0; i < 50; ++i) {
+    ints.write(int(i));
+  }
+  ints.pop(10);
+  auto pin = ints.pin();
+  ints.pop(20);
+  BOOST_REQUIRE_EQUAL(*ints.front(), 10);
+  ints.unpin(pin);
+  ints.pop(20);
+  BOOST_REQUIRE_EQUAL(*ints.front(), 30);
+}
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_spans)
+{
+  IterableQueueModel<int> queue(10, false);
+  for (int i = 0; i < 7; ++i) {
+    queue.write(int(i));
+  }
+  queue.pop(5);
+  for (int i = 7; i < 12; ++i) {
+    queue.write(int(i));
+  }
+  // The elements 5 to 11 wrap around the end of the ring
+  auto it = queue.begin();
+  ++it;
+  auto spans = queue.spans(it);
+  BOOST_REQUIRE_EQUAL(spans.size(), 6);
+  BOOST_REQUIRE_EQUAL(spans.parts[0].count, 4);
+  std::vector<int> seen;
+  for (auto& part : spans.parts) {
+    seen.insert(seen.end(), part.begin(), part.end());
+  }
+  BOOST_REQUIRE(seen == std::vector<int>({ 6, 7, 8, 9, 10, 11 }));
+
+  seen.clear();
+  BOOST_REQUIRE_EQUAL(queue.scan(queue.begin(),
+                                 [&](int& element) {
+                                   seen.push_back(element);
+                                   return element < 8;
+                                 }),
+                      3);
+  BOOST_REQUIRE(seen == std::vector<int>({ 5, 6, 7, 8 }));
+  BOOST_REQUIRE_EQUAL(queue.spans(queue.end()).size(), 0);
+
+  // Stepping the iterator agrees with the spans
+  int expected = 5;
+  for (auto iter = queue.begin(); iter != queue.end(); ++iter) {
+    BOOST_REQUIRE_EQUAL(*iter, expected++);
+  }
+  BOOST_REQUIRE_EQUAL(expected, 12);
+}
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_mapped_memory)
+{
+  for (std::string huge_pages : { "none", "thp", "huge_2mb" }) {
+    IterableQueueModel<int> queue(2, false);
+    queue.free_memory();
+    // Without reserved huge pages this falls back to transparent huge pages
+    queue.allocate_mapped_memory(100000, huge_pages);
+    queue.prefault_memory(4);
+    for (int i = 0; i < 1000; ++i) {
+      BOOST_REQUIRE(queue.write(int(i)));
+    }
+    BOOST_REQUIRE_EQUAL(queue.occupancy(), 1000);
+    BOOST_REQUIRE_EQUAL(*queue.front(), 0);
+    BOOST_REQUIRE_EQUAL(*queue.back(), 999);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_pin)
+{
+  IterableQueueModel<int> queue(100, false);
+  for (int i = 0; i < 50; ++i) {
+    queue.write(int(i));
+  }
+
+  auto pin = queue.pin();
+  queue.pop(10);
+  BOOST_REQUIRE_EQUAL(queue.occupancy(), 50);
+
+  // Release everything older than the element with value 20
+  auto it = queue.begin();
+  for (int i = 0; i < 20; ++i) {
+    ++it;
+  }
+  queue.advance_pin(pin, &(*it));
+  queue.pop(30);
+  BOOST_REQUIRE_EQUAL(queue.occupancy(), 30);
+  BOOST_REQUIRE_EQUAL(*queue.front(), 20);
+
+  queue.unpin(pin);
+  queue.pop(10);
+  BOOST_REQUIRE_EQUAL(*queue.front(), 30);
+}
+
+BOOST_AUTO_TEST_CASE(IterableQueueModel_pin_concurrent_pop)
+{
+  IterableQueueModel<int> queue(1000, false);
+  std::atomic<bool> run{ true };
+  std::atomic<bool> failed{ false };
+
+  std::thread producer_and_popper([&]() {
+    int value = 0;
+    while (run.load()) {
+      while (queue.write(int(value))) {
+        ++value;
+      }
+      queue.pop(queue.occupancy() / 2);
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&]() {
+      for (int i = 0; i < 10000; ++i) {
+        auto pin = queue.pin();
+        auto front = queue.front();
+        if (front != nullptr) {
+          int value = *front;
+          std::this_thread::yield();
+          if (*front != value) {
+            failed.store(true);
+          }
+        }
+        queue.unpin(pin);
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  run.store(false);
+  producer_and_popper.join();
+  BOOST_REQUIRE(!failed.load());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+/**
+ * @file readoutlibs_LatencyHistogram_test.cxx Unit Tests for the LatencyHistogram
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_LatencyHistogram_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/utils/LatencyHistogram.hpp"
+
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_LatencyHistogram_test)
+
+BOOST_AUTO_TEST_CASE(LatencyHistogram_buckets)
+{
+  for (LatencyHistogram::value_t value : { 0, 1, 15, 16, 17, 100, 1000, 123456, 987654321 }) {
+    auto index = LatencyHistogram::bucket_index(value);
+    BOOST_REQUIRE(value <= LatencyHistogram::bucket_upper_bound(index));
+    if (index > 0) {
+      BOOST_REQUIRE(value > LatencyHistogram::bucket_upper_bound(index - 1));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(LatencyHistogram_percentiles)
+{
+  LatencyHistogram hist;
+  for (LatencyHistogram::value_t value = 1; value <= 1000; ++value) {
+    hist.record(value);
+  }
+  auto summary = hist.collect();
+  BOOST_REQUIRE_EQUAL(summary.count, 1000);
+  BOOST_REQUIRE_EQUAL(summary.max, 1000);
+  // Relative error bounded by the sub bucket resolution
+  BOOST_REQUIRE(summary.p50 >= 500 && summary.p50 <= 500 + 500 / LatencyHistogram::sub_buckets);
+  BOOST_REQUIRE(summary.p99 >= 990 && summary.p99 <= 1000);
+  BOOST_REQUIRE_EQUAL(summary.p999, 1000);
+
+  // Collecting resets the histogram
+  summary = hist.collect();
+  BOOST_REQUIRE_EQUAL(summary.count, 0);
+  BOOST_REQUIRE_EQUAL(summary.max, 0);
+}
+
+BOOST_AUTO_TEST_CASE(LatencyHistogram_concurrent_record)
+{
+  LatencyHistogram hist;
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 8; ++t) {
+    writers.emplace_back([&hist]() {
+      for (LatencyHistogram::value_t value = 0; value < 10000; ++value) {
+        hist.record(value);
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  auto summary = hist.collect();
+  BOOST_REQUIRE_EQUAL(summary.count, 80000);
+  BOOST_REQUIRE_EQUAL(summary.max, 9999);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
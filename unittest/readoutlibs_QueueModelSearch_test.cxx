@@ -0,0 +1,154 @@
+/**
+ * @file readoutlibs_QueueModelSearch_test.cxx Unit Tests for the lower_bound of the searchable queue models
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_QueueModelSearch_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/models/BinarySearchQueueModel.hpp"
+#include "readoutlibs/models/FixedRateQueueModel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+namespace {
+
+struct TestElement
+{
+  uint64_t timestamp; // NOLINT(build/unsigned)
+
+  bool operator<(const TestElement& other) const { return timestamp < other.timestamp; }
+  uint64_t get_first_timestamp() const { return timestamp; } // NOLINT(build/unsigned)
+  size_t get_num_frames() const { return 1; }
+
+  static const constexpr uint64_t expected_tick_difference = 25; // NOLINT(build/unsigned)
+};
+
+// Fills the queue with elements of the given timestamps, after moving the read index forward by offset
+template<class Queue>
+void
+fill(Queue& queue, const std::vector<uint64_t>& timestamps, size_t offset = 0) // NOLINT(build/unsigned)
+{
+  for (size_t i = 0; i < offset; ++i) {
+    queue.write(TestElement{ 0 });
+  }
+  queue.pop(offset);
+  for (auto ts : timestamps) {
+    BOOST_REQUIRE(queue.write(TestElement{ ts }));
+  }
+}
+
+std::vector<uint64_t> // NOLINT(build/unsigned)
+timestamps_with_gaps(size_t num_elements)
+{
+  std::vector<uint64_t> timestamps; // NOLINT(build/unsigned)
+  uint64_t ts = 1000;               // NOLINT(build/unsigned)
+  for (size_t i = 0; i < num_elements; ++i) {
+    timestamps.push_back(ts);
+    ts += (i % 7 == 3) ? 4 * TestElement::expected_tick_difference : TestElement::expected_tick_difference;
+  }
+  return timestamps;
+}
+
+// Reference result: the last element not greater than the searched timestamp
+template<class Queue>
+void
+check_floor(Queue& queue, const std::vector<uint64_t>& timestamps, uint64_t ts, bool with_errors) // NOLINT
+{
+  TestElement key{ ts };
+  auto it = queue.lower_bound(key, with_errors);
+  if (ts < timestamps.front()) {
+    BOOST_REQUIRE(it == queue.end());
+    return;
+  }
+  size_t expected = 0;
+  while (expected + 1 < timestamps.size() && timestamps[expected + 1] <= ts) {
+    ++expected;
+  }
+  BOOST_REQUIRE(it != queue.end());
+  BOOST_REQUIRE_EQUAL(it->get_first_timestamp(), timestamps[expected]);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_QueueModelSearch_test)
+
+BOOST_AUTO_TEST_CASE(BinarySearch_floor)
+{
+  auto timestamps = timestamps_with_gaps(1000);
+  for (size_t offset : { 0, 700 }) {
+    BinarySearchQueueModel<TestElement> queue(1200);
+    fill(queue, timestamps, offset);
+    for (uint64_t ts = 900; ts < timestamps.back() + 100; ts += 7) { // NOLINT(build/unsigned)
+      check_floor(queue, timestamps, ts, false);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(BinarySearch_timestamp_index)
+{
+  auto timestamps = timestamps_with_gaps(1000);
+  for (size_t stride : { 1, 16, 1000 }) {
+    for (size_t offset : { 0, 700, 1193 }) {
+      BinarySearchQueueModel<TestElement> queue(1200, stride);
+      fill(queue, timestamps, offset);
+      for (uint64_t ts = 900; ts < timestamps.back() + 100; ts += 7) { // NOLINT(build/unsigned)
+        check_floor(queue, timestamps, ts, false);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FixedRate_contiguous)
+{
+  std::vector<uint64_t> timestamps; // NOLINT(build/unsigned)
+  for (size_t i = 0; i < 1000; ++i) {
+    timestamps.push_back(1000 + i * TestElement::expected_tick_difference);
+  }
+  FixedRateQueueModel<TestElement> queue(1200);
+  fill(queue, timestamps, 500);
+  for (uint64_t ts = 900; ts <= timestamps.back(); ts += 11) { // NOLINT(build/unsigned)
+    check_floor(queue, timestamps, ts, false);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FixedRate_missing_frames)
+{
+  auto timestamps = timestamps_with_gaps(1000);
+  for (size_t offset : { 0, 700 }) {
+    FixedRateQueueModel<TestElement> queue(1200);
+    fill(queue, timestamps, offset);
+    for (uint64_t ts = 900; ts < timestamps.back() + 100; ts += 7) { // NOLINT(build/unsigned)
+      check_floor(queue, timestamps, ts, true);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(BinarySearch_pop_older_than)
+{
+  auto timestamps = timestamps_with_gaps(1000);
+  BinarySearchQueueModel<TestElement> queue(1200);
+  fill(queue, timestamps, 700);
+
+  // Bounded by the amount
+  BOOST_REQUIRE_EQUAL(queue.pop_older_than(TestElement{ timestamps[500] }, 100), 100);
+  BOOST_REQUIRE_EQUAL(queue.front()->get_first_timestamp(), timestamps[100]);
+  // Bounded by the element, also between two timestamps
+  BOOST_REQUIRE_EQUAL(queue.pop_older_than(TestElement{ timestamps[400] + 1 }, 1000), 301);
+  BOOST_REQUIRE_EQUAL(queue.front()->get_first_timestamp(), timestamps[401]);
+  BOOST_REQUIRE_EQUAL(queue.pop_older_than(TestElement{ 0 }, 1000), 0);
+  BOOST_REQUIRE_EQUAL(queue.pop_older_than(TestElement{ timestamps.back() + 1 }, 1000), 599);
+  BOOST_REQUIRE_EQUAL(queue.occupancy(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,163 @@
+/**
+ * @file readoutlibs_RequestHandlerPin_test.cxx Unit Tests for the latency buffer pins of the request handler
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_RequestHandlerPin_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/FrameErrorRegistry.hpp"
+#include "readoutlibs/ReadoutTypes.hpp"
+#include "readoutlibs/models/BinarySearchQueueModel.hpp"
+#include "readoutlibs/models/DefaultRequestHandlerModel.hpp"
+#include "readoutlibs/models/SkipListLatencyBufferModel.hpp"
+#include "readoutlibs/readoutconfig/Nljs.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+using namespace dunedaq::readoutlibs;
+
+namespace {
+
+constexpr uint64_t tick_difference = 25; // NOLINT(build/unsigned)
+
+struct TestElement
+{
+  using FrameType = types::DUMMY_FRAME_STRUCT;
+
+  FrameType frame;
+
+  bool operator<(const TestElement& other) const { return get_first_timestamp() < other.get_first_timestamp(); }
+  uint64_t get_first_timestamp() const { return frame.get_timestamp(); } // NOLINT(build/unsigned)
+  void set_first_timestamp(uint64_t ts) { frame.set_timestamp(ts); }   // NOLINT(build/unsigned)
+
+  size_t get_payload_size() const { return sizeof(frame); }
+  size_t get_num_frames() const { return 1; }
+  size_t get_frame_size() const { return sizeof(FrameType); }
+
+  FrameType* begin() { return &frame; }
+  FrameType* end() { return &frame + 1; }
+
+  static const constexpr dunedaq::daqdataformats::GeoID::SystemType system_type =
+    dunedaq::daqdataformats::GeoID::SystemType::kTPC;
+  static const constexpr dunedaq::daqdataformats::FragmentType fragment_type =
+    dunedaq::daqdataformats::FragmentType::kUnknown;
+  static const constexpr uint64_t expected_tick_difference = tick_difference; // NOLINT(build/unsigned)
+};
+
+// Runs a hook while a request holds its pin on the window
+template<class LatencyBufferType>
+class HookedBuffer : public LatencyBufferType
+{
+public:
+  using LatencyBufferType::LatencyBufferType;
+
+  void advance_pin(int pin, const TestElement* element) override
+  {
+    LatencyBufferType::advance_pin(pin, element);
+    if (m_hook) {
+      m_hook();
+    }
+  }
+
+  std::function<void()> m_hook;
+};
+
+template<class LatencyBufferType>
+class TestRequestHandler : public DefaultRequestHandlerModel<TestElement, LatencyBufferType>
+{
+public:
+  using DefaultRequestHandlerModel<TestElement, LatencyBufferType>::DefaultRequestHandlerModel;
+  using DefaultRequestHandlerModel<TestElement, LatencyBufferType>::cleanup;
+  using DefaultRequestHandlerModel<TestElement, LatencyBufferType>::data_request;
+  using typename DefaultRequestHandlerModel<TestElement, LatencyBufferType>::ResultCode;
+};
+
+std::unique_ptr<HookedBuffer<BinarySearchQueueModel<TestElement>>>
+make_buffer(HookedBuffer<BinarySearchQueueModel<TestElement>>*, size_t capacity)
+{
+  return std::make_unique<HookedBuffer<BinarySearchQueueModel<TestElement>>>(capacity);
+}
+
+// The skip list grows as needed
+std::unique_ptr<HookedBuffer<SkipListLatencyBufferModel<TestElement>>>
+make_buffer(HookedBuffer<SkipListLatencyBufferModel<TestElement>>*, size_t /*capacity*/)
+{
+  return std::make_unique<HookedBuffer<SkipListLatencyBufferModel<TestElement>>>();
+}
+
+template<class LatencyBufferType>
+void
+cleanup_during_request()
+{
+  using Buffer = HookedBuffer<LatencyBufferType>;
+  using Handler = TestRequestHandler<Buffer>;
+  const size_t capacity = 1000;
+  const size_t num_elements = 900;
+  std::unique_ptr<Buffer> buffer = make_buffer(static_cast<Buffer*>(nullptr), capacity);
+  std::unique_ptr<FrameErrorRegistry> error_registry = std::make_unique<FrameErrorRegistry>();
+  Handler handler(buffer, error_registry);
+
+  readoutconfig::RequestHandlerConf conf;
+  conf.latency_buffer_size = capacity;
+  conf.pop_limit_pct = 0.1;
+  conf.pop_size_pct = 0.9;
+  conf.num_request_handling_threads = 1;
+  conf.enable_raw_recording = false;
+  nlohmann::json args;
+  args["requesthandlerconf"] = conf;
+  handler.conf(args);
+
+  for (size_t i = 0; i < num_elements; ++i) {
+    TestElement element;
+    element.set_first_timestamp(i * tick_difference);
+    BOOST_REQUIRE(buffer->write(std::move(element)));
+  }
+
+  const size_t window_first = 600;
+  const size_t window_size = 10;
+  dunedaq::dfmessages::DataRequest request;
+  request.request_information.window_begin = window_first * tick_difference;
+  request.request_information.window_end = (window_first + window_size) * tick_difference;
+  request.trigger_timestamp = request.request_information.window_begin;
+
+  // The elements older than the window go, the window stays while the fragment is built
+  size_t occupancy_during_request = 0;
+  buffer->m_hook = [&]() {
+    handler.cleanup();
+    occupancy_during_request = buffer->occupancy();
+  };
+  auto result = handler.data_request(request);
+  buffer->m_hook = nullptr;
+
+  BOOST_REQUIRE(result.result_code == Handler::ResultCode::kFound);
+  BOOST_REQUIRE_EQUAL(occupancy_during_request, num_elements - window_first);
+  BOOST_REQUIRE_EQUAL(buffer->front()->get_first_timestamp(), window_first * tick_difference);
+  BOOST_REQUIRE_EQUAL(result.fragment->get_size(),
+                      sizeof(dunedaq::daqdataformats::FragmentHeader) + window_size * sizeof(TestElement));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_RequestHandlerPin_test)
+
+BOOST_AUTO_TEST_CASE(RequestHandlerPin_cleanup_during_request)
+{
+  cleanup_during_request<BinarySearchQueueModel<TestElement>>();
+}
+
+BOOST_AUTO_TEST_CASE(RequestHandlerPin_cleanup_during_request_skiplist)
+{
+  cleanup_during_request<SkipListLatencyBufferModel<TestElement>>();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
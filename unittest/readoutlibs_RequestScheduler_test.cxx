@@ -0,0 +1,118 @@
+/**
+ * @file readoutlibs_RequestScheduler_test.cxx Unit Tests for the scheduling policies of the RequestScheduler
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_RequestScheduler_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/utils/RequestScheduler.hpp"
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+namespace {
+
+// Runs the jobs on a single thread that is kept busy until all of them are queued, returns the order they ran in
+std::vector<int>
+dispatch_order(RequestScheduler::Policy policy, const std::vector<RequestScheduler::Key>& keys)
+{
+  std::vector<int> order;
+  std::mutex order_mutex;
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  {
+    RequestScheduler scheduler(1, policy);
+    scheduler.submit({ 0, 0, "" }, [released]() { released.wait(); });
+    for (size_t i = 0; i < keys.size(); ++i) {
+      scheduler.submit(keys[i], [&, i]() {
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(static_cast<int>(i));
+      });
+    }
+    release.set_value();
+    scheduler.join();
+    BOOST_REQUIRE_EQUAL(scheduler.depth(), 0);
+  }
+  return order;
+}
+
+const std::vector<RequestScheduler::Key> keys{
+  { 300, 10, "a" }, { 100, 5000, "a" }, { 200, 50, "a" }, { 400, 20, "b" }, { 100, 30, "c" },
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_RequestScheduler_test)
+
+BOOST_AUTO_TEST_CASE(RequestScheduler_policies)
+{
+  BOOST_REQUIRE(dispatch_order(RequestScheduler::Policy::fifo, keys) == std::vector<int>({ 0, 1, 2, 3, 4 }));
+  // Ties on the deadline are served in submission order
+  BOOST_REQUIRE(dispatch_order(RequestScheduler::Policy::earliest_deadline, keys) ==
+                std::vector<int>({ 1, 4, 2, 0, 3 }));
+  BOOST_REQUIRE(dispatch_order(RequestScheduler::Policy::smallest_window, keys) ==
+                std::vector<int>({ 0, 3, 4, 2, 1 }));
+  BOOST_REQUIRE(dispatch_order(RequestScheduler::Policy::destination_fair, keys) ==
+                std::vector<int>({ 0, 3, 4, 1, 2 }));
+}
+
+BOOST_AUTO_TEST_CASE(RequestScheduler_parse_policy)
+{
+  RequestScheduler::Policy policy = RequestScheduler::Policy::fifo;
+  BOOST_REQUIRE(RequestScheduler::parse_policy("destination_fair", policy));
+  BOOST_REQUIRE(policy == RequestScheduler::Policy::destination_fair);
+  BOOST_REQUIRE(!RequestScheduler::parse_policy("lifo", policy));
+  BOOST_REQUIRE(policy == RequestScheduler::Policy::destination_fair);
+}
+
+BOOST_AUTO_TEST_CASE(RequestScheduler_rekey)
+{
+  std::vector<int> order;
+  std::mutex order_mutex;
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  RequestScheduler scheduler(1, RequestScheduler::Policy::earliest_deadline);
+  auto blocker = scheduler.submit({ 0, 0, "" }, [released]() { released.wait(); });
+  std::vector<RequestScheduler::ticket_t> tickets;
+  for (int i = 0; i < 3; ++i) {
+    tickets.push_back(scheduler.submit({ static_cast<uint64_t>(300 - 100 * i), 0, "" }, [&, i]() { // NOLINT
+      std::lock_guard<std::mutex> lock(order_mutex);
+      order.push_back(i);
+    }));
+  }
+  // Moved to the front and to the back, the outdated positions are skipped
+  BOOST_REQUIRE(scheduler.rekey(tickets[0], { 50, 0, "" }));
+  BOOST_REQUIRE(scheduler.rekey(tickets[2], { 400, 0, "" }));
+  release.set_value();
+  scheduler.join();
+  BOOST_REQUIRE(order == std::vector<int>({ 0, 1, 2 }));
+  BOOST_REQUIRE(!scheduler.rekey(blocker, { 0, 0, "" }));
+  BOOST_REQUIRE_EQUAL(scheduler.depth(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(RequestScheduler_many_threads)
+{
+  std::atomic<int> done{ 0 };
+  RequestScheduler scheduler(4, RequestScheduler::Policy::earliest_deadline);
+  for (int i = 0; i < 10000; ++i) {
+    scheduler.submit({ static_cast<uint64_t>(i % 97), 0, "" }, [&]() { ++done; }); // NOLINT(build/unsigned)
+  }
+  scheduler.join();
+  BOOST_REQUIRE_EQUAL(done.load(), 10000);
+  BOOST_REQUIRE_EQUAL(scheduler.collect_dispatch_wait().count, 10000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,71 @@
+/**
+ * @file readoutlibs_ShardedCounter_test.cxx Unit Tests for the ShardedCounter
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_ShardedCounter_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/utils/ShardedCounter.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_ShardedCounter_test)
+
+BOOST_AUTO_TEST_CASE(ShardedCounter_collect)
+{
+  ShardedCounter counter;
+  ++counter;
+  counter += 41;
+  BOOST_REQUIRE_EQUAL(counter.total(), 42);
+
+  auto begin = ShardedCounter::clock_t::now();
+  auto collected = counter.collect(begin);
+  BOOST_REQUIRE_EQUAL(collected.delta, 42);
+
+  // Collecting keeps the total, the next delta only holds the new increments
+  counter += 10;
+  collected = counter.collect(begin + std::chrono::seconds(2));
+  BOOST_REQUIRE_EQUAL(collected.delta, 10);
+  BOOST_REQUIRE_CLOSE(collected.rate, 5., 1e-9);
+  BOOST_REQUIRE_EQUAL(counter.total(), 52);
+
+  // Counts beyond 32 bits
+  counter += 5000000000;
+  BOOST_REQUIRE_EQUAL(counter.collect().delta, 5000000000);
+
+  counter.reset();
+  BOOST_REQUIRE_EQUAL(counter.total(), 0);
+  BOOST_REQUIRE_EQUAL(counter.collect().delta, 0);
+}
+
+BOOST_AUTO_TEST_CASE(ShardedCounter_concurrent_add)
+{
+  ShardedCounter counter;
+  std::vector<std::thread> writers;
+  for (size_t t = 0; t < 2 * ShardedCounter::num_shards; ++t) {
+    writers.emplace_back([&counter]() {
+      for (int i = 0; i < 100000; ++i) {
+        ++counter;
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  BOOST_REQUIRE_EQUAL(counter.total(), 2 * ShardedCounter::num_shards * 100000);
+  BOOST_REQUIRE_EQUAL(counter.collect().delta, 2 * ShardedCounter::num_shards * 100000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,133 @@
+/**
+ * @file readoutlibs_TimeBucketLatencyBuffer_test.cxx Unit Tests for the TimeBucketLatencyBufferModel
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE readoutlibs_TimeBucketLatencyBuffer_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "readoutlibs/models/TimeBucketLatencyBufferModel.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::readoutlibs;
+
+namespace {
+
+struct TestElement
+{
+  uint64_t timestamp; // NOLINT(build/unsigned)
+
+  bool operator<(const TestElement& other) const { return timestamp < other.timestamp; }
+  uint64_t get_first_timestamp() const { return timestamp; } // NOLINT(build/unsigned)
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(readoutlibs_TimeBucketLatencyBuffer_test)
+
+BOOST_AUTO_TEST_CASE(TimeBucket_out_of_order)
+{
+  TimeBucketLatencyBufferModel<TestElement> buffer(1000, 100);
+  // Every bucket of 100 ticks gets 10 elements, written in reverse order
+  for (uint64_t ts = 1000; ts > 0; ts -= 10) { // NOLINT(build/unsigned)
+    BOOST_REQUIRE(buffer.write(TestElement{ ts }));
+  }
+  BOOST_REQUIRE_EQUAL(buffer.occupancy(), 100);
+  BOOST_REQUIRE_EQUAL(buffer.front()->timestamp, 10);
+  BOOST_REQUIRE_EQUAL(buffer.back()->timestamp, 1000);
+
+  uint64_t expected = 10; // NOLINT(build/unsigned)
+  for (auto it = buffer.begin(); it != buffer.end(); ++it) {
+    BOOST_REQUIRE_EQUAL(it->timestamp, expected);
+    expected += 10;
+  }
+  BOOST_REQUIRE_EQUAL(expected, 1010);
+
+  // The last element not greater than the searched one, also across bucket borders
+  for (uint64_t ts : { 10, 15, 99, 100, 101, 555, 1000, 2000 }) { // NOLINT(build/unsigned)
+    TestElement key{ ts };
+    auto it = buffer.lower_bound(key, false);
+    BOOST_REQUIRE(it.good());
+    BOOST_REQUIRE_EQUAL(it->timestamp, std::min<uint64_t>(ts / 10 * 10, 1000)); // NOLINT(build/unsigned)
+  }
+  TestElement too_early{ 5 };
+  BOOST_REQUIRE(buffer.lower_bound(too_early, false) == buffer.end());
+}
+
+BOOST_AUTO_TEST_CASE(TimeBucket_pop_and_pins)
+{
+  TimeBucketLatencyBufferModel<TestElement> buffer(50, 100);
+  for (uint64_t ts = 0; ts < 60; ++ts) { // NOLINT(build/unsigned)
+    BOOST_REQUIRE_EQUAL(buffer.write(TestElement{ ts * 10 }), ts < 50);
+  }
+
+  // Oldest first
+  buffer.pop(15);
+  BOOST_REQUIRE_EQUAL(buffer.occupancy(), 35);
+  BOOST_REQUIRE_EQUAL(buffer.front()->timestamp, 150);
+  BOOST_REQUIRE_EQUAL(buffer.pop_older_than(TestElement{ 205 }, 100), 6);
+  BOOST_REQUIRE_EQUAL(buffer.front()->timestamp, 210);
+
+  // A pin blocks all pops until it is advanced or released
+  auto pin = buffer.pin();
+  buffer.pop(10);
+  BOOST_REQUIRE_EQUAL(buffer.front()->timestamp, 210);
+  TestElement key{ 300 };
+  auto it = buffer.lower_bound(key, false);
+  buffer.advance_pin(pin, &(*it));
+  buffer.pop(100);
+  BOOST_REQUIRE_EQUAL(buffer.front()->timestamp, 300);
+  buffer.unpin(pin);
+  buffer.flush();
+  BOOST_REQUIRE_EQUAL(buffer.occupancy(), 0);
+  BOOST_REQUIRE(buffer.front() == nullptr);
+  BOOST_REQUIRE(buffer.begin() == buffer.end());
+}
+
+BOOST_AUTO_TEST_CASE(TimeBucket_multiple_producers)
+{
+  TimeBucketLatencyBufferModel<TestElement> buffer(1000000, 64);
+  const int num_producers = 4;
+  const int per_producer = 20000;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < per_producer; ++i) {
+        buffer.write(TestElement{ static_cast<uint64_t>(i * num_producers + p) }); // NOLINT(build/unsigned)
+      }
+    });
+  }
+  std::thread evictor([&]() {
+    TestElement newest{ UINT64_MAX };
+    for (size_t popped = 0; popped < 10000;) {
+      popped += buffer.pop_older_than(newest, std::min<size_t>(100, 10000 - popped));
+    }
+  });
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  evictor.join();
+
+  BOOST_REQUIRE_EQUAL(buffer.occupancy(), num_producers * per_producer - 10000);
+  size_t count = 0;
+  uint64_t previous = 0; // NOLINT(build/unsigned)
+  for (auto it = buffer.begin(); it != buffer.end(); ++it) {
+    BOOST_REQUIRE(it->timestamp >= previous);
+    previous = it->timestamp;
+    ++count;
+  }
+  BOOST_REQUIRE_EQUAL(count, buffer.occupancy());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,5 +1,5 @@
 /**
- * @file readoutlibs_VariableSizeElementQueue_test.cxx Unit Tests for the VariableSizeElementQueue
+ * @file readoutlibs_VariableSizeElementQueue_test.cxx Unit Tests for the VariableSizeElementQueueModel
  *
  * This is part of the DUNE DAQ Application Framework, copyright 2020.
  * Licensing/copyright details are in the COPYING file that you should have
@@ -13,161 +13,126 @@
 
 #include "boost/test/unit_test.hpp"
 
-#include "readout/ReadoutTypes.hpp"
-#include "readout/utils/SearchableProducerConsumerQueue.hpp"
+#include "readoutlibs/models/VariableSizeElementQueueModel.hpp"
 
-#include <cstdio>
-#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <utility>
+#include <vector>
 
-using namespace dunedaq::readout;
+using namespace dunedaq::readoutlibs;
 
-BOOST_AUTO_TEST_SUITE(readoutlibs_VariableSizeElementQueue_test)
+namespace {
 
-struct KeyGetter
+struct TestPayload
 {
-  uint32_t operator()(types::VariableSizePayloadWrapper& wrapper) // NOLINT(build/unsigned)
-  {
-    uint32_t timestamp;                                       // NOLINT(build/unsigned)
-    memcpy(&timestamp, wrapper.data.get(), sizeof(uint32_t)); // NOLINT(build/unsigned)
-    return timestamp;
-  }
+  uint64_t timestamp; // NOLINT(build/unsigned)
+  char* payload;
+  uint32_t size; // NOLINT(build/unsigned)
+
+  bool operator<(const TestPayload& other) const { return timestamp < other.timestamp; }
+  uint64_t get_first_timestamp() const { return timestamp; } // NOLINT(build/unsigned)
+  char* begin() { return payload; }
+  std::size_t get_payload_size() const { return size; }
+  void set_payload(void* new_payload) { payload = static_cast<char*>(new_payload); }
 };
 
-BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_find)
+// Writes a payload of the given size, filled with the low byte of the timestamp, from a reused scratch buffer
+bool
+write_payload(VariableSizeElementQueueModel<TestPayload>& queue, uint64_t timestamp, uint32_t size) // NOLINT
 {
-  TLOG() << "Fill up a queue and check if the elements can be found" << std::endl;
-  SearchableProducerConsumerQueue<types::VariableSizePayloadWrapper, uint32_t, KeyGetter> // NOLINT(build/unsigned)
-    queue(10000);
-  for (uint32_t timestamp_counter = 0; timestamp_counter < 10000; timestamp_counter += 10) { // NOLINT(build/unsigned)
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
-
-    for (uint32_t expected_timestamp = 0; expected_timestamp <= timestamp_counter; // NOLINT(build/unsigned)
-         expected_timestamp += 10) {
-      uint32_t timestamp; // NOLINT(build/unsigned)
-      types::VariableSizePayloadWrapper* found_element = queue.find_element(expected_timestamp);
-      BOOST_REQUIRE(found_element);
-      std::memcpy(&timestamp, found_element->data.get(), sizeof(timestamp));
-      BOOST_REQUIRE_EQUAL(expected_timestamp, timestamp);
-    }
-  }
+  static std::vector<char> scratch;
+  scratch.assign(size, static_cast<char>(timestamp));
+  return queue.write(TestPayload{ timestamp, scratch.data(), size });
 }
 
-BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_find_upper)
+bool
+payload_matches(TestPayload& element)
 {
-  TLOG() << "Search for elements that are not in the queue" << std::endl;
-  SearchableProducerConsumerQueue<types::VariableSizePayloadWrapper, uint32_t, KeyGetter> // NOLINT(build/unsigned)
-    queue(10000);
-  for (uint32_t timestamp_counter = 10; timestamp_counter < 10000; timestamp_counter += 10) { // NOLINT(build/unsigned)
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
-
-    for (uint32_t expected_timestamp = 5; expected_timestamp <= timestamp_counter; // NOLINT(build/unsigned)
-         expected_timestamp += 10) {
-      uint32_t timestamp; // NOLINT(build/unsigned)
-      types::VariableSizePayloadWrapper* found_element = queue.find_element(expected_timestamp);
-      BOOST_REQUIRE(found_element);
-      std::memcpy(&timestamp, found_element->data.get(), sizeof(timestamp));
-      BOOST_REQUIRE_EQUAL(expected_timestamp + 5, timestamp);
+  for (std::size_t i = 0; i < element.size; ++i) {
+    if (element.payload[i] != static_cast<char>(element.timestamp)) {
+      return false;
     }
   }
+  return true;
 }
 
-BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_find_outside)
-{
-  TLOG() << "Try to find elements that are bigger than the biggest one in the queue" << std::endl;
-  SearchableProducerConsumerQueue<types::VariableSizePayloadWrapper, uint32_t, KeyGetter> // NOLINT(build/unsigned)
-    queue(10);
-  char* payload = static_cast<char*>(malloc(1024));
-  uint32_t timestamp = 42;                       // NOLINT(build/unsigned)
-  memcpy(payload, &timestamp, sizeof(uint32_t)); // NOLINT(build/unsigned)
-  types::VariableSizePayloadWrapper wrapper(1024, payload);
-  bool queue_write = queue.write(std::move(wrapper));
-  BOOST_REQUIRE(queue_write);
-
-  types::VariableSizePayloadWrapper* found_element = queue.find_element(100);
-  BOOST_REQUIRE_EQUAL(found_element, nullptr);
-}
-
-BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_overrun)
-{
-  TLOG() << "Cause an overrun of the cyclic buffer" << std::endl;
-  SearchableProducerConsumerQueue<types::VariableSizePayloadWrapper, uint32_t, KeyGetter> // NOLINT(build/unsigned)
-    queue(1001);
-  for (uint32_t timestamp_counter = 0; timestamp_counter < 1000; ++timestamp_counter) { // NOLINT(build/unsigned)
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
-  }
+} // namespace
 
-  for (int i = 0; i < 500; ++i) {
-    types::VariableSizePayloadWrapper wrapper;
-    bool read_successful = queue.read(wrapper);
-    BOOST_REQUIRE(read_successful);
-  }
+BOOST_AUTO_TEST_SUITE(readoutlibs_VariableSizeElementQueue_test)
 
-  for (uint32_t timestamp_counter = 1000; timestamp_counter < 1500; ++timestamp_counter) { // NOLINT(build/unsigned)
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
+BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_find)
+{
+  TLOG() << "Fill up a queue and check if the elements can be found" << std::endl;
+  VariableSizeElementQueueModel<TestPayload> queue(1001, 1 << 20);
+  for (uint64_t ts = 10; ts <= 10000; ts += 10) { // NOLINT(build/unsigned)
+    BOOST_REQUIRE(write_payload(queue, ts, 100 + ts % 900));
   }
 
-  for (uint32_t expected_timestamp = 500; expected_timestamp < 1500; ++expected_timestamp) { // NOLINT(build/unsigned)
-    uint32_t timestamp;                                                                      // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper* found_element = queue.find_element(expected_timestamp);
-    BOOST_REQUIRE(found_element);
-    std::memcpy(&timestamp, found_element->data.get(), sizeof(timestamp));
-    BOOST_REQUIRE_EQUAL(expected_timestamp, timestamp);
+  for (uint64_t ts = 5; ts < 10005; ts += 5) { // NOLINT(build/unsigned)
+    TestPayload key{ ts, nullptr, 0 };
+    auto it = queue.lower_bound(key, false);
+    if (ts < 10) {
+      BOOST_REQUIRE(it == queue.end());
+      continue;
+    }
+    BOOST_REQUIRE(it.good());
+    BOOST_REQUIRE_EQUAL(it->timestamp, ts / 10 * 10);
+    BOOST_REQUIRE_EQUAL(it->size, 100 + it->timestamp % 900);
+    BOOST_REQUIRE(payload_matches(*it));
   }
 }
 
-BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_overrun_find_upper)
+BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_arena_wrap)
 {
-  TLOG() << "Cause an overrun of the cyclic buffer and search for upper timestamps" << std::endl;
-  SearchableProducerConsumerQueue<types::VariableSizePayloadWrapper, uint32_t, KeyGetter> // NOLINT(build/unsigned)
-    queue(1001);
-  for (uint32_t timestamp_counter = 10; timestamp_counter < 10000; timestamp_counter += 10) { // NOLINT(build/unsigned)
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
-  }
-
-  for (int i = 0; i < 500; ++i) {
-    types::VariableSizePayloadWrapper wrapper;
-    bool read_successful = queue.read(wrapper);
-    BOOST_REQUIRE(read_successful);
+  TLOG() << "Cycle variable size payloads through a small arena" << std::endl;
+  VariableSizeElementQueueModel<TestPayload> queue(1000, 4096);
+  uint64_t next = 0;   // NOLINT(build/unsigned)
+  uint64_t oldest = 0; // NOLINT(build/unsigned)
+  for (int round = 0; round < 1000; ++round) {
+    // Fill the arena, then free a few records at its tail
+    while (write_payload(queue, next, 1 + (next * 37) % 300)) {
+      ++next;
+    }
+    BOOST_REQUIRE(queue.occupancy() > 0);
+    BOOST_REQUIRE(queue.arena_occupancy() <= queue.arena_size());
+    uint64_t expected = oldest; // NOLINT(build/unsigned)
+    for (auto it = queue.begin(); it != queue.end(); ++it) {
+      BOOST_REQUIRE_EQUAL(it->timestamp, expected++);
+      BOOST_REQUIRE(payload_matches(*it));
+    }
+    BOOST_REQUIRE_EQUAL(expected, next);
+    std::size_t to_pop = std::min<std::size_t>(1 + round % 5, queue.occupancy());
+    queue.pop(to_pop);
+    oldest += to_pop;
+    BOOST_REQUIRE_EQUAL(queue.front()->timestamp, oldest);
   }
+  queue.flush();
+  BOOST_REQUIRE_EQUAL(queue.arena_occupancy(), 0);
+}
 
-  for (uint32_t timestamp_counter = 10000; timestamp_counter < 15000; // NOLINT(build/unsigned)
-       timestamp_counter += 10) {
-    char* payload = static_cast<char*>(malloc(1024));
-    memcpy(payload, &timestamp_counter, sizeof(uint32_t)); // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper wrapper(1024, payload);
-    bool queue_write = queue.write(std::move(wrapper));
-    BOOST_REQUIRE(queue_write);
+BOOST_AUTO_TEST_CASE(VariableSizeElementQueue_overrun)
+{
+  TLOG() << "Reject payloads once either the index or the arena is full" << std::endl;
+  VariableSizeElementQueueModel<TestPayload> index_bound(11, 1 << 20);
+  for (uint64_t ts = 0; ts < 20; ++ts) { // NOLINT(build/unsigned)
+    BOOST_REQUIRE_EQUAL(write_payload(index_bound, ts, 64), ts < 10);
   }
 
-  for (uint32_t expected_timestamp = 5005; expected_timestamp < 14995; // NOLINT(build/unsigned)
-       expected_timestamp += 10) {
-    uint32_t timestamp; // NOLINT(build/unsigned)
-    types::VariableSizePayloadWrapper* found_element = queue.find_element(expected_timestamp);
-    BOOST_REQUIRE(found_element);
-    std::memcpy(&timestamp, found_element->data.get(), sizeof(timestamp));
-    BOOST_REQUIRE_EQUAL(expected_timestamp + 5, timestamp);
+  VariableSizeElementQueueModel<TestPayload> arena_bound(1000, 1024);
+  BOOST_REQUIRE(!write_payload(arena_bound, 0, 2048));
+  std::size_t written = 0;
+  while (write_payload(arena_bound, written, 100)) {
+    ++written;
   }
+  BOOST_REQUIRE_EQUAL(written, 8);
+  // A record never ends right at the oldest one, so a single free slot is not enough after a wrap
+  arena_bound.pop(1);
+  BOOST_REQUIRE(!write_payload(arena_bound, written, 100));
+  arena_bound.pop(1);
+  BOOST_REQUIRE(write_payload(arena_bound, written, 100));
+  BOOST_REQUIRE(!write_payload(arena_bound, written + 1, 100));
 }
 
 BOOST_AUTO_TEST_SUITE_END()